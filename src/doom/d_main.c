@@ -79,6 +79,7 @@
 #endif
 
 #include "d_main.h"
+#include "fb_hash.h"
 #if PICO_BUILD
 #include "i_picosound.h"
 #if USB_SUPPORT
@@ -275,6 +276,15 @@ boolean D_Display (void)
 #endif
 	    R_RenderPlayerView (&players[displayplayer]);
 
+#if !PICO_DOOM
+    // hash the frame (for -fbhash) before the hu or any menu is drawn on it;
+    // doom_tiny hashes the same frames in pd_render, also before its overlays
+    if (gamestate == GS_LEVEL && !wipe && !inhelpscreens && !automapactive)
+    {
+        FB_HashFrame(gametic, I_VideoBuffer, SCREENHEIGHT);
+    }
+#endif
+
 #if !DOOM_TINY
     if (gamestate == GS_LEVEL && gametic)
 	HU_Drawer ();
@@ -348,7 +358,6 @@ boolean D_Display (void)
 #if PICO_DOOM
     pd_end_frame(wipe);
 #else
-
     // menus go directly to the screen
     M_Drawer ();          // menu is drawn even on top of everything
 #endif
@@ -515,6 +524,9 @@ void D_RunFrame()
         } while (wipestate);
 #endif
     }
+#if DOOM_TINY && PRINT_TOUCHED_LUMPS
+    W_EndTouchedLumpsFrame();
+#endif
 }
 
 //
@@ -1761,6 +1773,25 @@ void D_DoomMain (void)
 
         printf("Playing demo %s.\n", file);
     }
+
+#if !PICO_DOOM
+    //!
+    // @arg <file>
+    // @category demo
+    //
+    // Write a hash of each frame of the level view to <file>, for
+    // comparison with another renderer (or build) using fbhash_diff.
+    // doom_tiny does the same when the PD_FBHASH environment variable
+    // is set.
+    //
+
+    p = M_CheckParmWithArgs("-fbhash", 1);
+
+    if (p && !FB_HashOpen(myargv[p + 1]))
+    {
+        I_Error("Failed to open %s for writing", myargv[p + 1]);
+    }
+#endif
 #endif
 
 #if !NO_DEMO_RECORDING || !PICO_NO_TIMING_DEMO
@@ -2106,6 +2137,11 @@ void D_DoomMain (void)
 	D_DoomLoop ();  // never returns
     }
 #endif
+#if PD_TIMEDEMO
+    // no command line in doom_tiny, so the headless benchmark build always times the embedded demos
+    G_TimeDemo (pd_timedemo_next_demo());
+    D_DoomLoop ();  // never returns
+#endif
 
 #if !DOOM_TINY
     if (startloadgame >= 0)
@@ -2560,7 +2560,7 @@ void G_DoPlayDemo (void)
 //
 // G_TimeDemo 
 //
-void G_TimeDemo (char* name) 
+void G_TimeDemo (const char* name) 
 {
     //!
     // @category video
@@ -2596,6 +2596,12 @@ boolean G_CheckDemoStatus (void)
 
     if (timingdemo)
     { 
+#if PD_TIMEDEMO
+        // chain straight on to the next embedded demo (this doesn't return after the last one)
+        W_ReleaseLumpName(defdemoname);
+        G_DeferedPlayDemo(pd_timedemo_next_demo());
+        return true;
+#endif
         // Prevent recursive calls
         timingdemo = false;
         demoplayback = false;
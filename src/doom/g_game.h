@@ -57,7 +57,7 @@ void G_BeginRecording (void);
 #endif
 
 void G_PlayDemo (char* name);
-void G_TimeDemo (char* name);
+void G_TimeDemo (const char* name);
 boolean G_CheckDemoStatus (void);
 
 void G_ExitLevel (void);
@@ -39,6 +39,10 @@
 #include "r_data.h"
 #include <assert.h>
 
+#if PICO_DOOM
+#include "picodoom.h"
+#endif
+
 //
 // Graphics.
 // DOOM graphics for walls and sprites
@@ -295,130 +299,79 @@ void R_InitData (void)
 
 //
 // R_PrecacheLevel
-// Preloads all relevant graphics for the level.
+// Warms the renderer's flat cache and patch decoders for the level,
+//  so its first frames don't have to build them all.
 //
-int		flatmemory;
-int		texturememory;
-int		spritememory;
-
-void R_PrecacheLevel (void)
+#if PICO_DOOM
+static void R_PrecacheSector (sector_t *sector)
 {
-#if 0
-    char*		flatpresent;
-    char*		spritepresent;
-
-    int			i;
-    int			j;
-    int			k;
-    int			lump;
+    if (sector->floorpic != skyflatnum)
+        pd_precache_flat(sector->floorpic);
+    if (sector->ceilingpic != skyflatnum)
+        pd_precache_flat(sector->ceilingpic);
+}
 
-//    texture_t*		texture;
-    thinker_t*		th;
+static void R_PrecacheSide (int sidenum)
+{
+    side_t *side;
 
-    if (demoplayback)
+    if (sidenum == -1)
         return;
+    side = sidenum_to_side(sidenum);
+    pd_precache_texture(side_toptexture(side));
+    pd_precache_texture(side_midtexture(side));
+    pd_precache_texture(side_bottomtexture(side));
+}
 
-    // Precache flats.
-    flatpresent = Z_Malloc(numflats, PU_STATIC, 0);
-    memset (flatpresent,0,numflats);
-
-    for (i=0 ; i<numsectors ; i++)
-    {
-        flatpresent[sectors[i].floorpic] = 1;
-        flatpresent[sectors[i].ceilingpic] = 1;
-    }
+// all the lines touching sector (or every line if it is NULL), along with
+// the sectors on either side of them
 
-    flatmemory = 0;
-    int flat_count = 0;
+static void R_PrecacheLines (sector_t *sector)
+{
+    line_t *li = lines;
+    sector_t *front, *back;
+    int i;
 
-    for (i=0 ; i<numflats ; i++)
+    for (i = 0; i < numlines; i++, li += line_next_step(li))
     {
-        if (flatpresent[i])
+        front = line_frontsector(li);
+        back = line_backsector(li);
+        if (sector && front != sector && back != sector)
+            continue;
+        if (sector)
         {
-            flat_count++;
-            lump = firstflat + i;
-            flatmemory += W_LumpLength(lump);
-            W_CacheLumpNum(lump, PU_CACHE);
+            if (front)
+                R_PrecacheSector(front);
+            if (back)
+                R_PrecacheSector(back);
         }
+        R_PrecacheSide(line_sidenum(li, 0));
+        R_PrecacheSide(line_sidenum(li, 1));
     }
+}
+#endif
 
-    Z_Free(flatpresent);
-
-//    // Precache textures.
-//    texturepresent = Z_Malloc(numtextures, PU_STATIC, 0);
-//    memset (texturepresent,0, numtextures);
-//
-//    for (i=0 ; i<numsides ; i++)
-//    {
-//        texturepresent[side_toptexture(&sides[i])] = 1;
-//        texturepresent[side_midtexture(&sides[i])] = 1;
-//        texturepresent[side_bottomtexture(&sides[i])] = 1;
-//    }
-
-    // Sky texture is always present.
-    // Note that F_SKY1 is the name used to
-    //  indicate a sky floor/ceiling as a flat,
-    //  while the sky texture is stored like
-    //  a wall texture, with an episode dependend
-    //  name.
-//    texturepresent[skytexture] = 1;
-//
-//    texturememory = 0;
-//    int texture_count =0;
-//    for (i=0 ; i<numtextures ; i++)
-//    {
-//        if (!texturepresent[i])
-//            continue;
-//
-//        texture_count++;
-//        texture = textures[i];
-//
-//        for (j=0 ; j<texture->patchcount ; j++)
-//        {
-//            lump = texture->patches[j].patch;
-//            texturememory += lump_info(lump)->size;
-//            W_CacheLumpNum(lump , PU_CACHE);
-//        }
-//    }
-//
-//    Z_Free(texturepresent);
-//
-    // Precache sprites.
-//    spritepresent = Z_Malloc(numsprites, PU_STATIC, 0);
-//    memset (spritepresent,0, numsprites);
-//
-//    for (th = thinker_next(&thinkercap) ; th != &thinkercap ; th=thinker_next(th))
-//    {
-//        if (th->function == ThinkF_P_MobjThinker)
-//            spritepresent[mobj_sprite((mobj_t *)th)] = 1;
-//    }
-//
-//    spritememory = 0;
-//    int sprite_count = 0;
-//    for (i=0 ; i<numsprites ; i++)
-//    {
-//        if (!spritepresent[i])
-//            continue;
-//        sprite_count++;
-//
-//        for (j=0 ; j<sprites[i].numframes ; j++)
-//        {
-//            sf = &sprites[i].spriteframes[j];
-//            for (k=0 ; k<8 ; k++)
-//            {
-//                lump = firstspritelump + sf->lump[k];
-//                spritememory += lump_info(lump)->size;
-//                W_CacheLumpNum(lump , PU_CACHE);
-//            }
-//        }
-//    }
-
-//    printf("PRECACHE Summary:\n");
-//    printf("  Flats %d/%d = %d bytes\n", flat_count, numflats, flatmemory);
-//    printf("  Textures %d/%d = %d bytes\n", texture_count, numtextures, texturememory);
-//    printf("  Sprites %d/%d = %d bytes\n", sprite_count, numsprites, spritememory);
-//    Z_Free(spritepresent);
+void R_PrecacheLevel (void)
+{
+#if PICO_DOOM
+    mobj_t *mo = players[consoleplayer].mo;
+    int i;
+
+    // the caches are only so big, so start with what is likely to be
+    // on screen first: the sky, then where the player starts
+    pd_precache_begin();
+    pd_precache_texture(skytexture);
+    if (mo)
+    {
+        R_PrecacheSector(mobj_sector(mo));
+        R_PrecacheLines(mobj_sector(mo));
+    }
+    for (i = 0; i < numsectors; i++)
+        R_PrecacheSector(&sectors[i]);
+    R_PrecacheLines(NULL);
+    pd_precache_end();
 #endif
 }
 
+
 #endif
\ No newline at end of file
@@ -511,6 +511,10 @@ void R_RenderSegLoop(void) {
 #endif
             }
         }
+#if PICO_DOOM && PD_OCCLUSION
+        if (ceilingclip[rw_x] + 1 >= floorclip[rw_x])
+            pd_close_column(rw_x);
+#endif
 
         rw_scale += rw_scalestep;
         topfrac += topstep;
@@ -477,15 +477,18 @@ void R_DrawMaskedColumn(maskedcolumn_t column) {
             if (0xff == (col_offset >> 8)) {
                 next_column = (col_offset & 0xff);
                 assert(next_column < patch_width(patch));
+                if (patch_meta_before_column(patch)) col_offset = col_offsets[next_column];
                 next_column++;
             } else {
                 next_column = column.col + 1;
             }
-            col_offset = col_offsets[next_column]; // we work backwards from the next column
-            // we have to skip over any columns which aren't stored
-            while (0xff == (col_offset >> 8)) {
-                assert(next_column < patch_width(patch)); // note < and ++ afterwards; we are allowed to read one beyond width which is the "end" marker column
-                col_offset = col_offsets[++next_column];
+            if (!patch_meta_before_column(patch)) {
+                col_offset = col_offsets[next_column]; // we work backwards from the next column
+                // we have to skip over any columns which aren't stored
+                while (0xff == (col_offset >> 8)) {
+                    assert(next_column < patch_width(patch)); // note < and ++ afterwards; we are allowed to read one beyond width which is the "end" marker column
+                    col_offset = col_offsets[++next_column];
+                }
             }
             data_index = (data_index + patch_width(patch)) * 2 + 2; // + 2 because we have one extra col_data offset
             if (patch_byte_addressed(patch)) {
@@ -612,6 +615,17 @@ R_DrawVisSprite
     framedrawable_t *fd = lookup_patch(vis->patch);
 #endif
     for (dc_x = vis->x1; dc_x <= vis->x2; dc_x++, frac += vis->xiscale) {
+#if PICO_DOOM && PD_OCCLUSION
+        if (dc_x == vis->x1 || !(dc_x & 3)) {
+            // skip columns hidden behind solid walls (a group of 4 at a time)
+            int span_end = MIN(dc_x | 3, vis->x2);
+            if (pd_masked_columns_occluded(dc_x, span_end, spryscale)) {
+                frac += vis->xiscale * (span_end - dc_x);
+                dc_x = span_end;
+                continue;
+            }
+        }
+#endif
         texturecolumn = frac >> FRACBITS;
 #ifdef RANGECHECK
         if (patch && (texturecolumn < 0 || texturecolumn >= patch_width(patch)))
@@ -1162,6 +1176,10 @@ void R_DrawMasked(void) {
 //
 void R_DrawSpriteEarly(vissprite_t *spr) {
 #if PICO_DOOM
+#if PD_OCCLUSION
+    // don't even look up the patch if the sprite is entirely behind solid walls
+    if (pd_masked_columns_occluded(spr->x1, spr->x2, spr->scale)) return;
+#endif
     pd_flag |= 1;
 #if !NO_MASKED_FLOOR_CLIP
     mfloorclip = floorclip;
@@ -0,0 +1,120 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Per-frame hashes of the palette indexed framebuffer.
+//
+// The output is a text file with a header line, followed by one line
+// per frame: the gametic, then a CRC-32 for each tile (left to right,
+// top to bottom), or "-" for tiles the renderer didn't supply, and
+// optionally a "!<word>" mark (see FB_HashFrameMarked).
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fb_hash.h"
+
+static const int tile_y[FB_HASH_TILES_Y + 1] =
+{
+    0, 24, 48, 72, 96, 120, 144, 168, 200
+};
+
+static FILE *hash_file;
+static uint32_t crc_table[256];
+
+static void InitCRCTable(void)
+{
+    uint32_t i, j, c;
+
+    for (i = 0; i < 256; ++i)
+    {
+        c = i;
+        for (j = 0; j < 8; ++j)
+        {
+            c = (c & 1) ? (c >> 1) ^ 0xedb88320 : c >> 1;
+        }
+        crc_table[i] = c;
+    }
+}
+
+static void CloseHashFile(void)
+{
+    if (hash_file != NULL)
+    {
+        fclose(hash_file);
+        hash_file = NULL;
+    }
+}
+
+boolean FB_HashOpen(const char *filename)
+{
+    hash_file = fopen(filename, "w");
+
+    if (hash_file == NULL)
+    {
+        return false;
+    }
+
+    InitCRCTable();
+    fprintf(hash_file, "fbhash %dx%d tiles %dx%d\n",
+            FB_HASH_WIDTH, FB_HASH_HEIGHT, FB_HASH_TILES_X, FB_HASH_TILES_Y);
+    atexit(CloseHashFile);
+
+    return true;
+}
+
+void FB_HashFrame(int tic, const byte *screen, int rows)
+{
+    FB_HashFrameMarked(tic, screen, rows, NULL);
+}
+
+void FB_HashFrameMarked(int tic, const byte *screen, int rows,
+                        const char *mark)
+{
+    int tx, ty, x, y;
+    uint32_t crc;
+    const byte *p;
+
+    if (hash_file == NULL)
+    {
+        return;
+    }
+
+    fprintf(hash_file, "%d", tic);
+
+    for (ty = 0; ty < FB_HASH_TILES_Y; ++ty)
+    {
+        for (tx = 0; tx < FB_HASH_TILES_X; ++tx)
+        {
+            if (tile_y[ty + 1] > rows)
+            {
+                fprintf(hash_file, " -");
+                continue;
+            }
+
+            crc = 0xffffffff;
+
+            for (y = tile_y[ty]; y < tile_y[ty + 1]; ++y)
+            {
+                p = screen + y * FB_HASH_WIDTH
+                  + tx * (FB_HASH_WIDTH / FB_HASH_TILES_X);
+
+                for (x = 0; x < FB_HASH_WIDTH / FB_HASH_TILES_X; ++x)
+                {
+                    crc = crc_table[(crc ^ p[x]) & 0xff] ^ (crc >> 8);
+                }
+            }
+
+            fprintf(hash_file, " %08x", crc ^ 0xffffffff);
+        }
+    }
+
+    if (mark != NULL)
+    {
+        fprintf(hash_file, " !%s", mark);
+    }
+
+    fprintf(hash_file, "\n");
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Per-frame hashes of the palette indexed framebuffer, so that the
+// output of two renderers (e.g. doom_tiny and chocolate-doom) playing
+// the same demo can be compared with fbhash_diff.
+
+#ifndef __FB_HASH_H__
+#define __FB_HASH_H__
+
+#include "doomtype.h"
+
+#define FB_HASH_WIDTH 320
+#define FB_HASH_HEIGHT 200
+
+// The screen is hashed as a grid of tiles, so differences can be located.
+// The 168 line 3D view is split into 7 bands of 24 lines, and the status
+// bar is the 8th band.
+
+#define FB_HASH_TILES_X 4
+#define FB_HASH_TILES_Y 8
+
+// Start writing hashes to the given file.
+
+boolean FB_HashOpen(const char *filename);
+
+// Hash a frame (with a stride of FB_HASH_WIDTH) for the given gametic.
+// Only the first 'rows' lines need be valid; tiles extending below them
+// are recorded as unknown.
+
+void FB_HashFrame(int tic, const byte *screen, int rows);
+
+// As FB_HashFrame, but if mark isn't NULL the frame is marked with it (a
+// single word), as one whose output may legitimately differ, e.g. because
+// the renderer ran out of columns. fbhash_diff reports differing marked
+// frames separately.
+
+void FB_HashFrameMarked(int tic, const byte *screen, int rows,
+                        const char *mark);
+
+#endif /* #ifndef __FB_HASH_H__ */
@@ -0,0 +1,324 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// Compare two framebuffer hash streams written by FB_HashFrame (see
+// fb_hash.c), matching frames by gametic, and report which frames and
+// screen regions differ. Tiles unknown in either stream are skipped.
+//
+// Usage: fbhash_diff [-v] <a.fbhash> <b.fbhash>
+//
+// Frames marked (with a trailing "!<word>") in either stream, as ones
+// whose output may legitimately differ, are counted separately when
+// they differ. Exits with 0 if every unmarked frame common to both
+// matches, 1 if not.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fb_hash.h"
+
+#define NUM_TILES (FB_HASH_TILES_X * FB_HASH_TILES_Y)
+#define UNKNOWN_TILE 0xffffffffffffffffull
+
+// frames listed by default before we just count them
+#define MAX_LISTED_FRAMES 20
+
+static const int tile_y[FB_HASH_TILES_Y + 1] =
+{
+    0, 24, 48, 72, 96, 120, 144, 168, 200
+};
+
+typedef struct
+{
+    int tic;
+    unsigned long long tiles[NUM_TILES];
+    char mark[32];                          // empty if not marked
+} frame_t;
+
+typedef struct
+{
+    frame_t *frames;
+    int num_frames;
+} stream_t;
+
+static void ReadStream(const char *filename, stream_t *stream)
+{
+    char line[1024];
+    char header[64];
+    int allocated = 0;
+    FILE *f;
+
+    f = fopen(filename, "r");
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "fbhash_diff: can't open %s\n", filename);
+        exit(2);
+    }
+
+    snprintf(header, sizeof(header), "fbhash %dx%d tiles %dx%d",
+             FB_HASH_WIDTH, FB_HASH_HEIGHT, FB_HASH_TILES_X, FB_HASH_TILES_Y);
+
+    if (fgets(line, sizeof(line), f) == NULL
+     || strncmp(line, header, strlen(header)) != 0)
+    {
+        fprintf(stderr, "fbhash_diff: %s is not a framebuffer hash file\n",
+                filename);
+        exit(2);
+    }
+
+    stream->frames = NULL;
+    stream->num_frames = 0;
+
+    while (fgets(line, sizeof(line), f) != NULL)
+    {
+        frame_t *frame;
+        char *p = line, *end;
+        int i;
+
+        if (stream->num_frames == allocated)
+        {
+            allocated = allocated ? allocated * 2 : 1024;
+            stream->frames = realloc(stream->frames,
+                                     allocated * sizeof(frame_t));
+        }
+
+        frame = &stream->frames[stream->num_frames];
+        frame->tic = strtol(p, &end, 10);
+
+        if (end == p)
+        {
+            continue;
+        }
+
+        p = end;
+
+        for (i = 0; i < NUM_TILES; ++i)
+        {
+            while (*p == ' ')
+            {
+                ++p;
+            }
+
+            if (*p == '-')
+            {
+                frame->tiles[i] = UNKNOWN_TILE;
+                ++p;
+            }
+            else
+            {
+                frame->tiles[i] = strtoul(p, &end, 16);
+
+                if (end == p)
+                {
+                    fprintf(stderr, "fbhash_diff: bad line in %s: %s",
+                            filename, line);
+                    exit(2);
+                }
+
+                p = end;
+            }
+        }
+
+        frame->mark[0] = '\0';
+
+        while (*p == ' ')
+        {
+            ++p;
+        }
+
+        if (*p == '!')
+        {
+            sscanf(p + 1, "%31s", frame->mark);
+        }
+
+        ++stream->num_frames;
+    }
+
+    fclose(f);
+}
+
+// Both renderers only hash one frame per tic, but in case of duplicates
+// we compare the last of each.
+
+static const frame_t *FindFrame(const stream_t *stream, int tic, int *pos)
+{
+    const frame_t *result = NULL;
+
+    while (*pos < stream->num_frames && stream->frames[*pos].tic <= tic)
+    {
+        if (stream->frames[*pos].tic == tic)
+        {
+            result = &stream->frames[*pos];
+        }
+        ++*pos;
+    }
+
+    return result;
+}
+
+// Number of distinct tics in a stream, to count its frames against those
+// compared (which are also one per tic).
+
+static int CountTics(const stream_t *stream)
+{
+    int i, tics = 0;
+
+    for (i = 0; i < stream->num_frames; ++i)
+    {
+        if (i + 1 == stream->num_frames
+         || stream->frames[i + 1].tic != stream->frames[i].tic)
+        {
+            ++tics;
+        }
+    }
+
+    return tics;
+}
+
+static void PrintTile(int tile)
+{
+    int tx = tile % FB_HASH_TILES_X;
+    int ty = tile / FB_HASH_TILES_X;
+    int w = FB_HASH_WIDTH / FB_HASH_TILES_X;
+
+    printf(" [x %d-%d y %d-%d]", tx * w, tx * w + w - 1,
+           tile_y[ty], tile_y[ty + 1] - 1);
+}
+
+int main(int argc, char **argv)
+{
+    stream_t a, b;
+    int tile_diffs[NUM_TILES] = { 0 };
+    int verbose = 0;
+    int compared = 0, differing = 0, differing_marked = 0, only_a = 0;
+    int first_diff_tic = -1;
+    int bpos = 0;
+    int i, tx, ty;
+
+    if (argc > 1 && !strcmp(argv[1], "-v"))
+    {
+        verbose = 1;
+        --argc;
+        ++argv;
+    }
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: fbhash_diff [-v] <a.fbhash> <b.fbhash>\n");
+        return 2;
+    }
+
+    ReadStream(argv[1], &a);
+    ReadStream(argv[2], &b);
+
+    for (i = 0; i < a.num_frames; ++i)
+    {
+        const frame_t *fa = &a.frames[i];
+        const frame_t *fb;
+        int tile, frame_differs = 0;
+
+        if (i + 1 < a.num_frames && a.frames[i + 1].tic == fa->tic)
+        {
+            continue;
+        }
+
+        fb = FindFrame(&b, fa->tic, &bpos);
+
+        if (fb == NULL)
+        {
+            ++only_a;
+            continue;
+        }
+
+        ++compared;
+
+        for (tile = 0; tile < NUM_TILES; ++tile)
+        {
+            if (fa->tiles[tile] == UNKNOWN_TILE
+             || fb->tiles[tile] == UNKNOWN_TILE
+             || fa->tiles[tile] == fb->tiles[tile])
+            {
+                continue;
+            }
+
+            if (!frame_differs)
+            {
+                if (first_diff_tic < 0)
+                {
+                    first_diff_tic = fa->tic;
+                }
+
+                if (verbose || differing < MAX_LISTED_FRAMES)
+                {
+                    printf("tic %d differs%s%s%s%s:", fa->tic,
+                           fa->mark[0] ? " !" : "", fa->mark,
+                           fb->mark[0] ? " !" : "", fb->mark);
+                }
+            }
+
+            frame_differs = 1;
+            ++tile_diffs[tile];
+
+            if (verbose || differing < MAX_LISTED_FRAMES)
+            {
+                PrintTile(tile);
+            }
+        }
+
+        if (frame_differs)
+        {
+            if (verbose || differing < MAX_LISTED_FRAMES)
+            {
+                printf("\n");
+            }
+
+            ++differing;
+
+            if (fa->mark[0] || fb->mark[0])
+            {
+                ++differing_marked;
+            }
+        }
+    }
+
+    printf("%d frames compared, %d differ", compared, differing);
+
+    if (differing_marked)
+    {
+        printf(" (%d of them marked)", differing_marked);
+    }
+
+    if (first_diff_tic >= 0)
+    {
+        printf(" (first at tic %d)", first_diff_tic);
+    }
+
+    printf("; %d frames only in %s, %d only in %s\n",
+           only_a, argv[1], CountTics(&b) - compared, argv[2]);
+
+    if (differing)
+    {
+        printf("differing frames per region (%d columns of %d pixels, "
+               "rows of lines as listed):\n",
+               FB_HASH_TILES_X, FB_HASH_WIDTH / FB_HASH_TILES_X);
+
+        for (ty = 0; ty < FB_HASH_TILES_Y; ++ty)
+        {
+            printf("  y %3d-%3d:", tile_y[ty], tile_y[ty + 1] - 1);
+
+            for (tx = 0; tx < FB_HASH_TILES_X; ++tx)
+            {
+                printf(" %6d", tile_diffs[ty * FB_HASH_TILES_X + tx]);
+            }
+
+            printf("\n");
+        }
+    }
+
+    return differing > differing_marked ? 1 : 0;
+}
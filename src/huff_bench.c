@@ -0,0 +1,688 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+
+// DESCRIPTION:
+//     Huffman decode throughput over the flats, patches (sprites and wall
+//     patches) and MUSX music of a WHD file, comparing the canonical bit
+//     walk (th_decode), the 8 bit prefix length table the renderer has
+//     always used (th_decode_table_special) and a k bit lookup table
+//     (th_decode_lut). Every lump is decoded with each method and the
+//     output compared. vpatches aren't Huffman coded (they are palette
+//     indexed runs, see v_video.c), so they are only counted along with the
+//     remaining lumps (levels, sounds etc.).
+//
+//     Whether the lookup table is any faster than the prefix table depends
+//     on k and the CPU, so each k it is run with is reported as faster or
+//     slower than the prefix table; "-k all" runs it for every k.
+//
+//     Usage: huff_bench [-k bits | -k all] [-n passes] <file.whd>
+//
+//     Exits with 0 if all methods agree, 1 if not.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "image_decoder.h"
+#include "musx_decoder.h"
+
+#define MAX_DECODER_HWORDS 1024
+
+// see v_patch.h
+#define patch_width(p) ((p)[1] | ((((p)[2]&1) << 8)))
+#define patch_height(p) ((p)[3])
+#define patch_byte_addressed(p) (((p)[0] & 4)!=0)
+#define patch_has_extra(p) (((p)[0] & 1)!=0)
+#define MAX_PATCH_WIDTH 320
+
+typedef enum {
+    METHOD_WALK,
+    METHOD_PREFIX,
+    METHOD_LUT,
+    NUM_METHODS
+} method_t;
+
+static const char *method_names[NUM_METHODS] = {
+    "canonical walk", "8 bit prefix table", "lut",
+};
+
+typedef struct {
+    const uint8_t *data;
+    uint32_t numlumps;
+    const uint32_t *offsets;
+    const uint8_t *names;
+    int num_names;
+    const uint32_t *sizes; // only when the lump data isn't in lump order (whd_gen -order)
+} whd_t;
+
+static int lut_bits = 8;
+
+static uint16_t decoder_buf[MAX_DECODER_HWORDS];
+static uint8_t decoder_tmp[1024];
+static uint8_t prefix_lengths[256];
+static uint16_t lut[1u << TH_LUT_MAX_BITS];
+static uint32_t lut_16[1u << TH_LUT_MAX_BITS];
+
+// MUSX has a decoder per kind of value; these are their tables
+enum {
+    MUSX_CHANNEL_EVENT,
+    MUSX_DELTA_VOLUME,
+    MUSX_DELTA_PITCH,
+    MUSX_DELTA_VIBRATO,
+    MUSX_PRESS_NOTE,
+    MUSX_PRESS_NOTE9,
+    MUSX_PRESS_VOLUME,
+    MUSX_GROUP_SIZE,
+    MUSX_GAP,
+    MUSX_RELEASE_DIST, // one per number of notes on in the channel
+    NUM_MUSX_TABLES = MUSX_RELEASE_DIST + MUSX_RELEASE_DIST_COUNT
+};
+
+static uint8_t musx_prefix_lengths[NUM_MUSX_TABLES][256];
+static uint16_t musx_lut[NUM_MUSX_TABLES][1u << TH_LUT_MAX_BITS];
+
+void th_bit_overrun(th_bit_input *bi)
+{
+    fprintf(stderr, "huff_bench: bit input overrun\n");
+    exit(2);
+}
+
+static uint8_t *ReadFile(const char *filename, long *size)
+{
+    FILE *f = fopen(filename, "rb");
+    uint8_t *data;
+
+    if (f == NULL)
+    {
+        fprintf(stderr, "huff_bench: can't open %s\n", filename);
+        exit(2);
+    }
+
+    fseek(f, 0, SEEK_END);
+    *size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    // the 32 bit refill may read a few bytes past the end of the last lump
+    data = calloc(1, *size + 8);
+
+    if (fread(data, 1, *size, f) != (size_t) *size)
+    {
+        fprintf(stderr, "huff_bench: can't read %s\n", filename);
+        exit(2);
+    }
+
+    fclose(f);
+    return data;
+}
+
+// see W_AddFile: wadinfo_t, whdheader_t, the lump offsets, the named lumps and then maybe the lump sizes
+static void ParseWHD(const uint8_t *data, long size, whd_t *whd)
+{
+    uint32_t infotableofs;
+
+    if (size < 36 || data[0] != 'I' || data[1] != 'W' || data[2] != 'H')
+    {
+        fprintf(stderr, "huff_bench: not a WHD file\n");
+        exit(2);
+    }
+
+    whd->data = data;
+    memcpy(&whd->numlumps, data + 4, 4);
+    memcpy(&infotableofs, data + 8, 4);
+    whd->offsets = (const uint32_t *) (data + infotableofs);
+    whd->names = data + 12 + 24 + (whd->numlumps + 1) * 4;
+    whd->num_names = data[12 + 22] | (data[12 + 23] << 8);
+    whd->sizes = NULL;
+    if (whd->offsets[whd->numlumps] & 0x80000000u) // WHD_LUMP_SIZES_PRESENT
+    {
+        whd->sizes = (const uint32_t *) (whd->names + whd->num_names * 12);
+    }
+}
+
+static int LumpNum(const whd_t *whd, const char *name)
+{
+    int i;
+
+    for (i = 0; i < whd->num_names; ++i)
+    {
+        const uint8_t *entry = whd->names + i * 12;
+
+        if (!strncasecmp((const char *) entry, name, 10))
+        {
+            return entry[10] | (entry[11] << 8);
+        }
+    }
+
+    fprintf(stderr, "huff_bench: no %s lump\n", name);
+    exit(2);
+}
+
+static const uint8_t *LumpData(const whd_t *whd, int lump)
+{
+    return whd->data + (whd->offsets[lump] & 0xffffffu);
+}
+
+static int LumpLength(const whd_t *whd, int lump)
+{
+    if (whd->sizes != NULL)
+    {
+        return (int) whd->sizes[lump];
+    }
+    return (int) (whd->offsets[lump + 1] & 0xffffffu) - (int) (whd->offsets[lump] & 0xffffffu);
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint8_t Decode(method_t method, th_bit_input *bi)
+{
+    switch (method)
+    {
+        case METHOD_WALK:
+            return th_decode(decoder_buf, bi);
+        case METHOD_PREFIX:
+            return th_decode_table_special(decoder_buf, prefix_lengths, bi);
+        default:
+            return th_decode_lut(decoder_buf, lut, lut_bits, bi);
+    }
+}
+
+static inline uint16_t Decode16(method_t method, th_bit_input *bi)
+{
+    switch (method)
+    {
+        case METHOD_WALK:
+            return th_decode_16(decoder_buf, bi);
+        case METHOD_PREFIX:
+            return th_decode_table_special_16(decoder_buf, prefix_lengths, bi);
+        default:
+            return th_decode_lut_16(decoder_buf, lut_16, lut_bits, bi);
+    }
+}
+
+static void MakeTable(method_t method, int encoding)
+{
+    if (method == METHOD_PREFIX)
+    {
+        th_make_prefix_length_table(decoder_buf, prefix_lengths);
+    }
+    else if (method == METHOD_LUT)
+    {
+        if (encoding)
+        {
+            th_make_lut_16(decoder_buf, lut_16, lut_bits);
+        }
+        else
+        {
+            th_make_lut(decoder_buf, lut, lut_bits);
+        }
+    }
+}
+
+// as decode_flat_to_entry in pd_render.cpp; returns the number of symbols decoded
+static int DecodeFlat(method_t method, const uint8_t *lump, uint8_t *out)
+{
+    th_bit_input bi;
+    int symbols = 0;
+    int x, y;
+
+    th_bit_input_init(&bi, lump);
+
+    if (th_bit(&bi))
+    {
+        th_read_simple_decoder(&bi, decoder_buf, MAX_DECODER_HWORDS,
+                               decoder_tmp, sizeof(decoder_tmp));
+    }
+    else
+    {
+        read_raw_pixels_decoder(&bi, decoder_buf, MAX_DECODER_HWORDS,
+                                decoder_tmp, sizeof(decoder_tmp));
+    }
+
+    MakeTable(method, 0);
+
+    if (!th_bit(&bi))
+    {
+        for (y = 0; y < 4096; ++y)
+        {
+            out[y] = Decode(method, &bi);
+        }
+
+        return 4096;
+    }
+
+    for (x = 0; x < 64; ++x)
+    {
+        uint8_t *p = out + x * 64;
+
+        if (th_bit(&bi))
+        {
+            uint xf = th_read_bits(&bi, 32 - __builtin_clz(x));
+
+            memcpy(p, out + xf * 64, 64);
+        }
+        else
+        {
+            for (y = 0; y < 64; ++y)
+            {
+                p[y] = Decode(method, &bi);
+            }
+
+            symbols += 64;
+        }
+    }
+
+    return symbols;
+}
+
+// as get_patch_decoder and decode_patch_column in pd_render.cpp, decoding
+// the full height of every distinct column
+static int DecodePatch(method_t method, const uint8_t *patch, uint8_t *out)
+{
+    th_bit_input bi;
+    uint data_index = 3 + patch_has_extra(patch);
+    const uint16_t *col_offsets;
+    const uint8_t *pixel_data;
+    int w = patch_width(patch);
+    int h = patch_height(patch);
+    int encoding;
+    int symbols = 0;
+    int col, y;
+
+    th_bit_input_init(&bi, patch + data_index * 2 + 1);
+    data_index += patch[data_index * 2];
+    encoding = th_read_bits(&bi, 1);
+
+    if (encoding)
+    {
+        read_raw_pixels_decoder_c3(&bi, decoder_buf, MAX_DECODER_HWORDS,
+                                   decoder_tmp, sizeof(decoder_tmp));
+    }
+    else if (th_bit(&bi))
+    {
+        th_read_simple_decoder(&bi, decoder_buf, MAX_DECODER_HWORDS,
+                               decoder_tmp, sizeof(decoder_tmp));
+    }
+    else
+    {
+        read_raw_pixels_decoder(&bi, decoder_buf, MAX_DECODER_HWORDS,
+                                decoder_tmp, sizeof(decoder_tmp));
+    }
+
+    if (decoder_buf[0] <= 1)
+    {
+        return 0;
+    }
+
+    MakeTable(method, encoding);
+    col_offsets = (const uint16_t *) patch + data_index;
+    pixel_data = patch + (data_index + w) * 2 + 2;
+
+    for (col = 0; col < w; ++col)
+    {
+        uint16_t col_offset = col_offsets[col];
+
+        if ((col_offset >> 8) == 0xff)
+        {
+            continue;
+        }
+
+        if (patch_byte_addressed(patch))
+        {
+            th_bit_input_init(&bi, pixel_data + col_offset);
+        }
+        else
+        {
+            th_bit_input_init_bit_offset(&bi, pixel_data, col_offset);
+        }
+
+        if (!encoding)
+        {
+            for (y = 0; y < h; ++y)
+            {
+                *out++ = Decode(method, &bi);
+            }
+        }
+        else
+        {
+            for (y = 0; y < h; ++y)
+            {
+                uint16_t p = Decode16(method, &bi);
+
+                *out++ = p;
+                *out++ = p >> 8;
+            }
+        }
+
+        symbols += h;
+    }
+
+    return symbols;
+}
+
+static void MakeMusxTable(method_t method, const musx_decoder *d, int table, uint16_t idx)
+{
+    th_decoder decoder = d->decoders + idx;
+
+    if (decoder[0] <= 1)
+    {
+        return;
+    }
+
+    if (method == METHOD_PREFIX)
+    {
+        th_make_prefix_length_table(decoder, musx_prefix_lengths[table]);
+    }
+    else if (method == METHOD_LUT)
+    {
+        th_make_lut(decoder, musx_lut[table], lut_bits);
+    }
+}
+
+static inline uint8_t DecodeMusx(method_t method, const musx_decoder *d, int table, uint16_t idx,
+                                 th_bit_input *bi)
+{
+    th_decoder decoder = d->decoders + idx;
+
+    // as with patches, single symbol decoders are left to th_decode
+    if (method == METHOD_WALK || decoder[0] <= 1)
+    {
+        return th_decode(decoder, bi);
+    }
+    else if (method == METHOD_PREFIX)
+    {
+        return th_decode_table_special(decoder, musx_prefix_lengths[table], bi);
+    }
+    else
+    {
+        return th_decode_lut(decoder, musx_lut[table], lut_bits, bi);
+    }
+}
+
+// as MIDI_RestartIterator and peek_event in midifile.c, writing each
+// event's fields rather than the MIDI event; returns the number of
+// symbols decoded, and the number of bytes written in *bytes
+static int DecodeMusic(method_t method, const uint8_t *lump, int length, uint8_t *out, int out_size,
+                       int *bytes)
+{
+    musx_decoder d;
+    th_bit_input bi;
+    uint8_t *p = out;
+    int symbols = 0;
+    int i;
+
+    th_sized_bit_input_init(&bi, lump + 8, length - 8);
+    musx_decoder_init(&d, &bi, decoder_buf, MAX_DECODER_HWORDS,
+                      decoder_tmp, sizeof(decoder_tmp));
+    MakeMusxTable(method, &d, MUSX_CHANNEL_EVENT, d.channel_event_idx);
+    MakeMusxTable(method, &d, MUSX_DELTA_VOLUME, d.delta_volume_idx);
+    MakeMusxTable(method, &d, MUSX_DELTA_PITCH, d.delta_pitch_idx);
+    MakeMusxTable(method, &d, MUSX_DELTA_VIBRATO, d.delta_vibrato_idx);
+    MakeMusxTable(method, &d, MUSX_PRESS_NOTE, d.press_note_idx);
+    MakeMusxTable(method, &d, MUSX_PRESS_NOTE9, d.press_note9_idx);
+    MakeMusxTable(method, &d, MUSX_PRESS_VOLUME, d.press_volume_idx);
+    MakeMusxTable(method, &d, MUSX_GROUP_SIZE, d.group_size_idx);
+    MakeMusxTable(method, &d, MUSX_GAP, d.gap_idx);
+
+    for (i = 2; i < MUSX_RELEASE_DIST_COUNT; ++i)
+    {
+        if (d.release_dist_idx[i])
+        {
+            MakeMusxTable(method, &d, MUSX_RELEASE_DIST + i, d.release_dist_idx[i]);
+        }
+    }
+
+    // the longest event is a gap of a few bytes
+    while (p < out + out_size - 16)
+    {
+        uint8_t ec;
+        int channel;
+
+        if (!d.group_remaining)
+        {
+            d.group_remaining = DecodeMusx(method, &d, MUSX_GROUP_SIZE, d.group_size_idx, &bi);
+            ++symbols;
+        }
+
+        ec = DecodeMusx(method, &d, MUSX_CHANNEL_EVENT, d.channel_event_idx, &bi);
+        ++symbols;
+        *p++ = ec;
+        channel = ec >> 4;
+
+        switch (ec & 0xf)
+        {
+            case change_controller:
+                *p++ = th_read_bits(&bi, 4);
+                *p++ = th_read_bits(&bi, 8);
+                break;
+            case delta_volume:
+                *p++ = DecodeMusx(method, &d, MUSX_DELTA_VOLUME, d.delta_volume_idx, &bi);
+                ++symbols;
+                break;
+            case delta_pitch:
+                *p++ = DecodeMusx(method, &d, MUSX_DELTA_PITCH, d.delta_pitch_idx, &bi);
+                ++symbols;
+                break;
+            case delta_vibrato:
+                *p++ = DecodeMusx(method, &d, MUSX_DELTA_VIBRATO, d.delta_vibrato_idx, &bi);
+                ++symbols;
+                break;
+            case press_key:
+                if (channel == 9)
+                {
+                    *p = DecodeMusx(method, &d, MUSX_PRESS_NOTE9, d.press_note9_idx, &bi);
+                }
+                else
+                {
+                    *p = DecodeMusx(method, &d, MUSX_PRESS_NOTE, d.press_note_idx, &bi);
+                }
+                musx_record_note_on(&d, channel, *p++);
+                *p++ = DecodeMusx(method, &d, MUSX_PRESS_VOLUME, d.press_volume_idx, &bi);
+                symbols += 2;
+                break;
+            case release_key:
+            {
+                uint8_t dist = 0;
+
+                if (d.channel_note_count[channel] > 1)
+                {
+                    int n = d.channel_note_count[channel];
+
+                    dist = DecodeMusx(method, &d, MUSX_RELEASE_DIST + n, d.release_dist_idx[n], &bi);
+                    ++symbols;
+                }
+
+                *p++ = musx_record_note_off(&d, channel, dist);
+                break;
+            }
+            case system_event:
+                *p++ = th_read_bits(&bi, 3);
+                break;
+            default:
+                // score_end, or garbage
+                *bytes = p - out;
+                return symbols;
+        }
+
+        if (!--d.group_remaining)
+        {
+            uint8_t gap;
+
+            do
+            {
+                gap = DecodeMusx(method, &d, MUSX_GAP, d.gap_idx, &bi);
+                ++symbols;
+                *p++ = gap;
+            } while (gap == MUSX_GAP_MAX && p < out + out_size);
+        }
+    }
+
+    *bytes = p - out;
+    return symbols;
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t out[NUM_METHODS][2 * 256 * MAX_PATCH_WIDTH];
+    double seconds[NUM_METHODS] = { 0 };
+    double lut_seconds[TH_LUT_MAX_BITS + 1] = { 0 };
+    long long symbols = 0;
+    int flats = 0, patches = 0, music = 0, skipped = 0, mismatches = 0;
+    int passes = 20;
+    int k_first = 8, k_last = 8;
+    int f_start, f_end, s_start, s_end, p_start, p_end;
+    whd_t whd;
+    uint8_t *data;
+    long size;
+    int lump, m, pass, k;
+
+    while (argc > 2 && argv[1][0] == '-')
+    {
+        if (!strcmp(argv[1], "-k"))
+        {
+            if (!strcmp(argv[2], "all"))
+            {
+                k_first = 1;
+                k_last = TH_LUT_MAX_BITS;
+            }
+            else
+            {
+                k_first = k_last = atoi(argv[2]);
+            }
+        }
+        else if (!strcmp(argv[1], "-n"))
+        {
+            passes = atoi(argv[2]);
+        }
+        else
+        {
+            break;
+        }
+
+        argc -= 2;
+        argv += 2;
+    }
+
+    if (argc != 2 || k_first < 1 || k_last > TH_LUT_MAX_BITS || passes < 1)
+    {
+        fprintf(stderr, "Usage: huff_bench [-k bits (1-%d) | -k all] [-n passes] <file.whd>\n"
+                        "  decodes the flats, patches and MUSX music (not vpatches, which aren't Huffman\n"
+                        "  coded) with each method, and reports whether the k bit lookup table is faster\n"
+                        "  or slower than the 8 bit prefix table for each k (which depends on k and the CPU)\n",
+                TH_LUT_MAX_BITS);
+        return 2;
+    }
+
+    data = ReadFile(argv[1], &size);
+    ParseWHD(data, size, &whd);
+    f_start = LumpNum(&whd, "F_START");
+    f_end = LumpNum(&whd, "F_END");
+    s_start = LumpNum(&whd, "S_START");
+    s_end = LumpNum(&whd, "S_END");
+    p_start = LumpNum(&whd, "P_START");
+    p_end = LumpNum(&whd, "P_END");
+
+    for (lump = 0; lump < (int) whd.numlumps; ++lump)
+    {
+        const uint8_t *lump_data = LumpData(&whd, lump);
+        int length = LumpLength(&whd, lump);
+        int is_flat = lump > f_start && lump < f_end;
+        int is_patch = (lump > s_start && lump < s_end)
+                    || (lump > p_start && lump < p_end);
+        int is_music = length > 8 && !memcmp(lump_data, "MUSX", 4);
+        int count = 0, bytes[NUM_METHODS];
+
+        if ((!is_flat && !is_patch && !is_music) || length == 0
+         || (is_patch && patch_width(lump_data) > MAX_PATCH_WIDTH))
+        {
+            ++skipped;
+            continue;
+        }
+
+        for (m = 0; m < NUM_METHODS; ++m)
+        {
+            for (k = m == METHOD_LUT ? k_first : 0; k <= (m == METHOD_LUT ? k_last : 0); ++k)
+            {
+                double t0 = Now();
+
+                lut_bits = k;
+
+                for (pass = 0; pass < passes; ++pass)
+                {
+                    if (is_flat)
+                    {
+                        count = DecodeFlat(m, lump_data, out[m]);
+                        bytes[m] = 4096;
+                    }
+                    else if (is_patch)
+                    {
+                        count = DecodePatch(m, lump_data, out[m]);
+                        bytes[m] = 2 * count;
+                    }
+                    else
+                    {
+                        count = DecodeMusic(m, lump_data, length, out[m], sizeof(out[m]), &bytes[m]);
+                    }
+                }
+
+                if (m == METHOD_LUT)
+                {
+                    lut_seconds[k] += Now() - t0;
+                }
+                else
+                {
+                    seconds[m] += Now() - t0;
+                }
+
+                if (m && (bytes[m] != bytes[0] || memcmp(out[0], out[m], bytes[0])))
+                {
+                    printf("lump %d: %s", lump, method_names[m]);
+
+                    if (m == METHOD_LUT)
+                    {
+                        printf(" (k=%d)", k);
+                    }
+
+                    printf(" output differs\n");
+                    ++mismatches;
+                }
+            }
+        }
+
+        symbols += count;
+        flats += is_flat;
+        patches += is_patch;
+        music += is_music;
+    }
+
+    printf("%d flats, %d patches, %d music lumps, %lld symbols (x%d passes), %d other lumps skipped\n",
+           flats, patches, music, symbols, passes, skipped);
+
+    for (m = 0; m < METHOD_LUT; ++m)
+    {
+        printf("  %-20s %8.2f Msymbols/s %6.2fx\n", method_names[m],
+               symbols * passes / seconds[m] * 1e-6, seconds[0] / seconds[m]);
+    }
+
+    for (k = k_first; k <= k_last; ++k)
+    {
+        char name[32];
+
+        snprintf(name, sizeof(name), "%s (k=%d)", method_names[METHOD_LUT], k);
+        printf("  %-20s %8.2f Msymbols/s %6.2fx  %s than the prefix table (%+.1f%%)\n", name,
+               symbols * passes / lut_seconds[k] * 1e-6, seconds[0] / lut_seconds[k],
+               lut_seconds[k] < seconds[METHOD_PREFIX] ? "faster" : "slower",
+               (seconds[METHOD_PREFIX] / lut_seconds[k] - 1) * 100);
+    }
+
+    return mismatches ? 1 : 0;
+}
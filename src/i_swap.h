@@ -21,7 +21,7 @@
 #ifndef __I_SWAP__
 #define __I_SWAP__
 
-#if !PICO_ON_DEVICE
+#if !PICO_ON_DEVICE && !IS_WHD_GEN
 #include "SDL_endian.h"
 #else
 #define SDL_SwapLE16(x) (x)
@@ -22,6 +22,11 @@
 #include <sys/param.h>
 #include "SDL.h"
 #include "SDL_opengl.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #ifdef _WIN32
 #ifndef WIN32_LEAN_AND_MEAN
@@ -66,6 +71,9 @@ static const char *window_title = "";
 // load the RGBA buffer to and that we render into another texture (4) which
 // is upscaled by an integer factor UPSCALE using "nearest" scaling and which
 // in turn is finally rendered to screen using "linear" scaling.
+//
+// With streaming_texture set, (2) is skipped: the paletted buffer is
+// expanded straight into the locked intermediate texture.
 
 static SDL_Surface *screenbuffer = NULL;
 static SDL_Surface *argbbuffer = NULL;
@@ -86,6 +94,13 @@ static uint32_t pixel_format;
 static SDL_Color palette[256];
 static boolean palette_to_set;
 
+// the palette in the texture's pixel format, for streaming_texture
+
+static uint32_t palette_pixels[256];
+#if defined(__aarch64__)
+static uint8_t palette_pixel_bytes[4][256];
+#endif
+
 // display has been set up?
 
 static boolean initialized = false;
@@ -146,6 +161,15 @@ int vga_porch_flash = false;
 
 int force_software_renderer = false;
 
+// Expand the screen straight into a locked streaming texture, rather than
+// blitting it to an intermediate surface and uploading that.
+
+int streaming_texture = false;
+
+// Print a breakdown of the time taken to update the screen?
+
+static boolean show_frame_times = false;
+
 // Time to wait for the screen to settle on startup before starting the
 // game (ms)
 
@@ -696,11 +720,173 @@ static void CreateUpscaledTexture(boolean force)
     }
 }
 
+// Expand a row of paletted pixels to 32 bit pixels with palette_pixels.
+
+static void ExpandPaletteRow(uint32_t *dest, const byte *src, int count)
+{
+    int i;
+
+    for (i = 0; i < count; ++i)
+    {
+        dest[i] = palette_pixels[src[i]];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void ExpandPaletteRowAVX2(uint32_t *dest, const byte *src, int count)
+{
+    int i;
+
+    for (i = 0; i + 8 <= count; i += 8)
+    {
+        __m256i indexes = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (src + i)));
+        _mm256_storeu_si256((__m256i *) (dest + i),
+                            _mm256_i32gather_epi32((const int *) palette_pixels, indexes, 4));
+    }
+
+    ExpandPaletteRow(dest + i, src + i, count - i);
+}
+#elif defined(__aarch64__)
+// No gather, so each byte of the pixels is looked up in its own 256 byte
+// table, 64 entries at a time (out of range indexes give 0).
+
+static void ExpandPaletteRowNEON(uint32_t *dest, const byte *src, int count)
+{
+    uint8x16x4_t tables[4][4];
+    int i, b, t;
+
+    for (b = 0; b < 4; ++b)
+    {
+        for (t = 0; t < 4; ++t)
+        {
+            tables[b][t] = vld1q_u8_x4(palette_pixel_bytes[b] + t * 64);
+        }
+    }
+
+    for (i = 0; i + 16 <= count; i += 16)
+    {
+        uint8x16_t indexes = vld1q_u8(src + i);
+        uint8x16x4_t pixels;
+
+        for (b = 0; b < 4; ++b)
+        {
+            pixels.val[b] = vqtbl4q_u8(tables[b][0], indexes);
+        }
+
+        for (t = 1; t < 4; ++t)
+        {
+            indexes = vsubq_u8(indexes, vdupq_n_u8(64));
+
+            for (b = 0; b < 4; ++b)
+            {
+                pixels.val[b] = vorrq_u8(pixels.val[b],
+                                         vqtbl4q_u8(tables[b][t], indexes));
+            }
+        }
+
+        vst4q_u8((uint8_t *) (dest + i), pixels);
+    }
+
+    ExpandPaletteRow(dest + i, src + i, count - i);
+}
+#endif
+
+static void (*expand_palette_row)(uint32_t *dest, const byte *src, int count)
+    = ExpandPaletteRow;
+
+static void SelectExpandPaletteRow(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (SDL_HasAVX2())
+    {
+        expand_palette_row = ExpandPaletteRowAVX2;
+    }
+#elif defined(__aarch64__)
+    expand_palette_row = ExpandPaletteRowNEON;
+#endif
+}
+
+static void UpdatePalettePixels(void)
+{
+    int i;
+
+    for (i = 0; i < 256; ++i)
+    {
+        palette_pixels[i] = SDL_MapRGB(argbbuffer->format, palette[i].r,
+                                       palette[i].g, palette[i].b);
+#if defined(__aarch64__)
+        palette_pixel_bytes[0][i] = palette_pixels[i];
+        palette_pixel_bytes[1][i] = palette_pixels[i] >> 8;
+        palette_pixel_bytes[2][i] = palette_pixels[i] >> 16;
+        palette_pixel_bytes[3][i] = palette_pixels[i] >> 24;
+#endif
+    }
+}
+
+// Expand the screen buffer straight into the (locked) intermediate texture.
+// Returns false if the texture couldn't be locked.
+
+static boolean StreamScreenToTexture(void)
+{
+    const byte *src = screenbuffer->pixels;
+    byte *dest;
+    void *pixels;
+    int pitch;
+    int y;
+
+    if (SDL_LockTexture(texture, NULL, &pixels, &pitch) != 0)
+    {
+        return false;
+    }
+
+    dest = pixels;
+
+    for (y = 0; y < SCREENHEIGHT; ++y)
+    {
+        expand_palette_row((uint32_t *) dest, src, SCREENWIDTH);
+        src += screenbuffer->pitch;
+        dest += pitch;
+    }
+
+    return true;
+}
+
+// Accumulated time spent in each part of I_FinishUpdate, for -frametimes.
+
+static struct
+{
+    uint64_t convert, upload, present;
+    int frames;
+} frame_times;
+
+static void ReportFrameTimes(uint64_t t0, uint64_t t1, uint64_t t2, uint64_t t3)
+{
+    double ms = 1000.0 / SDL_GetPerformanceFrequency();
+
+    frame_times.convert += t1 - t0;
+    frame_times.upload += t2 - t1;
+    frame_times.present += t3 - t2;
+
+    if (++frame_times.frames == TICRATE)
+    {
+        printf("I_FinishUpdate (%s): convert %.3fms, upload %.3fms, "
+               "present %.3fms per frame\n",
+               streaming_texture ? "streaming" : "blit",
+               frame_times.convert * ms / TICRATE,
+               frame_times.upload * ms / TICRATE,
+               frame_times.present * ms / TICRATE);
+        memset(&frame_times, 0, sizeof(frame_times));
+    }
+}
+
 //
 // I_FinishUpdate
 //
 void I_FinishUpdate (void)
 {
+    uint64_t t0, t1, t2, t3;
+    boolean streamed = false;
     static int lasttic;
     int tics;
     int i;
@@ -770,6 +956,7 @@ void I_FinishUpdate (void)
     if (palette_to_set)
     {
         SDL_SetPaletteColors(screenbuffer->format->palette, palette, 0, 256);
+        UpdatePalettePixels();
         palette_to_set = false;
 
         if (vga_porch_flash)
@@ -781,14 +968,32 @@ void I_FinishUpdate (void)
         }
     }
 
-    // Blit from the paletted 8-bit screen buffer to the intermediate
-    // 32-bit RGBA buffer that we can load into the texture.
+    t0 = SDL_GetPerformanceCounter();
+
+    if (streaming_texture && SDL_BYTESPERPIXEL(pixel_format) == 4)
+    {
+        streamed = StreamScreenToTexture();
+    }
+
+    if (streamed)
+    {
+        t1 = SDL_GetPerformanceCounter();
+        SDL_UnlockTexture(texture);
+    }
+    else
+    {
+        // Blit from the paletted 8-bit screen buffer to the intermediate
+        // 32-bit RGBA buffer that we can load into the texture.
 
-    SDL_LowerBlit(screenbuffer, &blit_rect, argbbuffer, &blit_rect);
+        SDL_LowerBlit(screenbuffer, &blit_rect, argbbuffer, &blit_rect);
+        t1 = SDL_GetPerformanceCounter();
 
-    // Update the intermediate texture with the contents of the RGBA buffer.
+        // Update the intermediate texture with the contents of the RGBA buffer.
 
-    SDL_UpdateTexture(texture, NULL, argbbuffer->pixels, argbbuffer->pitch);
+        SDL_UpdateTexture(texture, NULL, argbbuffer->pixels, argbbuffer->pitch);
+    }
+
+    t2 = SDL_GetPerformanceCounter();
 
     // Make sure the pillarboxes are kept clear each frame.
 
@@ -809,6 +1014,13 @@ void I_FinishUpdate (void)
 
     SDL_RenderPresent(renderer);
 
+    t3 = SDL_GetPerformanceCounter();
+
+    if (show_frame_times)
+    {
+        ReportFrameTimes(t0, t1, t2, t3);
+    }
+
     // Restore background and undo the disk indicator, if it was drawn.
     V_RestoreDiskBackground();
 }
@@ -976,6 +1188,16 @@ void I_GraphicsCheckCommandLine(void)
 
     nomouse = M_CheckParm("-nomouse") > 0;
 
+    //!
+    // @category video
+    //
+    // Print how long updating the screen takes each frame, split into
+    // converting the screen to 32 bit pixels, uploading it to the
+    // texture, and rendering and presenting it.
+    //
+
+    show_frame_times = M_ParmExists("-frametimes");
+
     //!
     // @category video
     // @arg <x>
@@ -1343,6 +1565,11 @@ static void SetVideoMode(void)
                                 SDL_TEXTUREACCESS_STREAMING,
                                 SCREENWIDTH, SCREENHEIGHT);
 
+    // The palette may now map to different pixels.
+
+    SelectExpandPaletteRow();
+    UpdatePalettePixels();
+
     // Initially create the upscaled texture for rendering to screen
 
     CreateUpscaledTexture(true);
@@ -1475,6 +1702,7 @@ void I_BindVideoVariables(void)
     M_BindIntVariable("fullscreen_height",         &fullscreen_height);
     M_BindIntVariable("force_software_renderer",   &force_software_renderer);
     M_BindIntVariable("max_scaling_buffer_pixels", &max_scaling_buffer_pixels);
+    M_BindIntVariable("streaming_texture",         &streaming_texture);
     M_BindIntVariable("window_width",              &window_width);
     M_BindIntVariable("window_height",             &window_height);
     M_BindIntVariable("grabmouse",                 &grabmouse);
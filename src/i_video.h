@@ -105,6 +105,7 @@ extern int aspect_ratio_correct;
 extern int integer_scaling;
 extern int vga_porch_flash;
 extern int force_software_renderer;
+extern int streaming_texture;
 
 extern should_be_const constcharstar window_position;
 void I_GetWindowPosition(int *x, int *y, int w, int h);
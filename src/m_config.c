@@ -799,6 +799,14 @@ static default_t extra_defaults_list[] =
 
     CONFIG_VARIABLE_INT(max_scaling_buffer_pixels),
 
+    //!
+    // If non-zero, the screen is converted straight into a streaming
+    // texture each frame, rather than via an intermediate 32-bit buffer.
+    // This saves a copy, but may not be supported by all renderers.
+    //
+
+    CONFIG_VARIABLE_INT(streaming_texture),
+
     //!
     // Number of milliseconds to wait on startup after the video mode
     // has been set, before the game will start.  This allows the
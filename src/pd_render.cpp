@@ -9,6 +9,7 @@
 
 #include "picodoom.h"
 #include "pico/sem.h"
+#include "pico/time.h"
 #include "hardware/gpio.h"
 #include "pico/divider.h"
 #include "image_decoder.h"
@@ -36,6 +37,212 @@ extern "C" {
 #define USE_CORE1_FOR_FLATS 1
 #endif
 #define USE_CORE1_FOR_REGULAR 1
+// resolve the per x column order once per frame (see resolve_pending_columns) rather than as columns are added
+#ifndef PD_BUCKET_SORT
+#define PD_BUCKET_SORT 0
+#endif
+#if !PICO_ON_DEVICE
+// on host builds the visplanes and regular columns can be drawn by more threads than the device has cores; the
+// columns are split into PD_RENDER_STRIPES vertical stripes of roughly equal cost
+#ifndef PD_RENDER_THREADS
+#define PD_RENDER_THREADS 1
+#endif
+#else
+static_assert(!PD_RENDER_THREADS || PD_RENDER_THREADS == 1, "");
+#endif
+#if PD_RENDER_THREADS > 1
+#include <atomic>
+#include <thread>
+#define PD_RENDER_STRIPES (PD_RENDER_THREADS * 2)
+// each render thread has its own decoder buffers/caches
+#define render_thread_local thread_local
+static thread_local bool render_worker_thread;
+// render worker threads may not be what the host thinks is core 0, but they never take the core 1 (audio core) paths
+#define on_audio_core() (!render_worker_thread && get_core_num())
+#else
+#define render_thread_local
+#define on_audio_core() get_core_num()
+#endif
+// host only: draw each in-game frame on a separate thread while the main thread gets on with the next tic. the column
+// lists and visplanes built by R_RenderPlayerView are in effect a snapshot of the frame, so other than the bits copied by
+// snapshot_frame_state, drawing doesn't look at game state at all (and the game never looks at the renderer's state)
+#ifndef PD_PIPELINE
+#define PD_PIPELINE 0
+#endif
+static_assert(!PICO_ON_DEVICE || !PD_PIPELINE, "");
+#if PD_PIPELINE && PD_RENDER_THREADS <= 1
+#include <thread>
+#endif
+// host only: SIMD versions of the column and flat span inner loops (which are otherwise done with the interpolators on
+// the device). they are picked in select_render_kernels; the scalar versions are the reference, and setting the
+// environment variable PD_SIMD=0 forces them (e.g. to check with PD_FBHASH that the output is identical)
+#ifndef PD_SIMD
+#if !PICO_ON_DEVICE && (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__))
+#define PD_SIMD 1
+#else
+#define PD_SIMD 0
+#endif
+#endif
+#if PD_SIMD
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+// count + 1 pixels, like col_render
+static void col_render_scalar(uint8_t *dest, uint count, const uint8_t *source, fixed_t frac, fixed_t fracstep, const lighttable_t *colormap) {
+    do {
+        *dest = colormap[source[(frac >> FRACBITS) & 127]];
+        dest += SCREENWIDTH;
+        frac += fracstep;
+    } while (count--);
+}
+
+// position/step are packed as for the span interpolator: 6.10 v in the top 16 bits, and 6.10 u in the bottom 16 bits
+static void span_render_scalar(uint8_t *p, int count, const uint8_t *flat_data, uint32_t position, uint32_t step, const lighttable_t *colormap) {
+    for (int i = 0; i < count; i++) {
+        uint32_t spot = ((position >> 4) & 0x0fc0) | (position >> 26);
+        position += step;
+        p[i] = colormap[flat_data[spot]];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// AVX2 has a 32 bit gather but no byte one, so we gather the aligned word containing each byte (which keeps the reads
+// within the flat/column/colormap) and shift the byte we want down
+__attribute__((target("avx2")))
+static inline __m256i gather_bytes_avx2(const uint8_t *base, __m256i index) {
+    __m256i words = _mm256_i32gather_epi32((const int *)base, _mm256_srli_epi32(index, 2), 4);
+    __m256i shift = _mm256_slli_epi32(_mm256_and_si256(index, _mm256_set1_epi32(3)), 3);
+    return _mm256_and_si256(_mm256_srlv_epi32(words, shift), _mm256_set1_epi32(0xff));
+}
+
+__attribute__((target("avx2")))
+static void col_render_avx2(uint8_t *dest, uint count, const uint8_t *source, fixed_t frac, fixed_t fracstep, const lighttable_t *colormap) {
+    if (((uintptr_t)source | (uintptr_t)colormap) & 3) {
+        col_render_scalar(dest, count, source, frac, fracstep, colormap);
+        return;
+    }
+    uint n = count + 1;
+    __m256i fracs = _mm256_add_epi32(_mm256_set1_epi32(frac), _mm256_mullo_epi32(_mm256_set1_epi32(fracstep),
+                                                                                  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    const __m256i step8 = _mm256_set1_epi32(fracstep * 8);
+    alignas(32) uint32_t pixels[8];
+    uint i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i texels = gather_bytes_avx2(source, _mm256_and_si256(_mm256_srli_epi32(fracs, FRACBITS), _mm256_set1_epi32(127)));
+        _mm256_store_si256((__m256i *)pixels, gather_bytes_avx2(colormap, texels));
+        fracs = _mm256_add_epi32(fracs, step8);
+        for (int j = 0; j < 8; j++) {
+            *dest = pixels[j];
+            dest += SCREENWIDTH;
+        }
+    }
+    if (i < n) col_render_scalar(dest, n - i - 1, source, frac + (fixed_t)(fracstep * i), fracstep, colormap);
+}
+
+__attribute__((target("avx2")))
+static void span_render_avx2(uint8_t *p, int count, const uint8_t *flat_data, uint32_t position, uint32_t step, const lighttable_t *colormap) {
+    if (((uintptr_t)flat_data | (uintptr_t)colormap) & 3) {
+        span_render_scalar(p, count, flat_data, position, step, colormap);
+        return;
+    }
+    __m256i pos = _mm256_add_epi32(_mm256_set1_epi32(position), _mm256_mullo_epi32(_mm256_set1_epi32(step),
+                                                                                  _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+    const __m256i step8 = _mm256_set1_epi32(step * 8);
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i spot = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi32(pos, 4), _mm256_set1_epi32(0x0fc0)),
+                                       _mm256_srli_epi32(pos, 26));
+        pos = _mm256_add_epi32(pos, step8);
+        __m256i pixels = gather_bytes_avx2(colormap, gather_bytes_avx2(flat_data, spot));
+        // narrow to bytes; each 128 bit lane ends up with its 4 pixels in the bottom 32 bits
+        pixels = _mm256_packus_epi16(_mm256_packus_epi32(pixels, pixels), pixels);
+        uint32_t lo = (uint32_t)_mm256_cvtsi256_si32(pixels);
+        uint32_t hi = (uint32_t)_mm_cvtsi128_si32(_mm256_extracti128_si256(pixels, 1));
+        memcpy(p + i, &lo, 4);
+        memcpy(p + i + 4, &hi, 4);
+    }
+    span_render_scalar(p + i, count - i, flat_data, position + step * i, step, colormap);
+}
+
+// no gather, so this just does the texture coordinates 4 at a time
+__attribute__((target("sse2")))
+static void span_render_sse2(uint8_t *p, int count, const uint8_t *flat_data, uint32_t position, uint32_t step, const lighttable_t *colormap) {
+    __m128i pos = _mm_add_epi32(_mm_set1_epi32(position), _mm_setr_epi32(0, step, step * 2, step * 3));
+    const __m128i step4 = _mm_set1_epi32(step * 4);
+    alignas(16) uint32_t spots[4];
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i spot = _mm_or_si128(_mm_and_si128(_mm_srli_epi32(pos, 4), _mm_set1_epi32(0x0fc0)), _mm_srli_epi32(pos, 26));
+        pos = _mm_add_epi32(pos, step4);
+        _mm_store_si128((__m128i *)spots, spot);
+        p[i] = colormap[flat_data[spots[0]]];
+        p[i + 1] = colormap[flat_data[spots[1]]];
+        p[i + 2] = colormap[flat_data[spots[2]]];
+        p[i + 3] = colormap[flat_data[spots[3]]];
+    }
+    span_render_scalar(p + i, count - i, flat_data, position + step * i, step, colormap);
+}
+#elif defined(__aarch64__)
+// no gather either, but the colormap lookup can be done with 4 64 byte table lookups (out of range indices give 0)
+static void span_render_neon(uint8_t *p, int count, const uint8_t *flat_data, uint32_t position, uint32_t step, const lighttable_t *colormap) {
+    const uint8x16x4_t cm0 = vld1q_u8_x4(colormap);
+    const uint8x16x4_t cm1 = vld1q_u8_x4(colormap + 64);
+    const uint8x16x4_t cm2 = vld1q_u8_x4(colormap + 128);
+    const uint8x16x4_t cm3 = vld1q_u8_x4(colormap + 192);
+    const uint32_t lane_steps[4] = { 0, step, step * 2, step * 3 };
+    uint32x4_t pos = vaddq_u32(vdupq_n_u32(position), vld1q_u32(lane_steps));
+    const uint32x4_t step4 = vdupq_n_u32(step * 4);
+    alignas(16) uint32_t spots[16];
+    alignas(16) uint8_t texels[16];
+    int i = 0;
+    for (; i + 16 <= count; i += 16) {
+        for (int j = 0; j < 16; j += 4) {
+            uint32x4_t spot = vorrq_u32(vandq_u32(vshrq_n_u32(pos, 4), vdupq_n_u32(0x0fc0)), vshrq_n_u32(pos, 26));
+            vst1q_u32(spots + j, spot);
+            pos = vaddq_u32(pos, step4);
+        }
+        for (int j = 0; j < 16; j++) texels[j] = flat_data[spots[j]];
+        uint8x16_t t = vld1q_u8(texels);
+        uint8x16_t pixels = vqtbl4q_u8(cm0, t);
+        pixels = vorrq_u8(pixels, vqtbl4q_u8(cm1, vsubq_u8(t, vdupq_n_u8(64))));
+        pixels = vorrq_u8(pixels, vqtbl4q_u8(cm2, vsubq_u8(t, vdupq_n_u8(128))));
+        pixels = vorrq_u8(pixels, vqtbl4q_u8(cm3, vsubq_u8(t, vdupq_n_u8(192))));
+        vst1q_u8(p + i, pixels);
+    }
+    span_render_scalar(p + i, count - i, flat_data, position + step * i, step, colormap);
+}
+#endif
+
+typedef void (*col_render_fn)(uint8_t *dest, uint count, const uint8_t *source, fixed_t frac, fixed_t fracstep, const lighttable_t *colormap);
+typedef void (*span_render_fn)(uint8_t *p, int count, const uint8_t *flat_data, uint32_t position, uint32_t step, const lighttable_t *colormap);
+static col_render_fn col_render_kernel = col_render_scalar;
+static span_render_fn span_render_kernel = span_render_scalar;
+
+static void select_render_kernels() {
+    const char *name = "scalar";
+    const char *env = getenv("PD_SIMD");
+    if (!env || atoi(env)) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            col_render_kernel = col_render_avx2;
+            span_render_kernel = span_render_avx2;
+            name = "avx2";
+        } else if (__builtin_cpu_supports("sse2")) {
+            span_render_kernel = span_render_sse2;
+            name = "sse2";
+        }
+#elif defined(__aarch64__)
+        span_render_kernel = span_render_neon;
+        name = "neon";
+#endif
+    }
+    printf("pd_render: using %s column/span kernels\n", name);
+}
+#endif
 #ifdef PICO_SPINLOCK_ID_OS2
 #define RENDER_SPIN_LOCK PICO_SPINLOCK_ID_OS2
 #else
@@ -75,6 +282,127 @@ statsomizer tex_count("texcount"), patch_count("patchcount");
 statsomizer patch_decoder_size("patch decoder size");
 #endif
 
+// cumulative renderer cache counters (everything is a uint32_t so the timedemo can treat them as an array)
+struct render_stat_counters {
+    uint32_t patch_column_cache_hits;
+    uint32_t patch_column_cache_misses;
+    uint32_t composite_column_cache_hits;
+    uint32_t composite_column_cache_misses;
+    uint32_t sky_cache_fills;
+    uint32_t occluded_masked_columns;
+    uint32_t flat_cache_hits;
+    uint32_t flat_cache_misses;
+    uint32_t flat_decode_us;
+    uint32_t patch_decoder_us;
+    uint32_t degraded_frames;
+};
+static render_stat_counters render_stats;
+#define RENDER_STATS_NAMES "patch_column_cache_hits", "patch_column_cache_misses", "composite_column_cache_hits", \
+        "composite_column_cache_misses", "sky_cache_fills", "occluded_masked_columns", \
+        "flat_cache_hits", "flat_cache_misses", "flat_decode_us", "patch_decoder_us", "degraded_frames"
+#if PD_RENDER_THREADS > 1
+#define render_stat_add(stat, n) __atomic_fetch_add(&render_stats.stat, (n), __ATOMIC_RELAXED)
+#else
+#define render_stat_add(stat, n) (render_stats.stat += (n))
+#endif
+
+// per frame use of the renderer's fixed size pools (and how often they overflowed), so they can be sized from real
+// maps rather than by guesswork. see pool_end_frame and pd_dump_pool_stats. host only by default, as on the device
+// it costs flash, RAM and time in every frame
+#ifndef PD_POOL_STATS
+#define PD_POOL_STATS (!PICO_ON_DEVICE)
+#endif
+#if PD_POOL_STATS
+struct pool_usage {
+    uint32_t cols;             // peak pd_column use (out of RENDER_COL_MAX)
+    uint32_t cols_failed;      // pd_column allocations which failed
+    uint32_t framedrawables;   // out of MAX_FRAME_DRAWABLES
+    uint32_t visplanes;        // out of MAXVISPLANES
+    uint32_t flat_run_refills; // times draw_visplanes ran out of flat_runs and had to flush early
+    uint32_t decoder_hwm;      // patch decoder circular buffer high water mark in hwords
+    uint32_t decoder_hwords;   // patch decoder hwords decoded; more than the circular buffer size means we thrashed
+};
+#define POOL_USAGE_NAMES "cols", "cols_failed", "framedrawables", "visplanes", "flat_run_refills", "decoder_hwm", "decoder_hwords"
+#define POOL_USAGE_COUNT (sizeof(pool_usage) / sizeof(uint32_t))
+static pool_usage frame_pools;
+#if PD_RENDER_THREADS > 1
+#define pool_usage_add(field, n) __atomic_fetch_add(&frame_pools.field, (n), __ATOMIC_RELAXED)
+static inline void pool_usage_max_u32(uint32_t *field, uint32_t v) {
+    uint32_t old = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while (old < v && !__atomic_compare_exchange_n(field, &old, v, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+#define pool_usage_max(field, v) pool_usage_max_u32(&frame_pools.field, (v))
+#else
+#define pool_usage_add(field, n) (frame_pools.field += (n))
+#define pool_usage_max(field, v) (frame_pools.field = std::max(frame_pools.field, (uint32_t)(v)))
+#endif
+#else
+#define pool_usage_add(field, n) ((void)0)
+#define pool_usage_max(field, v) ((void)0)
+#endif
+
+#if PD_TIMEDEMO
+// host only headless benchmark; we can't see the debug pins on a build box, so time the same phases in wall time
+static_assert(!PICO_ON_DEVICE, "");
+#include <time.h>
+#include <vector>
+enum td_phase {
+    TD_INSERT,          // pd_add_column/pd_add_masked_columns/pd_add_plane_column (inc push_down_x)
+    TD_FLUSH_VISPLANES, // note this is also included in TD_DRAW_VISPLANES
+    TD_DRAW_VISPLANES,
+    TD_COMPOSITE,
+    TD_PATCH,
+    TD_FUZZ,
+    TD_FRAME,           // pd_begin_frame -> pd_end_frame, so includes BSP walk and overlays too
+    TD_PHASE_COUNT
+};
+static const char *const td_phase_names[TD_PHASE_COUNT] = {
+        "insert", "flush_visplanes", "draw_visplanes", "draw_composite_columns", "draw_patch_columns", "draw_fuzz_columns", "frame"
+};
+#define TD_STAT_COUNT (sizeof(render_stats) / sizeof(uint32_t))
+static const char *const td_stat_names[] = { RENDER_STATS_NAMES };
+static_assert(count_of(td_stat_names) == TD_STAT_COUNT, "");
+#if PD_POOL_STATS
+static const char *const td_pool_names[] = { POOL_USAGE_NAMES };
+static_assert(count_of(td_pool_names) == POOL_USAGE_COUNT, "");
+#endif
+struct td_frame_record {
+    uint64_t ns[TD_PHASE_COUNT];
+    uint32_t stats[TD_STAT_COUNT]; // render_stats delta for this frame
+#if PD_POOL_STATS
+    pool_usage pools;
+#endif
+    int gametic;
+    int cols;
+    bool degraded; // drawn at half horizontal resolution by the governor
+};
+struct td_demo_record {
+    const char *name;
+    std::vector<td_frame_record> frames;
+};
+static std::vector<td_demo_record> td_demos;
+static uint64_t td_phase_ns[TD_PHASE_COUNT];
+static uint64_t td_frame_start;
+static render_stat_counters td_frame_start_stats;
+
+static inline uint64_t td_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct td_scope {
+    explicit td_scope(td_phase phase) : phase(phase), t0(td_now_ns()) {}
+    // atomic as phases may run in several render threads at once (in which case they record total thread time)
+    ~td_scope() { __atomic_fetch_add(&td_phase_ns[phase], td_now_ns() - t0, __ATOMIC_RELAXED); }
+    td_phase phase;
+    uint64_t t0;
+};
+#define TD_SCOPE(phase) td_scope __td_scope(phase)
+#else
+#define TD_SCOPE(phase) ((void)0)
+#endif
+
 #if PICO_ON_DEVICE
 
 #include "hardware/interp.h"
@@ -88,6 +416,9 @@ extern "C" {
 #include "w_wad.h"
 #include "z_zone.h"
 #include "doom/r_plane.h"
+#if !PICO_ON_DEVICE
+#include "fb_hash.h"
+#endif
 void I_UpdateSound(void);
 }
 void draw_cast_sprite(int sprite_lump);
@@ -100,23 +431,197 @@ wipestate_t wipestate;
 static uint8_t post_wipecount;
 
 // todo these are only needed temporarily, so stack or "tmp buffer"
-static uint16_t flat_decoder_buf[WHD_FLAT_DECODER_MAX_SIZE];
-static uint8_t flat_decoder_tmp[WHD_FLAT_DECODER_MAX_SIZE];
+static render_thread_local uint16_t flat_decoder_buf[WHD_FLAT_DECODER_MAX_SIZE];
+static render_thread_local uint8_t __aligned(4) flat_decoder_tmp[WHD_FLAT_DECODER_MAX_SIZE];
+// flats are decoded with a PD_FLAT_LUT_BITS bit lookup table (see th_decode_lut) built in flat_decoder_tmp, rather than
+// the 8 bit prefix length table patches use; 0 goes back to the latter. host only by default, until it has been measured
+// on the device
+#ifndef PD_FLAT_LUT_BITS
+#if PICO_ON_DEVICE
+#define PD_FLAT_LUT_BITS 0
+#else
+#define PD_FLAT_LUT_BITS 8
+#endif
+#endif
+static_assert((2u << PD_FLAT_LUT_BITS) <= sizeof(flat_decoder_tmp), "");
 #define PATCH_DECODER_HASH_SIZE 128
 static_assert(__builtin_popcount(PATCH_DECODER_HASH_SIZE)==1, "");
-static int16_t patch_hash_offsets[PATCH_DECODER_HASH_SIZE];
+static render_thread_local int16_t patch_hash_offsets[PATCH_DECODER_HASH_SIZE];
 #define PATCH_DECODER_CIRCULAR_BUFFER_SIZE (2048-256)
-static uint16_t patch_decoder_circular_buf[PATCH_DECODER_CIRCULAR_BUFFER_SIZE];
-static uint16_t patch_decoder_circular_buf_write_pos;
-static uint16_t patch_decoder_circular_buf_write_limit;
+static render_thread_local uint16_t patch_decoder_circular_buf[PATCH_DECODER_CIRCULAR_BUFFER_SIZE];
+static render_thread_local uint16_t patch_decoder_circular_buf_write_pos;
+static render_thread_local uint16_t patch_decoder_circular_buf_write_limit;
 // this is used when decoding decoders, but also as a cache for up to 4 decoder tables (each of which are 256 bytes big)
-static uint8_t patch_decoder_tmp[256 * WHD_MAX_COL_UNIQUE_PATCHES];
+static render_thread_local uint8_t patch_decoder_tmp[256 * WHD_MAX_COL_UNIQUE_PATCHES];
 // which patch decoder table (or 0 if none) is stored in each of the 256 byte areas in patch_decoder_tmp
-static uint16_t patch_decoder_tmp_table_patch_numbers[WHD_MAX_COL_UNIQUE_PATCHES];
+static render_thread_local uint16_t patch_decoder_tmp_table_patch_numbers[WHD_MAX_COL_UNIQUE_PATCHES];
+
+// caches of decoded patch columns and of composited (multi-patch) texture columns which survive across frames, with LRU
+// eviction. PD_PATCH_COLUMN_CACHE_SIZE and PD_COMPOSITE_COLUMN_CACHE_SIZE are the RAM budgets in bytes (per render
+// thread), and 0 disables them. they are only used from core 0 on the device
+#ifndef PD_PATCH_COLUMN_CACHE_SIZE
+#if PICO_ON_DEVICE
+#define PD_PATCH_COLUMN_CACHE_SIZE 0
+#else
+#define PD_PATCH_COLUMN_CACHE_SIZE (128 * 1024)
+#endif
+#endif
+// composite columns are keyed by the texture number actually drawn (i.e. after texturetranslation and switch state), and
+// the texture data never changes, so animated and switched walls just use different entries; nothing is ever stale
+#ifndef PD_COMPOSITE_COLUMN_CACHE_SIZE
+#if PICO_ON_DEVICE
+#define PD_COMPOSITE_COLUMN_CACHE_SIZE 0
+#else
+#define PD_COMPOSITE_COLUMN_CACHE_SIZE (64 * 1024)
+#endif
+#endif
+// the sky texture is a single patch drawn unscaled, and only changes with the level, so with PD_SKY_CACHE its columns
+// are decoded (and lit) once into sky_cache, and drawn by sky_col_render which is just a copy. this costs 32K per
+// render thread, so it is off on the device
+#ifndef PD_SKY_CACHE
+#if PICO_ON_DEVICE
+#define PD_SKY_CACHE 0
+#else
+#define PD_SKY_CACHE 1
+#endif
+#endif
+#if PD_PATCH_COLUMN_CACHE_SIZE || PD_COMPOSITE_COLUMN_CACHE_SIZE
+// columns taller than this aren't cached (almost all patches are at most 128 high, and textures wrap at 128)
+#define COLUMN_CACHE_MAX_PIXELS 128
+struct column_cache_slot {
+    uint16_t id; // patch or texture number
+    uint16_t col;
+    int16_t hash_next;
+    int16_t lru_prev;
+    int16_t lru_next;
+    uint8_t count; // number of pixels decoded from the top of the column
+    uint8_t pixels[COLUMN_CACHE_MAX_PIXELS];
+};
+#define COLUMN_CACHE_HASH_SIZE 256
+
+template<uint SIZE> struct column_cache {
+    static constexpr uint SLOTS = SIZE / sizeof(column_cache_slot);
+    static_assert(SLOTS > 0 && SLOTS < 0x8000, "");
+    column_cache_slot slots[SLOTS];
+    int16_t hash[COLUMN_CACHE_HASH_SIZE];
+    int16_t lru_head, lru_tail;
+    uint16_t used;
+
+    void init() {
+        memset(hash, -1, sizeof(hash));
+        lru_head = lru_tail = -1;
+        used = 0;
+    }
+
+    static int bucket(int id, int col) {
+        return (id * 31 + col) & (COLUMN_CACHE_HASH_SIZE - 1);
+    }
+
+    void lru_unlink(int16_t s) {
+        auto &slot = slots[s];
+        if (slot.lru_prev >= 0) slots[slot.lru_prev].lru_next = slot.lru_next;
+        else lru_head = slot.lru_next;
+        if (slot.lru_next >= 0) slots[slot.lru_next].lru_prev = slot.lru_prev;
+        else lru_tail = slot.lru_prev;
+    }
+
+    void lru_push_front(int16_t s) {
+        auto &slot = slots[s];
+        slot.lru_prev = -1;
+        slot.lru_next = lru_head;
+        if (lru_head >= 0) slots[lru_head].lru_prev = s;
+        else lru_tail = s;
+        lru_head = s;
+    }
+
+    int16_t find(int id, int col) const {
+        for (int16_t s = hash[bucket(id, col)]; s >= 0; s = slots[s].hash_next) {
+            if (slots[s].id == id && slots[s].col == col) return s;
+        }
+        return -1;
+    }
+
+    // whether we have at least the top count pixels of the column
+    bool contains(int id, int col, int count) const {
+        int16_t s = find(id, col);
+        return s >= 0 && slots[s].count >= count;
+    }
+
+    // copies the top count pixels of the column into pixels if we have them
+    bool lookup(int id, int col, uint8_t *pixels, int count) {
+        int16_t s = find(id, col);
+        if (s >= 0 && slots[s].count >= count) {
+            memcpy(pixels, slots[s].pixels, count);
+            if (s != lru_head) {
+                lru_unlink(s);
+                lru_push_front(s);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void store(int id, int col, const uint8_t *pixels, int count) {
+        if (count > COLUMN_CACHE_MAX_PIXELS) return;
+        int16_t s = find(id, col);
+        if (s < 0) {
+            if (used < SLOTS) {
+                s = (int16_t)used++;
+            } else {
+                // evict the least recently used column
+                s = lru_tail;
+                lru_unlink(s);
+                int16_t *prev = &hash[bucket(slots[s].id, slots[s].col)];
+                while (*prev != s) prev = &slots[*prev].hash_next;
+                *prev = slots[s].hash_next;
+            }
+            auto &slot = slots[s];
+            slot.id = id;
+            slot.col = col;
+            int b = bucket(id, col);
+            slot.hash_next = hash[b];
+            hash[b] = s;
+        } else {
+            // we had a shorter version of this column
+            lru_unlink(s);
+        }
+        lru_push_front(s);
+        slots[s].count = count;
+        memcpy(slots[s].pixels, pixels, count);
+    }
+};
+#endif
+#if PD_PATCH_COLUMN_CACHE_SIZE
+static render_thread_local column_cache<PD_PATCH_COLUMN_CACHE_SIZE> patch_column_cache;
+#endif
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+static render_thread_local column_cache<PD_COMPOSITE_COLUMN_CACHE_SIZE> composite_column_cache;
+#endif
+#if PD_SKY_CACHE
+// skies wider or taller than this (only possible in PWADs) are just drawn as regular patches
+#define SKY_CACHE_MAX_WIDTH 256
+#define SKY_CACHE_HEIGHT 128
+struct sky_column_cache {
+    int patch_num; // -1 if nothing is cached
+    int colormap_index; // the pixels are already mapped through this colormap
+    uint16_t w;
+    uint8_t pixels[SKY_CACHE_MAX_WIDTH][SKY_CACHE_HEIGHT];
+};
+static render_thread_local sky_column_cache sky_cache;
+#endif
 // in case we max out columns during regular rendering, we will be left with gaps in the screen
 // so we keep a bit set for each 4 columns (no harm in clearing columns a word wide)
 static uint32_t not_fully_covered_cols[(SCREENWIDTH/4 + 31)/32];
 static uint8_t not_fully_covered_yl, not_fully_covered_yh;
+#if PD_OCCLUSION
+// coarse occlusion for masked columns, at the same granularity of 4 columns: a bit set for each group whose columns have
+// all been closed by solid walls (see pd_close_column), and the furthest iscale of anything in the group, in units of
+// 1 << OCCLUSION_ISCALE_SHIFT (rounded up so it stays conservative)
+#define OCCLUSION_ISCALE_SHIFT 8
+static uint32_t occluded_groups[(SCREENWIDTH/4 + 31)/32];
+static uint8_t occlusion_closed_cols[SCREENWIDTH/4]; // bit per closed column of the group
+static uint16_t occlusion_max_iscale[SCREENWIDTH/4];
+#endif
 static int16_t fd_heads[MAX_FRAME_DRAWABLES]; // frame drawable linked lists
 vpatchlists_t *vpatchlists;
 int16_t visplane_heads[MAXVISPLANES];
@@ -265,6 +770,22 @@ static_assert(sizeof(pd_column) == sizeof(flat_run) * 2, ""); // we pack two int
 
 static __aligned(4) int16_t column_heads[SCREENWIDTH * 2];
 #define fuzzy_column_heads (&column_heads[SCREENWIDTH])
+// bit per x whose (non fuzzy) columns have changed since a fuzzy column was inserted there; only these need reclipping
+static uint32_t fuzzy_x_needs_reclip[(SCREENWIDTH + 31) / 32];
+// fuzzy columns are reclipped and drawn a batch at a time; a batch is the run of x's covered by a drawable's fuzzy
+// columns (as these are added left to right), and batches which overlap are merged by reclip_fuzz_columns so each x is
+// in at most one. when there are too many drawables, the last batch is just widened to cover the rest
+#define MAX_FUZZ_BATCHES 32
+struct fuzz_batch {
+    int16_t x1, x2;
+};
+static fuzz_batch fuzz_batches[MAX_FUZZ_BATCHES];
+static int fuzz_batch_count;
+// fuzzoffset position each x starts at, relative to fuzzpos at the start of draw_fuzz_columns, and the total advance
+// over the frame. these are filled in by reclip_fuzz_columns, so each column can be drawn independently of the others
+// (fuzz only reads the pixels above and below in the same column)
+static uint8_t fuzz_start[SCREENWIDTH];
+static uint8_t fuzz_advance;
 
 static void SafeUpdateSound() {
     boolean save = false;
@@ -321,20 +842,202 @@ const char *type_name(pd_column column) {
 static uint8_t __aligned(4) list_buffer[RENDER_COL_MAX * sizeof(pd_column) + 64*64]; // extra 64*64 is for one flat
 static uint8_t *last_list_buffer_limit = list_buffer + sizeof(list_buffer);
 //static_assert(text_font_cpy > list_buffer, "");
-#define MAX_CACHED_FLATS (sizeof(list_buffer) / 4096)
-static uint8_t cached_flat_picnum[MAX_CACHED_FLATS];
+// list_buffer and visplane_bit are each shared by several phases of a frame (and by users between frames), so rather
+// than every borrower knowing who else has the same bytes when, each phase leases the range it uses from the frame
+// arena and gets at it through arena_ptr. the buffers' owners (the pd_columns and flat runs, and the visplane bits
+// themselves) still use them directly on their hot paths, but lease what they use so borrowers are checked against
+// them. with PD_ARENA_CHECKS, a lease overlapping a live lease of another phase, or an access outside a phase's lease,
+// panics. the peak bytes leased by each phase are printed with the pool stats
+#ifndef PD_ARENA_CHECKS
+#if PICO_ON_DEVICE || defined(NDEBUG)
+#define PD_ARENA_CHECKS 0
+#else
+#define PD_ARENA_CHECKS 1
+#endif
+#endif
+enum arena_phase {
+    ARENA_INSERTION,  // list_buffer: the frame's pd_columns (and the flat runs made from them) until it is finished
+    ARENA_VISPLANES,  // visplane_bit: from pd_begin_frame until draw_visplanes (on whichever core) has read it
+    ARENA_FLATS,      // list_buffer: the flat cache regions usable this frame
+    ARENA_PATCHES,    // visplane_bit: core 1's column heads and heights for draw_patch_columns
+    ARENA_OVERLAYS,   // list_buffer: the wipe's data, until its last frame is off screen
+    ARENA_WORK_AREA,  // list_buffer: pd_get_work_area (loading and saving games, ENDOOM) until the next frame
+    ARENA_PHASE_COUNT
+};
+static const char *const arena_phase_names[ARENA_PHASE_COUNT] = {
+        "insertion", "visplanes", "flats", "patches", "overlays", "work area"
+};
+// column heads (int16_t) then heights (uint8_t) for core 1's draw_patch_columns
+#define ARENA_PATCH_SCRATCH_SIZE (WHD_PATCH_MAX_WIDTH * 3)
+static_assert(sizeof(visplane_bit) >= ARENA_PATCH_SCRATCH_SIZE, "");
+
+struct arena_lease {
+    uint8_t *start; // nullptr when not leased
+    uint32_t size;
+};
+static arena_lease arena_leases[ARENA_PHASE_COUNT];
+static uint32_t arena_peak[ARENA_PHASE_COUNT]; // bytes, for the current map
+
+static inline bool arena_live(arena_phase phase) {
+    return arena_leases[phase].start != nullptr;
+}
+
+static inline void arena_release(arena_phase phase) {
+    arena_leases[phase].start = nullptr;
+    arena_leases[phase].size = 0;
+}
+
+// phase now uses [start, start + size), in place of anything it had leased before
+static void arena_lease_range(arena_phase phase, uint8_t *start, uint32_t size) {
+#if PD_ARENA_CHECKS
+    bool in_list_buffer = start >= list_buffer && start + size <= list_buffer + sizeof(list_buffer);
+    bool in_visplane_bit = start >= visplane_bit && start + size <= visplane_bit + sizeof(visplane_bit);
+    if (!in_list_buffer && !in_visplane_bit) {
+        panic("pd_render: arena %s lease of %d bytes is outside the arena", arena_phase_names[phase], (int)size);
+    }
+    for (int p = 0; p < ARENA_PHASE_COUNT; p++) {
+        const arena_lease &l = arena_leases[p];
+        if (p != phase && l.start && start < l.start + l.size && l.start < start + size) {
+            panic("pd_render: arena %s lease overlaps %s", arena_phase_names[phase], arena_phase_names[p]);
+        }
+    }
+#endif
+    arena_leases[phase].start = start;
+    arena_leases[phase].size = size;
+    if (size > arena_peak[phase]) arena_peak[phase] = size;
+}
+
+// for borrowers which work out their own addresses
+static inline void arena_check(arena_phase phase, const uint8_t *p, uint32_t size) {
+#if PD_ARENA_CHECKS
+    const arena_lease &l = arena_leases[phase];
+    if (!l.start || p < l.start || p + size > l.start + l.size) {
+        panic("pd_render: arena %s access outside its lease", arena_phase_names[phase]);
+    }
+#endif
+}
+
+// count Ts at offset bytes into phase's lease
+template<typename T> static inline T *arena_ptr(arena_phase phase, uint32_t count, uint32_t offset = 0) {
+    uint8_t *p = arena_leases[phase].start + offset;
+    arena_check(phase, p, count * sizeof(T));
+    return (T *)p;
+}
+
+// decoded flats are cached in 4K entries: PD_FLAT_CACHE_RESERVED_SLOTS dedicated ones which are always available, followed
+// by the 4K regions counted down from the top of list_buffer. cached_flat_slots of those regions (always at least one),
+// starting at cached_flat0, are usable each frame depending on how much space the columns and any wipe left free. since
+// entries are tied to regions rather than slot numbers, a flat survives changes in the number of free regions as long as
+// nothing was written over it
+#ifndef PD_FLAT_CACHE_RESERVED_SLOTS
+#if PICO_ON_DEVICE
+#define PD_FLAT_CACHE_RESERVED_SLOTS 0
+#else
+#define PD_FLAT_CACHE_RESERVED_SLOTS 8
+#endif
+#endif
+#define LIST_BUFFER_FLAT_REGIONS (sizeof(list_buffer) / 4096)
+#define MAX_CACHED_FLATS (PD_FLAT_CACHE_RESERVED_SLOTS + LIST_BUFFER_FLAT_REGIONS)
+#if PD_FLAT_CACHE_RESERVED_SLOTS
+static uint8_t __aligned(4) reserved_flat_slots[PD_FLAT_CACHE_RESERVED_SLOTS][4096];
+#endif
+static uint8_t cached_flat_picnum[MAX_CACHED_FLATS]; // 0xff for none
+static uint32_t cached_flat_last_use[MAX_CACHED_FLATS];
+static uint32_t flat_cache_clock;
 static uint8_t cached_flat_slots;
 static uint8_t *cached_flat0;
+
+static inline uint8_t *flat_cache_region(int region) {
+    return list_buffer + sizeof(list_buffer) - (region + 1) * 4096;
+}
+
+static inline uint8_t *flat_cache_entry_data(int entry) {
+#if PD_FLAT_CACHE_RESERVED_SLOTS
+    if (entry < PD_FLAT_CACHE_RESERVED_SLOTS) return reserved_flat_slots[entry];
+#endif
+    uint8_t *region = flat_cache_region(entry - PD_FLAT_CACHE_RESERVED_SLOTS);
+    arena_check(ARENA_FLATS, region, 4096);
+    return region;
+}
+
+// the usable entries are [0, PD_FLAT_CACHE_RESERVED_SLOTS) and [first, end) below
+static inline int flat_cache_first_region_entry() {
+    return PD_FLAT_CACHE_RESERVED_SLOTS + (flat_cache_region(0) - cached_flat0) / 4096;
+}
+
+static inline int flat_cache_next_entry(int entry, int first) {
+    entry++;
+    return entry == PD_FLAT_CACHE_RESERVED_SLOTS ? first : entry;
+}
+
+#define for_each_usable_flat_cache_entry(e) \
+    for (int first = flat_cache_first_region_entry(), end = first + cached_flat_slots, \
+         e = PD_FLAT_CACHE_RESERVED_SLOTS ? 0 : first; e < end; e = flat_cache_next_entry(e, first))
+
+static int flat_cache_find(int picnum) {
+    for_each_usable_flat_cache_entry(e) {
+        if (cached_flat_picnum[e] == picnum) return e;
+    }
+    return -1;
+}
+
+// least recently used (or empty) entry
+static int flat_cache_victim() {
+    int victim = -1;
+    for_each_usable_flat_cache_entry(e) {
+        if (cached_flat_picnum[e] == 0xff) return e;
+        if (victim < 0 || cached_flat_last_use[e] < cached_flat_last_use[victim]) victim = e;
+    }
+    assert(victim >= 0);
+    return victim;
+}
+
+static inline uint8_t *flat_cache_use(int entry) {
+    cached_flat_last_use[entry] = ++flat_cache_clock;
+    return flat_cache_entry_data(entry);
+}
+
+// the flat cache regions usable this frame (see cached_flat_slots)
+static void arena_lease_flat_regions() {
+    uint8_t *lowest = cached_flat0 - (cached_flat_slots - 1) * 4096;
+    arena_lease_range(ARENA_FLATS, lowest, cached_flat_slots * 4096);
+}
+
+// once cached_flat_slots has been limited to the regions above the columns
+static void lease_columns_and_flat_regions(uint32_t col_bytes) {
+    // regions below the ones we can use this frame may have been overwritten by columns
+    for(int e = flat_cache_first_region_entry() + cached_flat_slots; e < (int)MAX_CACHED_FLATS; e++) {
+        cached_flat_picnum[e] = 0xff;
+    }
+    arena_release(ARENA_FLATS);
+    arena_lease_range(ARENA_INSERTION, list_buffer, col_bytes);
+    arena_lease_flat_regions();
+}
 static int16_t render_col_count;
 #define render_cols ((pd_column *)list_buffer)
 #define flat_runs ((flat_run *)list_buffer)
 static int16_t render_col_free;
+static uint16_t render_col_failed; // allocations this frame which failed because we were out of columns
+
+#if PD_BUCKET_SORT
+static bool columns_pending; // append_pending_group has been called since the last resolve_pending_columns
+static bool resolving_pending;
+static void resolve_pending_columns_guts();
+#endif
 
 static int16_t alloc_pd_column(int x) {
+#if PD_BUCKET_SORT
+    // the pending columns still hold everything that will end up occluded, so resolve them early to free that, which
+    // leaves the pool about as full as sorted insertion would have it
+    if (render_col_free < 0 && render_col_count == RENDER_COL_MAX && columns_pending && !resolving_pending) {
+        resolve_pending_columns_guts();
+    }
+#endif
     if (render_col_free < 0) {
         if (render_col_count == RENDER_COL_MAX) {
             assert(x>=0 && x<SCREENWIDTH);
             not_fully_covered_cols[x/(4*32)] |= 1u << ((x/4)&31);
+            render_col_failed++;
             return -1;
         }
         render_col_free = render_col_count++;
@@ -352,6 +1055,99 @@ static void free_pd_column(int16_t rc_index) {
     render_col_free = rc_index;
 }
 
+// frame budget governor: running out of columns mid frame leaves black gaps (see not_fully_covered_cols and
+// uh_oh_discard_columns), and running over time drops frames, so we predict from the previous few frames whether the
+// next one is likely to do either, and if so render it at half horizontal resolution instead (a la R_DrawColumnLow);
+// only columns at even x are added, and each is then copied to the odd x to its right. off by default, as the output
+// then depends on how long frames take
+#ifndef PD_GOVERNOR
+#define PD_GOVERNOR 0
+#endif
+#if PD_GOVERNOR
+#ifndef PD_FRAME_BUDGET_US
+#define PD_FRAME_BUDGET_US (1000000 / 35)
+#endif
+#define GOVERNOR_HISTORY 4
+// frames predicted to be fine at full resolution before we switch back (so we don't flicker between the two)
+#define GOVERNOR_CALM_FRAMES 8
+static struct {
+    // estimates for recent full resolution frames (degraded frames are scaled up)
+    uint32_t cols_history[GOVERNOR_HISTORY];
+    uint32_t us_history[GOVERNOR_HISTORY];
+    uint8_t pos;
+    uint8_t calm_frames;
+    bool degrade_next;
+    bool degraded; // the current frame
+    uint32_t frame_start_us;
+    uint32_t render_us; // time spent rendering this frame so far, excluding waiting for the display
+} governor;
+#define governor_skip_x(x) (governor.degraded && ((x) & 1))
+
+static void governor_begin_frame() {
+    governor.degraded = governor.degrade_next && gamestate == GS_LEVEL && !wipestate && !automapactive;
+    if (governor.degraded) render_stat_add(degraded_frames, 1);
+    governor.frame_start_us = time_us_32();
+    governor.render_us = 0;
+}
+
+static inline void governor_pause() {
+    governor.render_us += time_us_32() - governor.frame_start_us;
+}
+
+static inline void governor_resume() {
+    governor.frame_start_us = time_us_32();
+}
+
+static void double_up_columns() {
+    // governor_skip_x is in view coordinates, so only double up within the view window
+    for (int y = 0; y < viewheight; y++) {
+        uint8_t *p = render_frame_buffer + (viewwindowy + y) * SCREENWIDTH + viewwindowx;
+        for (int x = 0; x + 1 < viewwidth; x += 2) {
+            p[x + 1] = p[x];
+        }
+    }
+}
+
+// peak of recent values plus the latest trend
+static uint32_t governor_predict(const uint32_t *v) {
+    uint32_t peak = 0;
+    for (int i = 0; i < GOVERNOR_HISTORY; i++) peak = std::max(peak, v[i]);
+    uint32_t last = v[(governor.pos + GOVERNOR_HISTORY - 1) % GOVERNOR_HISTORY];
+    uint32_t prev = v[(governor.pos + GOVERNOR_HISTORY - 2) % GOVERNOR_HISTORY];
+    return peak + (last > prev ? last - prev : 0);
+}
+
+static void governor_end_frame(int col_capacity) {
+    if (gamestate != GS_LEVEL) {
+        // start afresh next level
+        memset(&governor, 0, sizeof(governor));
+        return;
+    }
+    uint32_t cols = render_col_count + render_col_failed;
+    uint32_t us = governor.render_us;
+    if (governor.degraded) {
+        // half the columns, but not everything we do is per column
+        cols *= 2;
+        us = us * 3 / 2;
+    }
+    governor.cols_history[governor.pos] = cols;
+    governor.us_history[governor.pos] = us;
+    governor.pos = (governor.pos + 1) % GOVERNOR_HISTORY;
+    uint32_t predicted_cols = governor_predict(governor.cols_history);
+    uint32_t predicted_us = governor_predict(governor.us_history);
+    // leave some columns spare so we still have room for a decent number of flats
+    bool overloaded = predicted_cols > (uint32_t)col_capacity * 7 / 8 || predicted_us > PD_FRAME_BUDGET_US;
+    if (overloaded) {
+        governor.degrade_next = true;
+        governor.calm_frames = 0;
+    } else if (governor.degrade_next && ++governor.calm_frames == GOVERNOR_CALM_FRAMES) {
+        governor.degrade_next = false;
+    }
+}
+#else
+#define governor_skip_x(x) false
+#endif
+
 #if DUMP_SORTING
 
 const char *column_desc(int index) {
@@ -385,6 +1181,7 @@ static void dump_column(int x, const char *prefix) {
 
 // new_index can be a (non overlapping) linked list (in ascending y order)
 static void push_down_x_guts(int x, int16_t new_index) {
+    if (fuzzy_column_heads[x] >= 0) fuzzy_x_needs_reclip[x >> 5] |= 1u << (x & 31);
     int16_t *prev_existing_ptr = &column_heads[x];
     int16_t existing_index = *prev_existing_ptr;
 //    dump_column(x, "before");
@@ -729,6 +1526,103 @@ static void push_down_x_fuzzy(int x, int16_t new_index) {
 //    dump_column(x+SCREENWIDTH, "after");
 }
 
+#if PD_BUCKET_SORT
+// alternative to keeping each x's list sorted as columns are inserted: new columns (or y sorted chains of masked column
+// pieces, which share a scale) are appended to a pending list per x, and are all resolved before drawing by sorting
+// them front to back (bucketed on quantized scale first) and then inserting them in that order, at which point every
+// insertion is behind everything already there so nothing inserted is ever clipped or freed again. the front-most column
+// wins each pixel, with the earliest inserted winning ties, just as with insertion order, so the output is identical as
+// long as the column pool doesn't run out. columns stay allocated until they are resolved, so when the pool does run out
+// everything pending is resolved there and then (see alloc_pd_column); the frame then goes on as with sorted insertion,
+// but which columns are dropped once the pool is really full can differ, so such frames may not be identical (they are
+// marked in the frame hash stream, see hash_frame)
+static int16_t pending_heads[SCREENWIDTH];
+static int16_t pending_tails[SCREENWIDTH];
+static int16_t pending_group_next[RENDER_COL_MAX]; // indexed by the first pd_column of a group
+static uint8_t pending_group_fuzzy[(RENDER_COL_MAX + 7) / 8];
+static uint32_t pending_x_has_fuzzy[(SCREENWIDTH + 31) / 32];
+static int16_t pending_groups[RENDER_COL_MAX];
+static int16_t pending_groups_sorted[RENDER_COL_MAX];
+// 0 for a scale of 0 (player sprites), otherwise 1 + log2(scale)
+#define SCALE_BUCKETS 25
+
+static void append_pending_group(int x, int16_t head, bool fuzzy) {
+    columns_pending = true;
+    pending_group_next[head] = -1;
+    if (pending_heads[x] < 0) {
+        pending_heads[x] = head;
+    } else {
+        pending_group_next[pending_tails[x]] = head;
+    }
+    pending_tails[x] = head;
+    if (fuzzy) {
+        pending_group_fuzzy[head >> 3] |= 1u << (head & 7);
+        pending_x_has_fuzzy[x >> 5] |= 1u << (x & 31);
+    } else {
+        pending_group_fuzzy[head >> 3] &= ~(1u << (head & 7));
+    }
+}
+
+static inline int scale_bucket(uint32_t scale) {
+    return scale ? 32 - __builtin_clz(scale) : 0;
+}
+
+static void resolve_pending_columns_guts() {
+    resolving_pending = true;
+    for (int x = 0; x < SCREENWIDTH; x++) {
+        if (pending_heads[x] < 0) continue;
+        int n = 0;
+        for (int16_t g = pending_heads[x]; g >= 0; g = pending_group_next[g]) {
+            pending_groups[n++] = g;
+        }
+        pending_heads[x] = -1;
+        if (pending_x_has_fuzzy[x >> 5] & (1u << (x & 31))) {
+            // fuzzy columns are clipped against whatever is there when they are inserted, which affects how they are
+            // split, and so the order fuzzpos is applied to them in. just insert everything in the original order
+            for (int i = 0; i < n; i++) {
+                int16_t g = pending_groups[i];
+                if (pending_group_fuzzy[g >> 3] & (1u << (g & 7))) {
+                    push_down_x_fuzzy(x, g);
+                } else {
+                    push_down_x_guts(x, g);
+                }
+            }
+            continue;
+        }
+        // stable counting sort by bucket...
+        uint16_t bucket_start[SCALE_BUCKETS + 1] = {};
+        for (int i = 0; i < n; i++) {
+            bucket_start[scale_bucket(render_cols[pending_groups[i]].scale) + 1]++;
+        }
+        for (int b = 1; b <= SCALE_BUCKETS; b++) bucket_start[b] += bucket_start[b - 1];
+        for (int i = 0; i < n; i++) {
+            int16_t g = pending_groups[i];
+            pending_groups_sorted[bucket_start[scale_bucket(render_cols[g].scale)]++] = g;
+        }
+        // ... then a stable insertion sort, which only ever moves things within a bucket
+        for (int i = 1; i < n; i++) {
+            int16_t g = pending_groups_sorted[i];
+            uint32_t scale = render_cols[g].scale;
+            int j = i;
+            for (; j > 0 && render_cols[pending_groups_sorted[j - 1]].scale > scale; j--) {
+                pending_groups_sorted[j] = pending_groups_sorted[j - 1];
+            }
+            pending_groups_sorted[j] = g;
+        }
+        for (int i = 0; i < n; i++) {
+            push_down_x_guts(x, pending_groups_sorted[i]);
+        }
+    }
+    memset(pending_x_has_fuzzy, 0, sizeof(pending_x_has_fuzzy));
+    columns_pending = resolving_pending = false;
+}
+
+static void resolve_pending_columns() {
+    TD_SCOPE(TD_INSERT);
+    resolve_pending_columns_guts();
+}
+#endif
+
 static void push_down_x(int x, int new_index) {
 #if DUMP_SORTING
     //    if (x == 196 && render_cols[new_index].yl == 94 && render_cols[new_index].yh == 95) {
@@ -745,7 +1639,11 @@ static void push_down_x(int x, int new_index) {
 #if PICO_ON_DEVICE
     //    gpio_put(22, 1);
 #endif
+#if PD_BUCKET_SORT
+    append_pending_group(x, new_index, false);
+#else
     push_down_x_guts(x, new_index);
+#endif
 #if PICO_ON_DEVICE
     //    gpio_put(22, 0);
 #endif
@@ -758,8 +1656,24 @@ static void push_down_x(int x, int new_index) {
 #endif
 }
 
+#if PD_PIPELINE
+static semaphore_t pipeline_go, pipeline_done;
+static bool pipeline_pending; // a frame has been handed to the pipeline thread, and not yet finished
+static bool pipeline_fb_patches; // the menu/hu patch list is to be drawn onto the frame once the pipeline thread is done
+static void pipeline_thread();
+static void pipeline_wait();
+#endif
+
 void pd_begin_frame() {
     DEBUG_PINS_SET(start_end, 1);
+#if PD_PIPELINE
+    pipeline_wait();
+#endif
+#if PD_TIMEDEMO
+    memset(td_phase_ns, 0, sizeof(td_phase_ns));
+    td_frame_start = td_now_ns();
+    td_frame_start_stats = render_stats;
+#endif
     if (gamestate == GS_LEVEL) {
 //        render_frame_index ^= 1;
     }
@@ -779,12 +1693,37 @@ void pd_begin_frame() {
 #endif
     // new
     memset(column_heads, -1, sizeof(column_heads));
+    memset(fuzzy_x_needs_reclip, 0, sizeof(fuzzy_x_needs_reclip));
+    fuzz_batch_count = 0;
+#if PD_BUCKET_SORT
+    memset(pending_heads, -1, sizeof(pending_heads));
+#endif
+    // the last frame's columns are finished with, as is anything pd_get_work_area handed out since (whose flat regions
+    // were invalidated, so can be used again)
+    arena_release(ARENA_INSERTION);
+    if (arena_live(ARENA_WORK_AREA)) {
+        arena_release(ARENA_WORK_AREA);
+        arena_lease_flat_regions();
+    }
+    arena_lease_range(ARENA_VISPLANES, visplane_bit, sizeof(visplane_bit));
     memset(visplane_bit, 0, sizeof(visplane_bit)); // todo could do this with dma
     for(uint i=0;i<count_of(not_fully_covered_cols);i++) not_fully_covered_cols[i] = 0; // only 3 of these so loop
+#if PD_OCCLUSION
+    memset(occluded_groups, 0, sizeof(occluded_groups));
+    memset(occlusion_closed_cols, 0, sizeof(occlusion_closed_cols));
+    memset(occlusion_max_iscale, 0, sizeof(occlusion_max_iscale));
+#endif
     not_fully_covered_yl = 0;
     not_fully_covered_yh = MAIN_VIEWHEIGHT - 1;
     render_col_count = 0;
     render_col_free = -1;
+    render_col_failed = 0;
+#if PD_POOL_STATS
+    memset(&frame_pools, 0, sizeof(frame_pools));
+#endif
+#if PD_GOVERNOR
+    governor_begin_frame();
+#endif
     pd_frame++;
     DEBUG_PINS_CLR(start_end, 1);
 }
@@ -811,6 +1750,27 @@ static void interp_init() {
 #endif
 }
 
+static void init_patch_decoder_cache() {
+    memset(patch_hash_offsets, -1, sizeof(patch_hash_offsets));
+    patch_decoder_circular_buf_write_pos = 0;
+    patch_decoder_circular_buf_write_limit = PATCH_DECODER_CIRCULAR_BUFFER_SIZE;
+#if PD_PATCH_COLUMN_CACHE_SIZE
+    patch_column_cache.init();
+#endif
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+    composite_column_cache.init();
+#endif
+#if PD_SKY_CACHE
+    sky_cache.patch_num = -1;
+#endif
+}
+
+#if PD_RENDER_THREADS > 1
+static semaphore_t render_worker_go[PD_RENDER_THREADS - 1];
+static semaphore_t render_workers_done;
+static void render_worker(int n);
+#endif
+
 void pd_init() {
     sem_init(&core1_wake, 0, 1);
     sem_init(&core0_done, 0, 1);
@@ -829,19 +1789,90 @@ void pd_init() {
 #if USE_CORE1_FOR_REGULAR
     sem_init(&core1_do_regular, 0, 1);
 #endif
-    memset(patch_hash_offsets, -1, sizeof(patch_hash_offsets));
-    patch_decoder_circular_buf_write_limit = PATCH_DECODER_CIRCULAR_BUFFER_SIZE;
+    init_patch_decoder_cache();
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+    printf("pd_render: composite column cache %d columns (%d bytes per render thread)\n",
+           (int)decltype(composite_column_cache)::SLOTS, (int)sizeof(composite_column_cache));
+#endif
+#if PD_SKY_CACHE
+    printf("pd_render: sky cache %d bytes per render thread\n", (int)sizeof(sky_cache));
+#endif
+#if PD_SIMD
+    select_render_kernels();
+#endif
+    memset(cached_flat_picnum, 0xff, sizeof(cached_flat_picnum));
+    cached_flat0 = flat_cache_region(0);
+    arena_lease_flat_regions();
+#if PD_RENDER_THREADS > 1
+    sem_init(&render_workers_done, 0, PD_RENDER_THREADS - 1);
+    for (int i = 0; i < PD_RENDER_THREADS - 1; i++) {
+        sem_init(&render_worker_go[i], 0, 1);
+        std::thread(render_worker, i).detach();
+    }
+#endif
+#if !PICO_ON_DEVICE
+    // no command line in doom_tiny, so this is the equivalent of chocolate-doom's -fbhash
+    const char *fbhash_filename = getenv("PD_FBHASH");
+    if (fbhash_filename && !FB_HashOpen(fbhash_filename)) {
+        I_Error("Can't write framebuffer hashes to %s", fbhash_filename);
+    }
+#endif
+#if PD_PIPELINE
+    sem_init(&pipeline_go, 0, 1);
+    sem_init(&pipeline_done, 0, 1);
+    std::thread(pipeline_thread).detach();
+#endif
 }
 
 void pd_add_span() {
 }
 
+#if PD_OCCLUSION
+static inline void occlusion_add_column(int x, uint32_t iscale) {
+    uint32_t v = (iscale + (1u << OCCLUSION_ISCALE_SHIFT) - 1) >> OCCLUSION_ISCALE_SHIFT;
+    uint16_t &max = occlusion_max_iscale[x / 4];
+    if (v > max) max = (uint16_t)std::min(v, 0xffffu);
+}
+
+void pd_close_column(int x) {
+    assert(x >= 0 && x < SCREENWIDTH);
+    if ((occlusion_closed_cols[x / 4] |= 1u << (x & 3u)) == 0xf) {
+        occluded_groups[x / (4*32)] |= 1u << ((x/4)&31);
+    }
+}
+
+// a column closed by solid walls is covered top to bottom by the walls and planes drawn so far, so a masked column
+// further away than all of them would be clipped away entirely when inserted; we only look at whole groups though
+int pd_masked_columns_occluded(int x1, int x2, fixed_t scale) {
+    if (x1 < 0) x1 = 0;
+    if (x2 >= SCREENWIDTH) x2 = SCREENWIDTH - 1;
+    if (x1 > x2 || (pd_flag & 2) || scale <= 0) return 0;
+    // first just check the bits a word at a time (a group with failed column allocations may have gaps)
+    for (int g = x1 / 4; g <= x2 / 4;) {
+        int end = std::min(x2 / 4, g | 31);
+        uint32_t mask = (end & 31) == 31 ? ~0u : (2u << (end & 31)) - 1;
+        mask &= ~((1u << (g & 31)) - 1);
+        if ((occluded_groups[g / 32] & ~not_fully_covered_cols[g / 32] & mask) != mask) return 0;
+        g = end + 1;
+    }
+    uint32_t iscale = hw_divider_u32_quotient_inlined(0xffffffff, scale);
+    if (iscale > DDA_MAX) iscale = DDA_MAX;
+    iscale >>= OCCLUSION_ISCALE_SHIFT;
+    for (int g = x1 / 4; g <= x2 / 4; g++) {
+        if (iscale <= occlusion_max_iscale[g]) return 0;
+    }
+    render_stat_add(occluded_masked_columns, x2 - x1 + 1);
+    return 1;
+}
+#endif
+
 #define FORCE_ISCALE 1
 
 void pd_add_column(pd_column_type type) {
+    TD_SCOPE(TD_INSERT);
     // --- VALIDATION AND CLAMPING
     int count = dc_yh - dc_yl;
-    if (count < 0)
+    if (count < 0 || governor_skip_x(dc_x))
         return;
 
     fixed_t iscale;
@@ -901,6 +1932,9 @@ void pd_add_column(pd_column_type type) {
         assert(dc_source.real_id < numtextures);
         textures.insert(dc_source.real_id);
     }
+#endif
+#if PD_OCCLUSION
+    occlusion_add_column(dc_x, render_cols[rc_index].scale);
 #endif
     push_down_x(dc_x, rc_index);
 
@@ -945,7 +1979,21 @@ void pd_add_column(pd_column_type type) {
 #endif
 }
 
+static void add_to_fuzz_batch(int x) {
+    if (fuzz_batch_count) {
+        auto &b = fuzz_batches[fuzz_batch_count - 1];
+        if ((x >= b.x1 && x <= b.x2 + 1) || fuzz_batch_count == MAX_FUZZ_BATCHES) {
+            b.x1 = std::min(b.x1, (int16_t)x);
+            b.x2 = std::max(b.x2, (int16_t)x);
+            return;
+        }
+    }
+    fuzz_batches[fuzz_batch_count++] = {(int16_t)x, (int16_t)x};
+}
+
 void pd_add_masked_columns(uint8_t *ys, int seg_count) {
+    TD_SCOPE(TD_INSERT);
+    if (governor_skip_x(dc_x)) return;
     // --- VALIDATION AND CLAMPING
     fixed_t iscale;
 #if FORCE_ISCALE
@@ -1025,7 +2073,12 @@ void pd_add_masked_columns(uint8_t *ys, int seg_count) {
     }
     render_cols[rc_index].next = -1;
     if (dc_colormap_index < 0) {
+        add_to_fuzz_batch(dc_x);
+#if PD_BUCKET_SORT
+        append_pending_group(dc_x, first_index, true);
+#else
         push_down_x_fuzzy(dc_x, first_index);
+#endif
     } else {
         push_down_x(dc_x, first_index);
     }
@@ -1081,6 +2134,8 @@ static int lightlevel(int visplane) {
 }
 
 void pd_add_plane_column(int x, int yl, int yh, fixed_t scale, int floor, int fd_num) {
+    TD_SCOPE(TD_INSERT);
+    if (governor_skip_x(x)) return;
     int rc_index = alloc_pd_column(x);
     if (rc_index < 0) return;
     int iscale = hw_divider_u32_quotient_inlined(0xffffffff, pd_scale);
@@ -1095,21 +2150,94 @@ void pd_add_plane_column(int x, int yl, int yh, fixed_t scale, int floor, int fd
     render_cols[rc_index].texturemid = TEXTUREMID_PLANE;
     render_cols[rc_index].fd_num = fd_num;
     render_cols[rc_index].next = -1;
+#if PD_OCCLUSION
+    occlusion_add_column(x, render_cols[rc_index].scale);
+#endif
     push_down_x(x, rc_index);
 }
 
+// sort the batches by x, merging any which overlap (e.g. from fuzzy drawables in front of each other)
+static void merge_fuzz_batches() {
+    for (int i = 1; i < fuzz_batch_count; i++) {
+        fuzz_batch b = fuzz_batches[i];
+        int j = i;
+        for (; j > 0 && fuzz_batches[j - 1].x1 > b.x1; j--) {
+            fuzz_batches[j] = fuzz_batches[j - 1];
+        }
+        fuzz_batches[j] = b;
+    }
+    int n = 0;
+    for (int i = 0; i < fuzz_batch_count; i++) {
+        if (n && fuzz_batches[i].x1 <= fuzz_batches[n - 1].x2 + 1) {
+            fuzz_batches[n - 1].x2 = std::max(fuzz_batches[n - 1].x2, fuzz_batches[i].x2);
+        } else {
+            fuzz_batches[n++] = fuzz_batches[i];
+        }
+    }
+    fuzz_batch_count = n;
+}
+
+// now the fuzzy columns are final, we know how far each advances fuzzpos, so where each x starts
+static void count_fuzz_starts() {
+    int pos = 0;
+    for (int b = 0; b < fuzz_batch_count; b++) {
+        for (int x = fuzz_batches[b].x1; x <= fuzz_batches[b].x2; x++) {
+            fuzz_start[x] = (uint8_t)pos;
+            for (int16_t i = fuzzy_column_heads[x]; i >= 0; i = render_cols[i].next) {
+                pos += render_cols[i].yh - render_cols[i].yl + 1;
+            }
+            pos %= FUZZTABLE;
+        }
+    }
+    fuzz_advance = (uint8_t)pos;
+}
+
 static void reclip_fuzz_columns() {
-    // re-add the fuzzy columns so they are correctly clipped
-    for (int x = 0; x < SCREENWIDTH; x++) {
-        int16_t cur = fuzzy_column_heads[x];
-        fuzzy_column_heads[x] = -1;
-        while (cur >= 0) {
-            int16_t next = render_cols[cur].next;
-            render_cols[cur].next = -1;
-            push_down_x_fuzzy(x, cur);
-            cur = next;
+    merge_fuzz_batches();
+    for (int b = 0; b < fuzz_batch_count; b++) {
+        for (int x = fuzz_batches[b].x1; x <= fuzz_batches[b].x2; x++) {
+            int16_t cur = fuzzy_column_heads[x];
+            if (cur < 0) continue;
+            // re-add the fuzzy columns so they are correctly clipped
+            fuzzy_column_heads[x] = -1;
+            if (!(fuzzy_x_needs_reclip[x >> 5] & (1u << (x & 31)))) {
+                // nothing has been inserted in front since, so each piece was already clipped against what is there
+                // now, and pushing it down again would leave it as it is. the only effect would be to reverse the list
+                // (which changes the order fuzzpos is applied in), so just do that
+                while (cur >= 0) {
+                    int16_t next = render_cols[cur].next;
+                    render_cols[cur].next = fuzzy_column_heads[x];
+                    fuzzy_column_heads[x] = cur;
+                    cur = next;
+                }
+            } else {
+                while (cur >= 0) {
+                    int16_t next = render_cols[cur].next;
+                    render_cols[cur].next = -1;
+                    push_down_x_fuzzy(x, cur);
+                    cur = next;
+                }
+            }
+            // fuzz doesn't touch the top or bottom row of the view (as it reads the rows above and below), so clip to
+            // that here rather than when drawing, dropping anything left empty
+            int16_t *last = &fuzzy_column_heads[x];
+            for (int16_t i = *last; i >= 0; i = *last) {
+                auto &c = render_cols[i];
+                assert(c.yl <= MAIN_VIEWHEIGHT);
+                assert(c.yh <= MAIN_VIEWHEIGHT);
+                if (!c.yl) c.yl = 1;
+                if (c.yh > MAIN_VIEWHEIGHT - 2) c.yh = MAIN_VIEWHEIGHT - 2;
+                if (c.yl > c.yh) {
+                    *last = c.next;
+                    free_pd_column(i);
+                } else {
+                    last = &c.next;
+                }
+            }
         }
     }
+    memset(fuzzy_x_needs_reclip, 0, sizeof(fuzzy_x_needs_reclip));
+    count_fuzz_starts();
 }
 
 static int16_t predraw_visplanes() {
@@ -1191,15 +2319,25 @@ static void clip_columns(int yl, int yh) {
     }
 }
 
+// game state which is needed when drawing (and may be changed by the game before we're done when pipelining)
+static flatname_t frame_flattranslation[NUM_SPECIAL_FLATS];
+static lumpindex_t frame_skytexture_patch;
+
+static void snapshot_frame_state() {
+    memcpy(frame_flattranslation, whd_flattranslation, sizeof(frame_flattranslation));
+    frame_skytexture_patch = skytexture_patch;
+}
+
 static int translate_picnum(int picnum) {
     if (whd_flattospecial[picnum] != 0xff) {
-        picnum = whd_specialtoflat[whd_flattranslation[whd_flattospecial[picnum]]];
+        picnum = whd_specialtoflat[frame_flattranslation[whd_flattospecial[picnum]]];
     }
     return picnum;
 }
 
-static uint8_t *decode_flat_to_slot(int cache_slot, int picnum) {
-    uint8_t *flat_data = cached_flat0 - cache_slot * 4096;
+static uint8_t *decode_flat_to_entry(int entry, int picnum) {
+    uint8_t *flat_data = flat_cache_use(entry);
+    uint32_t t0 = time_us_32();
     DEBUG_PINS_SET(flat_decode, 1);
     uint16_t *pos = flat_decoder_buf;
     uint pos_size = count_of(flat_decoder_buf);
@@ -1221,13 +2359,20 @@ static uint8_t *decode_flat_to_slot(int cache_slot, int picnum) {
         pos = read_raw_pixels_decoder(&bi, pos, pos_size, flat_decoder_tmp, count_of(flat_decoder_tmp));
     }
     assert(pos < flat_decoder_buf + count_of(flat_decoder_buf));
+#if PD_FLAT_LUT_BITS
+    const uint16_t *flat_lut = (const uint16_t *)flat_decoder_tmp;
+    th_make_lut(rp_decoder, (uint16_t *)flat_decoder_tmp, PD_FLAT_LUT_BITS);
+#define decode_flat_pixel() th_decode_lut(rp_decoder, flat_lut, PD_FLAT_LUT_BITS, &bi)
+#else
     th_make_prefix_length_table(rp_decoder, flat_decoder_tmp);
+#define decode_flat_pixel() th_decode_table_special(rp_decoder, flat_decoder_tmp, &bi)
+#endif
     wait_for_input(100000);
     bool have_same = th_bit(&bi);
     if (!have_same) {
         uint8_t *p = flat_data;
         for (int y = 0; y < 4096; y++) {
-            *p++ = th_decode_table_special(rp_decoder, flat_decoder_tmp, &bi);
+            *p++ = decode_flat_pixel();
         }
     } else {
         for (int x = 0; x < 64; x++) {
@@ -1242,19 +2387,22 @@ static uint8_t *decode_flat_to_slot(int cache_slot, int picnum) {
                 }
             } else {
                 for (int y = 0; y < 64; y++) {
-                    *p++ = th_decode_table_special(rp_decoder, flat_decoder_tmp, &bi);
+                    *p++ = decode_flat_pixel();
                 }
             }
 
         }
     }
-//                    printf("Pass %d, caching slot %d pic (%d)\n", pass, cache_slot, picnum);
-    cached_flat_picnum[cache_slot] = picnum;
+//                    printf("Pass %d, caching entry %d pic (%d)\n", pass, entry, picnum);
+#undef decode_flat_pixel
+    cached_flat_picnum[entry] = picnum;
     DEBUG_PINS_CLR(flat_decode, 1);
+    render_stat_add(flat_decode_us, time_us_32() - t0);
     return flat_data;
 }
 
 static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
+    TD_SCOPE(TD_FLUSH_VISPLANES);
 //    printf("FRAME %d %d\n", pd_frame, numvisplanes);
     angle_t angle = (viewangle + x_to_viewangle(0)) >> ANGLETOFINESHIFT;
     fixed_t viewcosangle = finecosine(angle);
@@ -1265,7 +2413,6 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
     viewsinangle = FixedMul(distscale0, viewsinangle);
 #endif
     // two passes; first pass we try to reuse flats we have decoded
-    int cache_slot = 0;
     for(int pass=0;pass<2;pass++) {
         for (int i = 0; i < numvisplanes; i++) {
             int picnum = translate_picnum(visplanes[i].picnum);
@@ -1288,24 +2435,20 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
 #if 0
                 source = (const uint8_t *) W_CacheLumpNum(firstflat + picnum, PU_STATIC);
 #else
-                uint8_t *flat_data = nullptr;
+                uint8_t *flat_data;
                 if (!pass) {
-                    for(cache_slot=0;cache_slot<cached_flat_slots;cache_slot++) {
-                        if (cached_flat_picnum[cache_slot] == picnum) {
-//                            printf("Pass %d, using slot %d pic (%d)\n", pass, cache_slot, picnum);
-                            flat_data = cached_flat0 - cache_slot * 4096;
-                        }
-                    }
-                    if (!flat_data) continue;
+                    int entry = flat_cache_find(picnum);
+                    if (entry < 0) continue;
+//                    printf("Pass %d, using entry %d pic (%d)\n", pass, entry, picnum);
+                    flat_data = flat_cache_use(entry);
+                    render_stat_add(flat_cache_hits, 1);
                 } else {
-                    cache_slot++;
+                    // note the flats drawn so far this frame are the most recently used, but they are finished with
+                    // anyway, so may be evicted if need be. also note that animated flats are keyed by their
+                    // translate_picnum, so each frame of the animation gets its own entry
                     assert(cached_flat_slots);
-                    if (cache_slot >= cached_flat_slots) {
-                        cache_slot = 0;
-                    }
-                }
-                if (!flat_data) {
-                    flat_data = decode_flat_to_slot(cache_slot, picnum);
+                    flat_data = decode_flat_to_entry(flat_cache_victim(), picnum);
+                    render_stat_add(flat_cache_misses, 1);
                 }
 #endif
                 DEBUG_PINS_SET(render_flat, 2);
@@ -1406,6 +2549,9 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
                         //            printf("partial\n");
                         uint8_t *p = render_frame_buffer + flat_runs[fr].y * SCREENWIDTH + flat_runs[fr].x_start;
                         uint8_t *p_end = p + flat_runs[fr].x_end - flat_runs[fr].x_start;
+#if PD_SIMD && !USE_INTERP
+                        span_render_kernel(p, p_end - p, flat_data, position, step, colormap);
+#else
                         while (p < p_end) {
 #if USE_INTERP
                             const uint8_t *texel = (const uint8_t *) span_interp->pop[2];
@@ -1422,6 +2568,7 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
                             *p++ = colormap[*texel];
 #pragma GCC diagnostic pop
                         }
+#endif
 //                        last_x_end = flat_runs[fr].x_end;
                     }
                     vp = flatnum_next[vp];
@@ -1433,8 +2580,19 @@ static void flush_visplanes(int8_t *flatnum_next, int numvisplanes) {
     }
 }
 
+// draw_visplanes has finished reading visplane_bit, so core 1 can have it for its patch scratch (core 1 either drew the
+// visplanes itself, or only starts its regular columns once core 0 has). core 0 is still drawing, so must never use it
+static void visplane_bit_done() {
+    arena_release(ARENA_VISPLANES);
+    arena_lease_range(ARENA_PATCHES, visplane_bit, ARENA_PATCH_SCRATCH_SIZE);
+}
+
 static void draw_visplanes(int16_t fr_list) {
-    if (!lastvisplane) return;
+    TD_SCOPE(TD_DRAW_VISPLANES);
+    if (!lastvisplane) {
+        visplane_bit_done();
+        return;
+    }
     int numvisplanes = lastvisplane - visplanes;
 
     memset(visplane_heads, -1, numvisplanes * sizeof(visplane_heads[0]));
@@ -1518,6 +2676,7 @@ static void draw_visplanes(int16_t fr_list) {
                 *vp &= ~((1u << bit) - 1);
             }
             if (fr_pos == -1) {
+                pool_usage_add(flat_run_refills, 1);
                 flush_visplanes(flatnum_next, numvisplanes);
                 memset(visplane_heads, -1, MAXVISPLANES * 2);
                 fr_pos = fr_list;
@@ -1536,6 +2695,7 @@ static void draw_visplanes(int16_t fr_list) {
     if (fr_pos != fr_list) {
         flush_visplanes(flatnum_next, numvisplanes);
     }
+    visplane_bit_done();
 }
 
 static inline void col_render(uint8_t *dest, uint count, const uint8_t *source, fixed_t frac, fixed_t fracstep, const lighttable_t* colormap) {
@@ -1579,6 +2739,8 @@ static inline void col_render(uint8_t *dest, uint count, const uint8_t *source,
     :
     );
     xs->col.frac = col_interp->accum[0];
+#elif PD_SIMD
+    col_render_kernel(dest, count, source, frac, fracstep, colormap);
 #else
     do {
         *dest = colormap[source[(frac >> FRACBITS) & 127]];
@@ -1627,7 +2789,7 @@ static inline int patch_offset_or_inverse_slot(int patch_num) {
 static void get_patch_decoder(int patch_num, patch_decode_info* pdis, int pdi_pos = 0, int pdi_count = 1) {
     auto& pdi = pdis[pdi_pos];
     pdi.patch = (patch_t *) W_CacheLumpNum(patch_num, PU_CACHE);
-    bool simple_path = get_core_num();
+    bool simple_path = on_audio_core();
     int offset_or_inverse_slot = patch_offset_or_inverse_slot(patch_num);
     uint data_index = 3 + patch_has_extra(pdi.patch);
     if (!simple_path && offset_or_inverse_slot >= 0) {
@@ -1641,6 +2803,7 @@ static void get_patch_decoder(int patch_num, patch_decode_info* pdis, int pdi_po
 #endif
     } else {
         DEBUG_PINS_SET(patch_decode, 1);
+        uint32_t t0 = time_us_32();
         int space_needed = patch_decoder_size_needed(pdi.patch) + PATCH_HASH_ENTRY_HEADER_HWORDS;
 #if DEBUG_DECODER_BUFFERS
         printf("Need slot of size %d\n", space_needed);
@@ -1750,52 +2913,276 @@ static void get_patch_decoder(int patch_num, patch_decode_info* pdis, int pdi_po
             }
             assert(pos <= patch_decoder_circular_buf + PATCH_DECODER_CIRCULAR_BUFFER_SIZE - 1);
             header->size = pos + PATCH_HASH_ENTRY_HEADER_HWORDS - pdi.decoder;
-#if !PICO_ON_DEVICE
+#if !PICO_ON_DEVICE && PD_RENDER_THREADS == 1
             patch_decoder_size.record(header->size);
 #endif
             patch_decoder_circular_buf_write_pos += header->size;
             patch_decoder_circular_buf[patch_decoder_circular_buf_write_pos] = 0; // we need a zero patch number to follow
+            pool_usage_max(decoder_hwm, patch_decoder_circular_buf_write_pos + 1u);
+            pool_usage_add(decoder_hwords, header->size);
+        }
+        pdi.header = *header;
+        render_stat_add(patch_decoder_us, time_us_32() - t0);
+        DEBUG_PINS_CLR(patch_decode, 1);
+    }
+    pdi.col_offsets = &((uint16_t*)pdi.patch)[data_index];
+    uint w = patch_width(pdi.patch);
+    assert(w > 0 && w <= 320);
+    pdi.data_index = (data_index + w) * 2 + 2; // + 2 because we have one extra col_data offset
+    pdi.w = (uint16_t) w;
+}
+
+const uint8_t *get_patch_decoder_table(uint patch_num, const uint16_t *decoder) {
+    if (on_audio_core()) {
+        th_make_prefix_length_table(decoder,
+                                    flat_decoder_tmp); // the table is large and quick to generate, so we don't cache
+        return flat_decoder_tmp;
+    } else {
+        for (int i = 0; i < WHD_MAX_COL_UNIQUE_PATCHES; i++) {
+            if (patch_num == patch_decoder_tmp_table_patch_numbers[i]) return patch_decoder_tmp + i * 256;
+        }
+        th_make_prefix_length_table(decoder,
+                                    patch_decoder_tmp); // the table is large and quick to generate, so we don't cache
+        patch_decoder_tmp_table_patch_numbers[0] = patch_num;
+        return patch_decoder_tmp;
+    }
+}
+
+const uint8_t *get_patch_decoder_table(uint patch_num, const uint16_t *decoder, int pos) {
+    if (patch_num == patch_decoder_tmp_table_patch_numbers[pos]) return patch_decoder_tmp + pos * 256;
+#if DEBUG_DECODER
+    printf("Get decoder %d table pos %d\n", patch_num, pos);
+#endif
+    th_make_prefix_length_table(decoder, patch_decoder_tmp + pos * 256); // the table is large and quick to generate, so we don't cache
+    patch_decoder_tmp_table_patch_numbers[pos] = patch_num;
+    return patch_decoder_tmp + pos * 256;
+}
+
+// level load precache (see R_PrecacheLevel): decode the flats and build the patch decoders which the level's sectors and
+// sidedefs use, before its first frame rather than during it. it fills at most PD_PRECACHE_BUDGET bytes of the flat cache
+// and patch decoder buffer (on the host the environment variable of the same name overrides this; 0 disables it)
+#ifndef PD_PRECACHE_BUDGET
+#if PICO_ON_DEVICE
+#define PD_PRECACHE_BUDGET (16 * 1024)
+#else
+#define PD_PRECACHE_BUDGET (64 * 1024)
+#endif
+#endif
+static struct {
+    bool active;
+    bool report_pending;      // report the decode time of the first level frame drawn after the precache
+    uint32_t budget;
+    uint32_t used;            // bytes
+    uint32_t flat_clock;      // flat_cache_clock at pd_precache_begin
+    uint32_t decoder_hwords;
+    uint16_t flats, decoders;
+    uint32_t start_us, us;
+    render_stat_counters end_stats; // render_stats at pd_precache_end
+} level_precache;
+
+void pd_precache_begin(void) {
+#if PD_PIPELINE
+    pipeline_wait();
+#endif
+    level_precache.budget = PD_PRECACHE_BUDGET;
+#if !PICO_ON_DEVICE
+    const char *env = getenv("PD_PRECACHE_BUDGET");
+    if (env) level_precache.budget = atoi(env);
+#endif
+    level_precache.active = level_precache.budget != 0;
+    level_precache.used = level_precache.decoder_hwords = 0;
+    level_precache.flats = level_precache.decoders = 0;
+    level_precache.flat_clock = flat_cache_clock;
+    level_precache.start_us = time_us_32();
+}
+
+// like flat_cache_victim, but never evicts a flat precached earlier in this pass (the callers go roughly from most to
+// least important), and leaves the top list_buffer region alone as the wipe into the level takes it. none of the
+// list_buffer regions may be used if they are leased as the work area holding a game being loaded
+static int precache_flat_victim() {
+    int victim = -1;
+    for_each_usable_flat_cache_entry(e) {
+        if (e == PD_FLAT_CACHE_RESERVED_SLOTS || (!arena_live(ARENA_FLATS) && e > PD_FLAT_CACHE_RESERVED_SLOTS)) continue;
+        if (cached_flat_picnum[e] == 0xff) return e;
+        if (victim < 0 || cached_flat_last_use[e] < cached_flat_last_use[victim]) victim = e;
+    }
+    if (victim >= 0 && cached_flat_last_use[victim] > level_precache.flat_clock) return -1;
+    return victim;
+}
+
+void pd_precache_flat(int picnum) {
+    if (!level_precache.active || level_precache.used + 4096 > level_precache.budget) return;
+    // as translate_picnum, but with the current animation frame as nothing has been snapshotted yet
+    if (whd_flattospecial[picnum] != 0xff) {
+        picnum = whd_specialtoflat[whd_flattranslation[whd_flattospecial[picnum]]];
+    }
+    if (flat_cache_find(picnum) >= 0) return;
+    int entry = precache_flat_victim();
+    if (entry < 0) return;
+    decode_flat_to_entry(entry, picnum);
+    level_precache.used += 4096;
+    level_precache.flats++;
+}
+
+#if PD_RENDER_THREADS <= 1
+static void precache_patch_decoder(int patch_num) {
+    if (patch_offset_or_inverse_slot(patch_num) >= 0) return;
+    patch_t *patch = (patch_t *)W_CacheLumpNum(patch_num, PU_CACHE);
+    uint hwords = patch_decoder_size_needed(patch) + PATCH_HASH_ENTRY_HEADER_HWORDS;
+    // the buffer is small, so past half of it we'd only be evicting decoders we precached earlier
+    if (level_precache.decoder_hwords + hwords > PATCH_DECODER_CIRCULAR_BUFFER_SIZE / 2 ||
+        level_precache.used + hwords * 2 > level_precache.budget) {
+        return;
+    }
+    patch_decode_info pdi;
+    pdi.header.patch_num = 0;
+    get_patch_decoder(patch_num, &pdi);
+    level_precache.decoder_hwords += pdi.header.size;
+    level_precache.used += pdi.header.size * 2;
+    level_precache.decoders++;
+}
+#endif
+
+void pd_precache_texture(int texnum) {
+#if PD_RENDER_THREADS <= 1
+    // each render thread has its own decoder buffer, and we don't know which one will draw what
+    if (!level_precache.active || !texnum) return;
+    int pc = whd_textures[texnum].patch_count;
+    if (!pc) {
+        precache_patch_decoder(whd_textures[texnum].patch0);
+    } else {
+        uint8_t *patch_table = &((uint8_t *)whd_textures)[whd_textures[texnum].metdata_offset];
+        for (int i = 0; i < pc; i++) {
+            precache_patch_decoder(patch_table[i * 2] | (patch_table[i * 2 + 1] << 8));
+        }
+    }
+#endif
+}
+
+void pd_precache_end(void) {
+    if (!level_precache.active) return;
+    level_precache.active = false;
+    level_precache.us = time_us_32() - level_precache.start_us;
+    level_precache.end_stats = render_stats;
+    level_precache.report_pending = true;
+    printf("pd_render: precached %d flats, %d patch decoders (%d/%d bytes) in %d us\n", level_precache.flats,
+           level_precache.decoders, (int)level_precache.used, (int)level_precache.budget, (int)level_precache.us);
+}
+
+#if PRINT_TOUCHED_LUMPS
+// record the patch columns drawn in the access trace, so whd_gen -order can lay out the columns within each patch too
+#define touch_patch_column(patch_num, col) W_TouchLumpColumn(patch_num, col)
+#else
+#define touch_patch_column(patch_num, col) ((void)0)
+#endif
+
+// decode pixels 0 to last of a patch column
+static void decode_patch_column(const patch_decode_info &pdi, const uint8_t *patch_decoder_table, uint16_t col_offset,
+                                uint8_t *pixels, int last) {
+    th_bit_input bi;
+    if (patch_byte_addressed(pdi.patch)) {
+        th_bit_input_init(&bi, pdi.patch + pdi.data_index + col_offset); // todo read off end potential
+    } else {
+        th_bit_input_init_bit_offset(&bi, pdi.patch + pdi.data_index, col_offset); // todo read off end potential
+    }
+    if (!pdi.header.encoding) {
+        for (int j = 0; j <= last; j++) {
+            pixels[j] = th_decode_table_special(pdi.decoder, patch_decoder_table, &bi);
+        }
+    } else {
+        for (int j = 0; j <= last; j++) {
+//            uint16_t p = th_decode_16(rp_decoder, &bi);
+            uint16_t p = th_decode_table_special_16(pdi.decoder, patch_decoder_table, &bi);
+            if (p < 256) {
+                pixels[j] = p;
+            } else {
+                int prev = j - 1;
+                assert(prev>=0);
+                assert(1 == p >> 8);
+                p &= 0xff;
+                assert(p<7);
+                pixels[j] = pixels[prev] + p - 3;
+            }
+        }
+    }
+}
+
+#if PD_SKY_CACHE
+// sky columns are unscaled and already lit, so this is col_render with fracstep 0x10000 and no colormap
+static inline void sky_col_render(uint8_t *dest, uint count, const uint8_t *source, uint y) {
+    do {
+        *dest = source[y & 127];
+        dest += SCREENWIDTH;
+        y++;
+    } while (count--);
+}
+
+// decode the whole sky patch into sky_cache; returns false if it doesn't fit
+static bool fill_sky_cache(int patch_num, int colormap_index) {
+    patch_decode_info pdi;
+    get_patch_decoder(patch_num, &pdi);
+    int h = patch_height(pdi.patch);
+    if (pdi.w > SKY_CACHE_MAX_WIDTH || h > SKY_CACHE_HEIGHT) return false;
+    render_stat_add(sky_cache_fills, 1);
+    const uint8_t *patch_decoder_table = get_patch_decoder_table(patch_num, pdi.decoder);
+    const lighttable_t *colormap = colormaps + 256 * colormap_index;
+    for (int col = 0; col < pdi.w; col++) {
+        uint16_t col_offset = pdi.col_offsets[col];
+        if (0xff == (col_offset >> 8)) {
+            assert((col_offset&0xff)<pdi.w);
+            col_offset = pdi.col_offsets[col_offset & 0xff];
+        }
+        uint8_t pixels[SKY_CACHE_HEIGHT] = {};
+        decode_patch_column(pdi, patch_decoder_table, col_offset, pixels, h - 1);
+        if (h < 127) {
+            pixels[127] = pixels[0];
+            pixels[h] = pixels[h-1];
+        }
+        for (int j = 0; j < SKY_CACHE_HEIGHT; j++) {
+            sky_cache.pixels[col][j] = colormap[pixels[j]];
         }
-        pdi.header = *header;
-        DEBUG_PINS_CLR(patch_decode, 1);
     }
-    pdi.col_offsets = &((uint16_t*)pdi.patch)[data_index];
-    uint w = patch_width(pdi.patch);
-    assert(w > 0 && w <= 320);
-    pdi.data_index = (data_index + w) * 2 + 2; // + 2 because we have one extra col_data offset
-    pdi.w = (uint16_t) w;
+    sky_cache.patch_num = patch_num;
+    sky_cache.colormap_index = colormap_index;
+    sky_cache.w = pdi.w;
+    return true;
 }
 
-const uint8_t *get_patch_decoder_table(uint patch_num, const uint16_t *decoder) {
-    if (get_core_num()) {
-        th_make_prefix_length_table(decoder,
-                                    flat_decoder_tmp); // the table is large and quick to generate, so we don't cache
-        return flat_decoder_tmp;
-    } else {
-        for (int i = 0; i < WHD_MAX_COL_UNIQUE_PATCHES; i++) {
-            if (patch_num == patch_decoder_tmp_table_patch_numbers[i]) return patch_decoder_tmp + i * 256;
+// draw the sky patch's columns from sky_cache (filling it first if the sky or its colormap changed); returns false if
+// the sky can't be cached, in which case it should be drawn as a regular patch
+static bool draw_sky_columns(int patch_num, int patch_head) {
+    int colormap_index = patch_num == 1203 ? 0 : fixedcolormap;
+    if (sky_cache.patch_num != patch_num || sky_cache.colormap_index != colormap_index) {
+        if (!fill_sky_cache(patch_num, colormap_index)) {
+            sky_cache.patch_num = -1;
+            return false;
         }
-        th_make_prefix_length_table(decoder,
-                                    patch_decoder_tmp); // the table is large and quick to generate, so we don't cache
-        patch_decoder_tmp_table_patch_numbers[0] = patch_num;
-        return patch_decoder_tmp;
     }
+    for (int i = patch_head; i != -1;) {
+        const auto &c = render_cols[i & 0x7fffu];
+        uint col = FROM_COL_HI_LO(c.col_hi, c.col_lo);
+        assert(col < sky_cache.w);
+        uint8_t *p = render_frame_buffer + __mul_instruction(c.yl, SCREENWIDTH) + c.x + ((i & 0x8000u) >> 7u);
+        assert (c.texturemid != TEXTUREMID_PLANE);
+        fixed_t frac = UP_SHIFT(c.texturemid) + (c.yl - centery) * 0x10000;
+        sky_col_render(p, c.yh - c.yl, sky_cache.pixels[col], (uint)(frac >> FRACBITS));
+        i = c.next;
+    }
+    return true;
 }
-
-const uint8_t *get_patch_decoder_table(uint patch_num, const uint16_t *decoder, int pos) {
-    if (patch_num == patch_decoder_tmp_table_patch_numbers[pos]) return patch_decoder_tmp + pos * 256;
-#if DEBUG_DECODER
-    printf("Get decoder %d table pos %d\n", patch_num, pos);
 #endif
-    th_make_prefix_length_table(decoder, patch_decoder_tmp + pos * 256); // the table is large and quick to generate, so we don't cache
-    patch_decoder_tmp_table_patch_numbers[pos] = patch_num;
-    return patch_decoder_tmp + pos * 256;
-}
 
 static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads, uint8_t *col_height, int translated) {
+    TD_SCOPE(TD_PATCH);
+#if PD_SKY_CACHE
+    if (patch_num == frame_skytexture_patch && !translated && !on_audio_core() &&
+        draw_sky_columns(patch_num, patch_head)) {
+        return;
+    }
+#endif
     // fix up the sky scale (we had to preserve the original scale for column clipping/sorting)
     //  note: we do this as a rare edge case here, rather than checking in loops
-    if (patch_num == skytexture_patch) {
+    if (patch_num == frame_skytexture_patch) {
         for(int j=patch_head; j != -1;) {
             auto &c = render_cols[j & 0x7fffu];
             c.scale = 0x10000;
@@ -1841,46 +3228,41 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
     } while (i != -1);
 
     const uint16_t *col_offsets = pdi.col_offsets;
+#if PD_PATCH_COLUMN_CACHE_SIZE
+    // only needed if we miss in the column cache
+    const uint8_t *patch_decoder_table = nullptr;
+#else
     const uint8_t *patch_decoder_table = get_patch_decoder_table(patch_num, pdi.decoder);
+#endif
     for(int col = 0; col < pdi.w; col++) {
         i = col_heads[col];
-        if (!(col & 63) && get_core_num()) {
+        if (!(col & 63) && on_audio_core()) {
             restart_song_state |= 1; // we may not restart a song during this call because it may blow the stack
             SafeUpdateSound();
             restart_song_state &= ~1;
         }
         if (i != -1) {
+            touch_patch_column(patch_num, col);
             uint16_t col_offset = col_offsets[col];
             if (0xff == (col_offset >> 8)) {
                 assert((col_offset&0xff)<pdi.w);
                 col_offset = col_offsets[col_offset & 0xff];
             }
-            uint8_t pixels[257];
-            th_bit_input bi;
-            if (patch_byte_addressed(pdi.patch)) {
-                th_bit_input_init(&bi, pdi.patch + pdi.data_index + col_offset); // todo read off end potential
-            } else {
-                th_bit_input_init_bit_offset(&bi, pdi.patch + pdi.data_index, col_offset); // todo read off end potential
-            }
-            if (!pdi.header.encoding) {
-                for (int j = 0; j <= col_height[col]; j++) {
-                    pixels[j] = th_decode_table_special(pdi.decoder, patch_decoder_table, &bi);
-                }
+            uint8_t __aligned(4) pixels[257]; // aligned so col_render_avx2 can gather from it
+#if PD_PATCH_COLUMN_CACHE_SIZE
+            bool use_column_cache = !on_audio_core();
+            if (use_column_cache && patch_column_cache.lookup(patch_num, col, pixels, col_height[col] + 1)) {
+                render_stat_add(patch_column_cache_hits, 1);
             } else {
-                for (int j = 0; j <= col_height[col]; j++) {
-//                    uint16_t p = th_decode_16(rp_decoder, &bi);
-                    uint16_t p = th_decode_table_special_16(pdi.decoder, patch_decoder_table, &bi);
-                    if (p < 256) {
-                        pixels[j] = p;
-                    } else {
-                        int prev = j - 1;
-                        assert(prev>=0);
-                        assert(1 == p >> 8);
-                        p &= 0xff;
-                        assert(p<7);
-                        pixels[j] = pixels[prev] + p - 3;
-                    }
-                }
+                if (use_column_cache) render_stat_add(patch_column_cache_misses, 1);
+                if (!patch_decoder_table) patch_decoder_table = get_patch_decoder_table(patch_num, pdi.decoder);
+#else
+            {
+#endif
+                decode_patch_column(pdi, patch_decoder_table, col_offset, pixels, col_height[col]);
+#if PD_PATCH_COLUMN_CACHE_SIZE
+                if (use_column_cache) patch_column_cache.store(patch_num, col, pixels, col_height[col] + 1);
+#endif
             }
 #if USE_PICO_NET
             // bit of a waste of time mostly. would be cheaper to change the decoder tables, but then again
@@ -1899,7 +3281,7 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
                 pixels[h] = pixels[h-1];
             }
 
-            if (fixedcolormap || patch_num == skytexture_patch) {
+            if (fixedcolormap || patch_num == frame_skytexture_patch) {
 #if NO_USE_DC_COLORMAP
                 should_be_const lighttable_t *dc_colormap = colormaps + 256 * (patch_num == 1203 ? 0 : fixedcolormap);
 #endif
@@ -1946,6 +3328,7 @@ static void draw_patch_columns(int patch_num, int patch_head, int16_t *col_heads
 }
 
 static void draw_composite_columns(int texture_num, int tex_head) {
+    TD_SCOPE(TD_COMPOSITE);
     uint w = texture_width(texture_num);
     int16_t col_heads[w];
     memset(col_heads, -1, sizeof(col_heads));
@@ -1980,6 +3363,12 @@ static void draw_composite_columns(int texture_num, int tex_head) {
             max = std::max(max, end);
         }
     } while (i != -1);
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+    bool use_column_cache = !on_audio_core();
+    // cached columns are composited from the top, so they can be reused whatever part of them is visible
+    if (use_column_cache) min = 0;
+    int cached_count = std::min(max, COLUMN_CACHE_MAX_PIXELS - 1) + 1;
+#endif
 
 #if DEBUG_COMPOSITE
     printf("Texture %d h=%d, %d->%d\n", texture_num, texture_height(texture_num)>>FRACBITS, min, max);
@@ -2025,6 +3414,17 @@ static void draw_composite_columns(int texture_num, int tex_head) {
             printf("Texture %d base cols %d->%d skip %d\n", texture_num, base, limit, col == limit);
     #endif
             if (col != limit) {
+                // we only need the patches' decoders if some column isn't in the cache
+                bool need_decode = true;
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+                if (use_column_cache) {
+                    uint c;
+                    for (c = col; c < limit; c++) {
+                        if (col_heads[c] != -1 && !composite_column_cache.contains(texture_num, c, cached_count)) break;
+                    }
+                    need_decode = c != limit;
+                }
+#endif
                 struct {
                     uint8_t y;
                     uint8_t count;
@@ -2060,7 +3460,7 @@ static void draw_composite_columns(int texture_num, int tex_head) {
                         metadata += 3;
                     } else {
                         // note y < max, because we only copy from above, and indeed having y > max in non local_patch & 0x80 causes us to not know how many pixels to draw
-                        if (y <= max && (y + length > min || (local_patch & 0x20))) { // 0x20 means used for memcpy
+                        if (need_decode && y <= max && (y + length > min || (local_patch & 0x20))) { // 0x20 means used for memcpy
                             // todo bitfields here
                             // 0qzy xxxx include y start    : <length> <xoff> (if y <y>) (if z <yoff>)
                             //    q means needed for memcpy
@@ -2130,7 +3530,16 @@ static void draw_composite_columns(int texture_num, int tex_head) {
                     i = col_heads[col];
                     if (i != -1) {
     #if 1
-                        uint8_t pixels[129];
+                        uint8_t __aligned(4) pixels[129];
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+                        if (use_column_cache && composite_column_cache.lookup(texture_num, col, pixels, cached_count)) {
+                            render_stat_add(composite_column_cache_hits, 1);
+                        } else {
+                            if (use_column_cache) render_stat_add(composite_column_cache_misses, 1);
+                            assert(need_decode);
+#else
+                        {
+#endif
                         for(int r=0;r<run_count;r++) {
                             const auto &run = runs[r];
                             assert(run.y + run.count <= 128);
@@ -2152,6 +3561,7 @@ static void draw_composite_columns(int texture_num, int tex_head) {
                                 const uint8_t *patch_decoder_table = decoder_tables[run.pdi_index];
                                 uint8_t pcol = col + run.col;
                                 assert(pcol < patch_width(pdi.patch));
+                                touch_patch_column(pdi.header.patch_num, pcol);
                                 uint16_t col_offset = col_offsets[pcol];
                                 if (0xff == (col_offset >> 8)) {
                                     assert((col_offset & 0xff) < w);
@@ -2204,6 +3614,10 @@ static void draw_composite_columns(int texture_num, int tex_head) {
                                 }
                             }
                         }
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+                        if (use_column_cache) composite_column_cache.store(texture_num, col, pixels, cached_count);
+#endif
+                        }
                         uint hh = texture_height(texture_num) >> FRACBITS;
                         if (hh != 128) {
                             pixels[127] = pixels[0];
@@ -2293,6 +3707,17 @@ static void draw_composite_columns(int texture_num, int tex_head) {
     }
 }
 
+static int fd_translation(int fd_num) {
+    if (fd_num == translated_fds[0]) {
+        return 1;
+    } else if (fd_num == translated_fds[1]) {
+        return 2;
+    } else if (fd_num == translated_fds[2]) {
+        return 3;
+    }
+    return 0;
+}
+
 // noinline as it uses alloca
 static void __noinline draw_regular_columns(int core) {
     if (!core) {
@@ -2309,11 +3734,10 @@ static void __noinline draw_regular_columns(int core) {
     spin_lock_t *lock = spin_lock_instance(RENDER_SPIN_LOCK);
     uint8_t *buffer;
     if (core) {
-        static_assert(sizeof(visplane_bit) >= WHD_PATCH_MAX_WIDTH, "");
         // visplane_bit is no longer used on core 1 as we've already drawn
-        buffer = visplane_bit;
+        buffer = arena_ptr<uint8_t>(ARENA_PATCHES, ARENA_PATCH_SCRATCH_SIZE);
     } else {
-        // on core 0 we can use the stack
+        // on core 0 we can use the stack (core 1 may still be reading visplane_bit in draw_visplanes)
         buffer = (uint8_t *)__builtin_alloca(WHD_PATCH_MAX_WIDTH * 3);
     }
     for(int fd_num=0; fd_num < num_framedrawables; fd_num++) {
@@ -2327,51 +3751,140 @@ static void __noinline draw_regular_columns(int core) {
             spin_unlock(lock, save);
             if (id < 0) {
                 DEBUG_PINS_SET(render_thing, 1<<core);
-                int translated = 0;
-                if (fd_num == translated_fds[0]) {
-                    translated = 1;
-                } else if (fd_num == translated_fds[1]) {
-                    translated = 2;
-                } else if (fd_num == translated_fds[2]) {
-                    translated = 3;
-                }
-                draw_patch_columns(-id, i, (int16_t*)buffer, buffer + WHD_PATCH_MAX_WIDTH * 2, translated);
+                draw_patch_columns(-id, i, (int16_t*)buffer, buffer + WHD_PATCH_MAX_WIDTH * 2, fd_translation(fd_num));
                 DEBUG_PINS_CLR(render_thing, 1<<core);
             }
         }
     }
 }
 
+#if PD_RENDER_THREADS > 1
+static int16_t stripe_fd_heads[PD_RENDER_STRIPES][MAX_FRAME_DRAWABLES];
+static std::atomic<int> render_next_task;
+static int16_t render_fr_list;
+
+// like re_sort_regular_columns_by_fd_num, but the screen is split into vertical stripes of roughly equal cost, each
+// with its own frame drawable lists, so every column is linked into exactly one stripe and stripes can be drawn in
+// parallel without touching each other's columns
+static void re_sort_regular_columns_into_stripes() {
+    uint32_t x_cost[SCREENWIDTH];
+    uint32_t total = 0;
+    for (int x = 0; x < SCREENWIDTH; x++) {
+        uint32_t cost = 0;
+        for (int16_t i = column_heads[x]; i >= 0; i = render_cols[i].next) {
+            // fixed overhead guess for setting up each column, plus the pixels
+            cost += 16 + render_cols[i].yh - render_cols[i].yl + 1;
+        }
+        x_cost[x] = cost;
+        total += cost;
+    }
+    memset(stripe_fd_heads, -1, sizeof(stripe_fd_heads));
+    int stripe = 0;
+    uint32_t cost_so_far = 0;
+    for (int x = 0; x < SCREENWIDTH; x++) {
+        int16_t *heads = stripe_fd_heads[stripe];
+        int16_t i = column_heads[x];
+        while (i >= 0) {
+            auto &c = render_cols[i];
+            assert(c.texturemid != TEXTUREMID_PLANE);
+            int16_t fd_next = heads[c.fd_num];
+            // see re_sort_regular_columns_by_fd_num for the link encoding
+            heads[c.fd_num] = (x >> 8) ? (i | 0x8000) : i;
+            i = c.next;
+            c.x = x;
+            c.next = fd_next;
+        }
+        cost_so_far += x_cost[x];
+        while (stripe < PD_RENDER_STRIPES - 1 && (uint64_t)cost_so_far * PD_RENDER_STRIPES >= (uint64_t)total * (stripe + 1)) {
+            stripe++;
+        }
+    }
+}
+
+static void draw_stripe_columns(int stripe) {
+    const int16_t *heads = stripe_fd_heads[stripe];
+    for(int fd_num=0; fd_num < num_framedrawables; fd_num++) {
+        if (heads[fd_num] != -1 && framedrawables[fd_num].real_id > 0) {
+            draw_composite_columns(framedrawables[fd_num].real_id, heads[fd_num]);
+        }
+    }
+    uint8_t buffer[WHD_PATCH_MAX_WIDTH * 3];
+    for(int fd_num=0; fd_num < num_framedrawables; fd_num++) {
+        int id = framedrawables[fd_num].real_id;
+        if (heads[fd_num] != -1 && id < 0) {
+            draw_patch_columns(-id, heads[fd_num], (int16_t*)buffer, buffer + WHD_PATCH_MAX_WIDTH * 2, fd_translation(fd_num));
+        }
+    }
+}
+
+// task 0 is the visplanes (which touch none of the regular columns' pixels), then one task per stripe
+static void run_render_tasks() {
+    int task;
+    while ((task = render_next_task++) <= PD_RENDER_STRIPES) {
+        if (!task) {
+            draw_visplanes(render_fr_list);
+        } else {
+            draw_stripe_columns(task - 1);
+        }
+    }
+}
+
+static void render_worker(int n) {
+    render_worker_thread = true;
+    init_patch_decoder_cache();
+    while (true) {
+        sem_acquire_blocking(&render_worker_go[n]);
+        run_render_tasks();
+        sem_release(&render_workers_done);
+    }
+}
+
+static void draw_in_render_threads(int16_t fr_list) {
+    re_sort_regular_columns_into_stripes();
+    render_fr_list = fr_list;
+    render_next_task = 0;
+    for (int i = 0; i < PD_RENDER_THREADS - 1; i++) {
+        sem_release(&render_worker_go[i]);
+    }
+    run_render_tasks();
+    for (int i = 0; i < PD_RENDER_THREADS - 1; i++) {
+        sem_acquire_blocking(&render_workers_done);
+    }
+}
+#endif
+
 int8_t fuzzpos;
 
 static void draw_fuzz_columns() {
-    for (int x = 0; x < SCREENWIDTH; x++) {
-        const lighttable_t *darken_map = xcolormaps + 256 * 6;
-        int16_t i = fuzzy_column_heads[x];
-        while (i >= 0) {
-            const auto &c = render_cols[i];
-            uint8_t *screen_col = render_frame_buffer + x;
-            int yl = c.yl;
-            int yh = c.yh;
-            assert(yl <= MAIN_VIEWHEIGHT);
-            assert(yh <= MAIN_VIEWHEIGHT);
-            if (yl == 0) yl = 1;
-            if (yh >= MAIN_VIEWHEIGHT - 1) yh = MAIN_VIEWHEIGHT - 2;
-
-            if (yl <= yh) {
-                uint8_t *p = screen_col + yl * SCREENWIDTH;
-                for (int y = 0; y <= yh - yl; y++) {
-                    *p = darken_map[p[fuzzoffset[fuzzpos]]];
-
-                    // Clamp table lookup index.
-                    if (++fuzzpos == FUZZTABLE)
-                        fuzzpos = 0;
-                    p += SCREENWIDTH;
+    TD_SCOPE(TD_FUZZ);
+    const lighttable_t *darken_map = xcolormaps + 256 * 6;
+    // the columns were clipped, and where each x starts in fuzzoffset worked out, by reclip_fuzz_columns; the output
+    // is the same as drawing every piece in x order continuing fuzzpos from one to the next
+    for (int b = 0; b < fuzz_batch_count; b++) {
+        for (int x = fuzz_batches[b].x1; x <= fuzz_batches[b].x2; x++) {
+            int pos = fuzzpos + fuzz_start[x];
+            if (pos >= FUZZTABLE) pos -= FUZZTABLE;
+            for (int16_t i = fuzzy_column_heads[x]; i >= 0; i = render_cols[i].next) {
+                const auto &c = render_cols[i];
+                uint8_t *p = render_frame_buffer + c.yl * SCREENWIDTH + x;
+                // draw in runs up to the end of fuzzoffset, rather than checking for wrapping every pixel. the pixel
+                // above has already been darkened, so this must stay top to bottom
+                for (int count = c.yh - c.yl + 1; count > 0;) {
+                    int n = std::min(count, FUZZTABLE - pos);
+                    const int16_t *offsets = fuzzoffset + pos;
+                    for (int y = 0; y < n; y++) {
+                        *p = darken_map[p[offsets[y]]];
+                        p += SCREENWIDTH;
+                    }
+                    count -= n;
+                    pos += n;
+                    if (pos == FUZZTABLE) pos = 0;
                 }
             }
-            i = c.next;
         }
     }
+    int pos = fuzzpos + fuzz_advance;
+    fuzzpos = (int8_t)(pos >= FUZZTABLE ? pos - FUZZTABLE : pos);
 }
 
 static void draw_splash(int patch_num, int top, int bottom, uint8_t *dest, int single_col = -1) {
@@ -2502,18 +4015,13 @@ void draw_fullscreen_background(int top, int bottom) {
             if (finalestage == F_STAGE_TEXT) {
                 int picnum = W_GetNumForName(finaleflat);
                 if (picnum) {
-                    int cache_slot;
-                    uint8_t *flat_data = 0;
-                    for (cache_slot = 0; cache_slot < cached_flat_slots; cache_slot++) {
-                        if (cached_flat_picnum[cache_slot] == picnum) {
-                            flat_data = cached_flat0 - cache_slot * 4096;
-                        }
-                    }
-                    if (!flat_data) {
-                        // just use slot 0
+                    uint8_t *flat_data;
+                    int entry = flat_cache_find(picnum - firstflat);
+                    if (entry >= 0) {
+                        flat_data = flat_cache_use(entry);
+                    } else {
                         assert(cached_flat_slots);
-                        cache_slot = 0;
-                        flat_data = decode_flat_to_slot(cache_slot, picnum - firstflat); // note this uses core1's data area, but it is not drawing flats at the moment
+                        flat_data = decode_flat_to_entry(flat_cache_victim(), picnum - firstflat); // note this uses core1's data area, but it is not drawing flats at the moment
                     }
                     // todo is this rotated 90 degress
                     for (int y = top; y < bottom; y++) {
@@ -2562,6 +4070,7 @@ void draw_fullscreen_background(int top, int bottom) {
 
 static void uh_oh_discard_columns(int render_col_limit) {
 //    memset(render_frame_buffer, 0xfc, SCREENWIDTH * MAIN_VIEWHEIGHT); // not quite right in clip
+    bool discarded_fuzz = false;
     for (int x = 0; x < SCREENWIDTH * 2; x++) { // >= SCREENWIDTH these are fuzzy columns
         int16_t *last = &column_heads[x];
         int16_t i = *last;
@@ -2574,6 +4083,8 @@ static void uh_oh_discard_columns(int render_col_limit) {
                     for(int y = c.yh -c.yl; y >= 0; y--, dest += SCREENWIDTH) {
                         *dest = 0;
                     }
+                } else {
+                    discarded_fuzz = true;
                 }
                 *last = c.next;
                 i = *last;
@@ -2583,14 +4094,303 @@ static void uh_oh_discard_columns(int render_col_limit) {
             }
         }
     }
+    if (discarded_fuzz) count_fuzz_starts();
+}
+// draw everything that was added since pd_begin_frame; when pipelining this is called on the pipeline thread, so must
+// not touch any game state not copied by snapshot_frame_state
+static void draw_frame(bool showing_help, bool cast_sprite) {
+    // render the visplane identifiers, freeing up the visplane columns (which we will use below)
+    int16_t fr_list = predraw_visplanes();
+
+    // ... now we can be parallel
+#if PD_RENDER_THREADS > 1
+    draw_in_render_threads(fr_list);
+#else
+#if !USE_CORE1_FOR_FLATS
+    draw_visplanes(fr_list);
+#else
+    core1_fr_list = fr_list;
+    sem_release(&core1_do_flats);
+#endif
+    re_sort_regular_columns_by_fd_num();
+#if USE_CORE1_FOR_REGULAR
+    sem_release(&core1_do_regular);
+#endif
+    draw_regular_columns(0);
+#endif
+#if !DEMO1_ONLY
+    if (cast_sprite) {
+        // note we do this before core0_done so core1 is still playing music
+        int sprite_lump = F_CastSprite();
+        draw_cast_sprite(sprite_lump);
+    }
+#endif
+    sem_release(&core0_done);
+    sem_acquire_blocking(&core1_done);
+    arena_release(ARENA_PATCHES);
+    draw_fuzz_columns();
+#if PD_GOVERNOR
+    if (governor.degraded && !showing_help) double_up_columns();
+    governor_pause();
+#endif
+    DEBUG_PINS_CLR(full_render, 1);
+}
+
+#if PD_POOL_STATS
+enum pool_overflow_type {
+    POOL_OVERFLOW_COLS,
+    POOL_OVERFLOW_FLAT_RUNS,
+    POOL_OVERFLOW_DECODERS,
+    POOL_OVERFLOW_TYPE_COUNT
+};
+static const char *const pool_overflow_names[POOL_OVERFLOW_TYPE_COUNT] = {
+        "pd_columns", "flat runs", "patch decoder buffer"
+};
+struct pool_overflow_event {
+    uint8_t type;
+    int8_t episode, map;
+    int tic;
+    uint32_t amount; // pd_column allocations failed, flat run refills, or patch decoder hwords decoded
+};
+#define POOL_OVERFLOW_LOG_SIZE 16
+static pool_overflow_event pool_overflow_log[POOL_OVERFLOW_LOG_SIZE];
+static uint32_t pool_overflow_count;
+static uint8_t pool_overflowing; // bit per pool_overflow_type overflowing last frame
+static pool_usage map_pools; // peaks for the current map
+static int8_t map_pools_episode, map_pools_map;
+static render_stat_counters map_start_stats; // render_stats on entering the current map
+#if PD_GOVERNOR
+// runs of consecutive frames the governor degraded
+struct degraded_run {
+    int8_t episode, map;
+    int tic; // of the first frame
+    uint32_t frames;
+};
+#define DEGRADED_RUN_LOG_SIZE 16
+static degraded_run degraded_run_log[DEGRADED_RUN_LOG_SIZE];
+static uint32_t degraded_run_count;
+static bool degraded_last_frame;
+#endif
+
+static void print_map_name(int episode, int map) {
+    if (gamemode == commercial) printf("MAP%02d", map);
+    else printf("E%dM%d", episode, map);
+}
+
+static void log_pool_overflow(pool_overflow_type type, uint32_t amount) {
+    // only log the first frame of a run of frames overflowing the same pool
+    if (!(pool_overflowing & (1u << type))) {
+        auto &e = pool_overflow_log[pool_overflow_count++ % POOL_OVERFLOW_LOG_SIZE];
+        e.type = type;
+        e.episode = gameepisode;
+        e.map = gamemap;
+        e.tic = gametic;
+        e.amount = amount;
+        printf("pd_render: %s overflow at ", pool_overflow_names[type]);
+        print_map_name(e.episode, e.map);
+        printf(" tic %d (%d)\n", e.tic, (int)amount);
+    }
+}
+
+void pd_dump_pool_stats(void) {
+    if (!map_pools_map) return;
+    printf("pd_render pools for ");
+    print_map_name(map_pools_episode, map_pools_map);
+    printf(" (peak/limit): pd_columns %d/%d (%d failed), framedrawables %d/%d, visplanes %d/%d, flat run refills %d, "
+           "patch decoder buffer %d/%d hwords (%d decoded)\n",
+           (int)map_pools.cols, RENDER_COL_MAX, (int)map_pools.cols_failed, (int)map_pools.framedrawables,
+           MAX_FRAME_DRAWABLES, (int)map_pools.visplanes, MAXVISPLANES, (int)map_pools.flat_run_refills,
+           (int)map_pools.decoder_hwm, PATCH_DECODER_CIRCULAR_BUFFER_SIZE, (int)map_pools.decoder_hwords);
+    printf("pd_render frame arena peak bytes (list_buffer %d, visplane_bit %d):", (int)sizeof(list_buffer),
+           (int)sizeof(visplane_bit));
+    for (int p = 0; p < ARENA_PHASE_COUNT; p++) {
+        printf("%s %s %d", p ? "," : "", arena_phase_names[p], (int)arena_peak[p]);
+    }
+    printf("\n");
+    uint32_t first = pool_overflow_count > POOL_OVERFLOW_LOG_SIZE ? pool_overflow_count - POOL_OVERFLOW_LOG_SIZE : 0;
+    if (pool_overflow_count) printf("pd_render last %d of %d overflows:\n", (int)(pool_overflow_count - first), (int)pool_overflow_count);
+    for (uint32_t i = first; i < pool_overflow_count; i++) {
+        const auto &e = pool_overflow_log[i % POOL_OVERFLOW_LOG_SIZE];
+        printf("  %s at ", pool_overflow_names[e.type]);
+        print_map_name(e.episode, e.map);
+        printf(" tic %d (%d)\n", e.tic, (int)e.amount);
+    }
+#if PD_GOVERNOR
+    printf("pd_render degraded frames: %d\n", (int)(render_stats.degraded_frames - map_start_stats.degraded_frames));
+    first = degraded_run_count > DEGRADED_RUN_LOG_SIZE ? degraded_run_count - DEGRADED_RUN_LOG_SIZE : 0;
+    if (degraded_run_count) printf("pd_render last %d of %d degraded runs:\n", (int)(degraded_run_count - first), (int)degraded_run_count);
+    for (uint32_t i = first; i < degraded_run_count; i++) {
+        const auto &r = degraded_run_log[i % DEGRADED_RUN_LOG_SIZE];
+        printf("  ");
+        print_map_name(r.episode, r.map);
+        printf(" tic %d for %d frames\n", r.tic, (int)r.frames);
+    }
+#endif
+#if PD_COMPOSITE_COLUMN_CACHE_SIZE
+    // note the usage is for this thread's cache, but the hits/misses are for all render threads
+    uint32_t hits = render_stats.composite_column_cache_hits - map_start_stats.composite_column_cache_hits;
+    uint32_t misses = render_stats.composite_column_cache_misses - map_start_stats.composite_column_cache_misses;
+    printf("pd_render composite column cache: %d/%d columns used, %d%% hit rate (%d hits, %d misses)\n",
+           (int)composite_column_cache.used, (int)decltype(composite_column_cache)::SLOTS,
+           hits + misses ? (int)(hits * 100ull / (hits + misses)) : 0, (int)hits, (int)misses);
+#endif
+}
+
+static void pool_end_frame() {
+    frame_pools.cols = render_col_count;
+    frame_pools.cols_failed = render_col_failed;
+    frame_pools.framedrawables = num_framedrawables;
+    frame_pools.visplanes = lastvisplane ? lastvisplane - visplanes : 0;
+    if (gamestate != GS_LEVEL) return;
+    if (gameepisode != map_pools_episode || gamemap != map_pools_map) {
+        // dump the peaks for each map as we leave it
+        pd_dump_pool_stats();
+        memset(&map_pools, 0, sizeof(map_pools));
+        memset(arena_peak, 0, sizeof(arena_peak));
+        map_start_stats = render_stats;
+        map_pools_episode = gameepisode;
+        map_pools_map = gamemap;
+    }
+    for (uint i = 0; i < POOL_USAGE_COUNT; i++) {
+        uint32_t *peak = ((uint32_t *)&map_pools) + i;
+        *peak = std::max(*peak, ((const uint32_t *)&frame_pools)[i]);
+    }
+    uint8_t overflowing = 0;
+    if (frame_pools.cols_failed) {
+        log_pool_overflow(POOL_OVERFLOW_COLS, frame_pools.cols_failed);
+        overflowing |= 1u << POOL_OVERFLOW_COLS;
+    }
+    if (frame_pools.flat_run_refills) {
+        log_pool_overflow(POOL_OVERFLOW_FLAT_RUNS, frame_pools.flat_run_refills);
+        overflowing |= 1u << POOL_OVERFLOW_FLAT_RUNS;
+    }
+    if (frame_pools.decoder_hwords > PATCH_DECODER_CIRCULAR_BUFFER_SIZE) {
+        log_pool_overflow(POOL_OVERFLOW_DECODERS, frame_pools.decoder_hwords);
+        overflowing |= 1u << POOL_OVERFLOW_DECODERS;
+    }
+    pool_overflowing = overflowing;
+#if PD_GOVERNOR
+    if (governor.degraded) {
+        if (!degraded_last_frame) {
+            auto &r = degraded_run_log[degraded_run_count++ % DEGRADED_RUN_LOG_SIZE];
+            r.episode = gameepisode;
+            r.map = gamemap;
+            r.tic = gametic;
+            r.frames = 0;
+            printf("pd_render: degraded at ");
+            print_map_name(r.episode, r.map);
+            printf(" tic %d\n", r.tic);
+        }
+        degraded_run_log[(degraded_run_count - 1) % DEGRADED_RUN_LOG_SIZE].frames++;
+    }
+    degraded_last_frame = governor.degraded;
+#endif
+}
+#else
+void pd_dump_pool_stats(void) {
+}
+#endif
+
+static int frame_gametic;
+#if !PICO_ON_DEVICE
+static bool frame_hashable;
+#endif
+
+// called once the frame has been drawn, but before any menu/hu patches are drawn onto it, as chocolate-doom does
+static void hash_frame() {
+#if !PICO_ON_DEVICE
+    // frames which ran out of columns are marked, as which columns were dropped depends on the insertion order
+    // (e.g. PD_BUCKET_SORT), so they may legitimately differ
+    if (frame_hashable) FB_HashFrameMarked(frame_gametic, render_frame_buffer, MAIN_VIEWHEIGHT,
+                                           render_col_failed ? "out_of_columns" : NULL);
+#endif
+}
+
+// anything which has to wait until the frame has been drawn
+static void finish_frame() {
+#if PD_POOL_STATS
+    pool_end_frame();
+#endif
+    if (level_precache.report_pending && gamestate == GS_LEVEL) {
+        // what the first frame still had to decode, to compare with running with PD_PRECACHE_BUDGET=0
+        level_precache.report_pending = false;
+        printf("pd_render: first frame after precache spent %d us decoding %d flats and %d us building patch decoders "
+               "(precache took %d us)\n",
+               (int)(render_stats.flat_decode_us - level_precache.end_stats.flat_decode_us),
+               (int)(render_stats.flat_cache_misses - level_precache.end_stats.flat_cache_misses),
+               (int)(render_stats.patch_decoder_us - level_precache.end_stats.patch_decoder_us), (int)level_precache.us);
+    }
+#if PD_GOVERNOR
+    governor_end_frame(std::min(RENDER_COL_MAX, (int)((cached_flat0 - list_buffer) / sizeof(pd_column))));
+#endif
+#if PD_TIMEDEMO
+    if (!td_demos.empty()) {
+        td_phase_ns[TD_FRAME] = td_now_ns() - td_frame_start;
+        td_frame_record r;
+        memcpy(r.ns, td_phase_ns, sizeof(r.ns));
+        for (uint i = 0; i < TD_STAT_COUNT; i++) {
+            r.stats[i] = ((const uint32_t *)&render_stats)[i] - ((const uint32_t *)&td_frame_start_stats)[i];
+        }
+        r.gametic = frame_gametic;
+#if PD_POOL_STATS
+        r.pools = frame_pools;
+#endif
+        r.cols = render_col_count;
+#if PD_GOVERNOR
+        r.degraded = governor.degraded;
+#else
+        r.degraded = false;
+#endif
+        td_demos.back().frames.push_back(r);
+    }
+#endif
+    sem_release(&render_frame_ready);
+}
+
+#if PD_PIPELINE
+static void pipeline_thread() {
+#if PD_RENDER_THREADS > 1
+    render_worker_thread = true;
+    init_patch_decoder_cache();
+#endif
+    while (true) {
+        sem_acquire_blocking(&pipeline_go);
+        draw_frame(false, false);
+        sem_release(&pipeline_done);
+    }
+}
+
+// called before anything which uses the frame buffer or list_buffer, so the last frame has to be finished
+static void pipeline_wait() {
+    if (pipeline_pending) {
+        sem_acquire_blocking(&pipeline_done);
+        pipeline_pending = false;
+        hash_frame();
+        if (pipeline_fb_patches) {
+            // deferred from pd_end_frame, as the pipeline thread was still drawing into the same buffer
+            pipeline_fb_patches = false;
+            V_UseBuffer(render_frame_buffer);
+            V_DrawPatchList(vpatchlists->framebuffer);
+            V_RestoreBuffer();
+        }
+        finish_frame();
+    }
 }
+#endif
+
 void pd_end_frame(int wipe_start) {
     DEBUG_PINS_SET(start_end, 2);
+#if PD_GOVERNOR
+    governor_pause();
+#endif
 #if !PICO_ON_DEVICE
 //    tex_count.record_print(textures.size());
 //    patch_count.record_print(patches.size());
 //    patch_decoder_size.print_summary();
 //    patch_decoder_size.reset();
+#endif
+#if PD_BUCKET_SORT
+    resolve_pending_columns();
 #endif
     // these were only clipped as they were inserted (so may be more obscured)
     reclip_fuzz_columns();
@@ -2601,7 +4401,15 @@ void pd_end_frame(int wipe_start) {
     }
 //    gpio_put(22, 0);
 #endif
+#if PD_TIMEDEMO
+    // headless, so don't let the (simulated) display pace us; it just shows whatever frame it has
+    if (sem_available(&display_frame_freed)) sem_acquire_blocking(&display_frame_freed);
+#else
     sem_acquire_blocking(&display_frame_freed);
+#endif
+#if PD_GOVERNOR
+    governor_resume();
+#endif
     bool showing_help = inhelpscreens;
     static boolean was_in_help;
     if (gamestate == GS_LEVEL) {
@@ -2644,10 +4452,12 @@ void pd_end_frame(int wipe_start) {
                     clip_columns(0, MAIN_VIEWHEIGHT - 32 -
                                     1); // note this is a noop in non GS_LEVEL so don't bother to add if
                     next_video_type = VIDEO_TYPE_WIPE;
-                    // steal space for our wipe data structures
-                    memset(cached_flat_picnum, -1, sizeof(cached_flat_picnum));
-                    wipe_yoffsets_raw = (int16_t *) (list_buffer_limit - 4096);
-                    wipe_yoffsets = list_buffer_limit - 4096 + SCREENWIDTH * 2;
+                    // steal space for our wipe data structures (the top list_buffer flat region)
+                    cached_flat_picnum[PD_FLAT_CACHE_RESERVED_SLOTS] = 0xff;
+                    arena_release(ARENA_FLATS); // leased again below without it
+                    arena_lease_range(ARENA_OVERLAYS, list_buffer_limit - 4096, 4096);
+                    wipe_yoffsets_raw = arena_ptr<int16_t>(ARENA_OVERLAYS, SCREENWIDTH);
+                    wipe_yoffsets = arena_ptr<uint8_t>(ARENA_OVERLAYS, SCREENWIDTH, SCREENWIDTH * 2);
 
                     memset(wipe_yoffsets, 0, SCREENWIDTH);
                     wipe_yoffsets_raw[0] = -6;//-(M_Random() % 12);
@@ -2657,7 +4467,7 @@ void pd_end_frame(int wipe_start) {
                         if (wipe_yoffsets_raw[i] > 0) wipe_yoffsets_raw[i] = 0;
                         else if (wipe_yoffsets_raw[i] == -12) wipe_yoffsets_raw[i] = -11;
                     }
-                    wipe_linelookup = (uint32_t *) (wipe_yoffsets + SCREENWIDTH);
+                    wipe_linelookup = arena_ptr<uint32_t>(ARENA_OVERLAYS, SCREENHEIGHT, SCREENWIDTH * 3);
                     uint screen_front = render_frame_index ^ 1; // what was currently displayed
                     uint32_t base;
 #if PICO_ON_DEVICE
@@ -2719,33 +4529,33 @@ void pd_end_frame(int wipe_start) {
     if (wipestate) list_buffer_limit -= 4096;
     // we need to use the lower limit of this frame and the last since the final wipe frame may still be using the data
     uint8_t *this_time_limit = std::min(list_buffer_limit, last_list_buffer_limit);
-    if (cached_flat0 != this_time_limit - 4096) {
-        // this should only happen coming in and out of wipe, so we trash all our flash slots
-        cached_flat0 = this_time_limit - 4096;
-        memset(cached_flat_picnum, -1, sizeof(cached_flat_picnum));
-    }
+    if (this_time_limit == list_buffer + sizeof(list_buffer)) arena_release(ARENA_OVERLAYS);
+    // this only moves coming in and out of wipe; the flats in the regions stay put (the wipe data region was
+    // invalidated above)
+    cached_flat0 = this_time_limit - 4096;
 //    printf("CF0 %p ll %p ttl %p overall %p\n", cached_flat0, list_buffer_limit, this_time_limit, list_buffer + sizeof(list_buffer));
     last_list_buffer_limit = list_buffer_limit;
 
     int new_cache_flat_slots = 1 + ((int)(cached_flat0 - list_buffer - render_col_count * sizeof(pd_column))) / 4096;
+    uint32_t live_col_bytes = render_col_count * sizeof(pd_column);
     if (new_cache_flat_slots < 1) {
         // flat 0 - list_buffer - render_col_count * 12 == 4096
         int render_col_limit = (cached_flat0 - list_buffer ) / sizeof(pd_column);
 //        printf("THIS IS A PROBLEM LIMIT TO %d cols\n", render_col_limit);
         new_cache_flat_slots = 1;
         uh_oh_discard_columns(render_col_limit);
+        live_col_bytes = render_col_limit * sizeof(pd_column);
     } else if (render_col_count == RENDER_COL_MAX) {
         static int foo;
 //        printf("OOPS MAXXED OUT %d\n", foo++);
     }
-    for(int i=cached_flat_slots; i<new_cache_flat_slots; i++) {
-        cached_flat_picnum[i] = 0xff;
-    }
     cached_flat_slots = new_cache_flat_slots;
+    lease_columns_and_flat_regions(live_col_bytes);
 
     if (showing_help) {
         // bit hacky, but does the job (we don't want to draw anything at all when fully covered
         memset(column_heads, -1, sizeof(column_heads));
+        fuzz_batch_count = fuzz_advance = 0;
     } else {
         for (uint i = 0; i < count_of(not_fully_covered_cols); i++) {
             if (not_fully_covered_cols[i]) {
@@ -2761,32 +4571,28 @@ void pd_end_frame(int wipe_start) {
             }
         }
     }
-    // render the visplane identifiers, freeing up the visplane columns (which we will use below)
-    int16_t fr_list = predraw_visplanes();
-
-    // ... now we can be parallel
-#if !USE_CORE1_FOR_FLATS
-    draw_visplanes(fr_list);
+    // note the pipeline thread only takes in-game frames, so never has the cast sprite to draw
+#if !DEMO1_ONLY
+    bool cast_sprite = gamestate == GS_FINALE && finalestage == F_STAGE_CAST && !wipestate;
 #else
-    core1_fr_list = fr_list;
-    sem_release(&core1_do_flats);
+    bool cast_sprite = false;
 #endif
-    re_sort_regular_columns_by_fd_num();
-#if USE_CORE1_FOR_REGULAR
-    sem_release(&core1_do_regular);
+    snapshot_frame_state();
+    frame_gametic = gametic;
+#if !PICO_ON_DEVICE
+    // the same frames chocolate-doom hashes (see D_Display)
+    frame_hashable = gamestate == GS_LEVEL && !wipe_start && !wipestate && !showing_help && !automapactive;
 #endif
-    draw_regular_columns(0);
-#if !DEMO1_ONLY
-    if (gamestate == GS_FINALE && finalestage == F_STAGE_CAST && !wipestate) {
-        // note we do this before core0_done so core1 is still playing music
-        int sprite_lump = F_CastSprite();
-        draw_cast_sprite(sprite_lump);
-    }
+#if PD_PIPELINE
+    if (gamestate == GS_LEVEL && !wipestate && !showing_help && !automapactive) {
+        pipeline_pending = true;
+        sem_release(&pipeline_go);
+    } else
 #endif
-    sem_release(&core0_done);
-    sem_acquire_blocking(&core1_done);
-    draw_fuzz_columns();
-    DEBUG_PINS_CLR(full_render, 1);
+    {
+        draw_frame(showing_help, cast_sprite);
+        hash_frame();
+    }
     NetUpdate();
 
     if (gamestate == GS_FINALE) {
@@ -2932,6 +4738,11 @@ void pd_end_frame(int wipe_start) {
     if (render_menu_etc_to_fb) {
         // render menu/hu to framebuffer
         V_RestoreBuffer();
+#if PD_PIPELINE
+        if (pipeline_pending) {
+            pipeline_fb_patches = true;
+        } else
+#endif
         V_DrawPatchList(vpatchlists->framebuffer);
     }
     if (pre_wipe_state == PRE_WIPE_EXTRA_FRAME_NEEDED) {
@@ -2949,7 +4760,11 @@ void pd_end_frame(int wipe_start) {
 #if 0 && !PICO_ON_DEVICE
     printf("GS %d vt %d fi %d\n", gamestate, next_video_type, next_frame_index);
 #endif
-    sem_release(&render_frame_ready);
+#if PD_PIPELINE
+    // otherwise this happens in pipeline_wait once the frame has been drawn
+    if (!pipeline_pending)
+#endif
+    finish_frame();
     DEBUG_PINS_CLR(start_end, 2);
 }
 
@@ -2977,6 +4792,107 @@ void pd_core1_loop() {
     sem_release(&core1_done);
 }
 
+#if PD_TIMEDEMO
+static void td_write_report(FILE *f) {
+    fprintf(f, "{\n  \"config\": {\"PD_SCALE_SORT\": %d, \"PD_RENDER_THREADS\": %d, \"PD_PATCH_COLUMN_CACHE_SIZE\": %d, "
+               "\"PD_FLAT_CACHE_RESERVED_SLOTS\": %d, \"PD_BUCKET_SORT\": %d, \"PD_GOVERNOR\": %d, "
+               "\"PD_PIPELINE\": %d, \"PD_SIMD\": %d, \"PD_SKY_CACHE\": %d, \"PD_OCCLUSION\": %d, "
+               "\"PD_PRECACHE_BUDGET\": %d, \"PD_ARENA_CHECKS\": %d, \"PD_FLAT_LUT_BITS\": %d},\n",
+            PD_SCALE_SORT, PD_RENDER_THREADS, PD_PATCH_COLUMN_CACHE_SIZE, PD_FLAT_CACHE_RESERVED_SLOTS, PD_BUCKET_SORT,
+            PD_GOVERNOR, PD_PIPELINE, PD_SIMD, PD_SKY_CACHE, PD_OCCLUSION, PD_PRECACHE_BUDGET,
+            PD_ARENA_CHECKS, PD_FLAT_LUT_BITS);
+    fprintf(f, "  \"phases\": [");
+    for (int p = 0; p < TD_PHASE_COUNT; p++) fprintf(f, "%s\"%s\"", p ? ", " : "", td_phase_names[p]);
+    fprintf(f, "],\n  \"demos\": [\n");
+    for (size_t d = 0; d < td_demos.size(); d++) {
+        const auto &demo = td_demos[d];
+        uint64_t total[TD_PHASE_COUNT] = {};
+        uint64_t max[TD_PHASE_COUNT] = {};
+        uint64_t stats_total[TD_STAT_COUNT] = {};
+#if PD_POOL_STATS
+        uint32_t pools_max[POOL_USAGE_COUNT] = {};
+#endif
+        for (const auto &r : demo.frames) {
+            for (int p = 0; p < TD_PHASE_COUNT; p++) {
+                total[p] += r.ns[p];
+                max[p] = std::max(max[p], r.ns[p]);
+            }
+            for (uint i = 0; i < TD_STAT_COUNT; i++) stats_total[i] += r.stats[i];
+#if PD_POOL_STATS
+            for (uint i = 0; i < POOL_USAGE_COUNT; i++) {
+                pools_max[i] = std::max(pools_max[i], ((const uint32_t *)&r.pools)[i]);
+            }
+#endif
+        }
+        fprintf(f, "    {\"name\": \"%s\", \"frames\": %d,\n", demo.name, (int)demo.frames.size());
+        fprintf(f, "     \"total_ns\": {");
+        for (int p = 0; p < TD_PHASE_COUNT; p++) fprintf(f, "%s\"%s\": %llu", p ? ", " : "", td_phase_names[p], (unsigned long long)total[p]);
+        fprintf(f, "},\n     \"max_ns\": {");
+        for (int p = 0; p < TD_PHASE_COUNT; p++) fprintf(f, "%s\"%s\": %llu", p ? ", " : "", td_phase_names[p], (unsigned long long)max[p]);
+        fprintf(f, "},\n     \"stats_total\": {");
+        for (uint i = 0; i < TD_STAT_COUNT; i++) fprintf(f, "%s\"%s\": %llu", i ? ", " : "", td_stat_names[i], (unsigned long long)stats_total[i]);
+#if PD_POOL_STATS
+        fprintf(f, "},\n     \"pools_max\": {");
+        for (uint i = 0; i < POOL_USAGE_COUNT; i++) fprintf(f, "%s\"%s\": %u", i ? ", " : "", td_pool_names[i], pools_max[i]);
+#endif
+        // one array per frame: gametic, column count, whether it was degraded, then ns for each of "phases" in order,
+        // then the render_stats deltas, then the pool usage
+        fprintf(f, "},\n     \"frame_fields\": [\"gametic\", \"cols\", \"degraded\"");
+        for (int p = 0; p < TD_PHASE_COUNT; p++) fprintf(f, ", \"%s\"", td_phase_names[p]);
+        for (uint i = 0; i < TD_STAT_COUNT; i++) fprintf(f, ", \"%s\"", td_stat_names[i]);
+#if PD_POOL_STATS
+        for (uint i = 0; i < POOL_USAGE_COUNT; i++) fprintf(f, ", \"pool_%s\"", td_pool_names[i]);
+#endif
+        fprintf(f, "],\n     \"frame_data\": [\n");
+        for (size_t i = 0; i < demo.frames.size(); i++) {
+            const auto &r = demo.frames[i];
+            fprintf(f, "       [%d, %d, %d", r.gametic, r.cols, r.degraded);
+            for (int p = 0; p < TD_PHASE_COUNT; p++) fprintf(f, ", %llu", (unsigned long long)r.ns[p]);
+            for (uint j = 0; j < TD_STAT_COUNT; j++) fprintf(f, ", %u", r.stats[j]);
+#if PD_POOL_STATS
+            for (uint j = 0; j < POOL_USAGE_COUNT; j++) fprintf(f, ", %u", ((const uint32_t *)&r.pools)[j]);
+#endif
+            fprintf(f, "]%s\n", i + 1 < demo.frames.size() ? "," : "");
+        }
+        // and the gametics of the frames the governor degraded
+        fprintf(f, "     ],\n     \"degraded_gametics\": [");
+        int degraded = 0;
+        for (const auto &r : demo.frames) {
+            if (r.degraded) fprintf(f, "%s%d", degraded++ ? ", " : "", r.gametic);
+        }
+        fprintf(f, "]}%s\n", d + 1 < td_demos.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+}
+
+// called to start the timedemo and then again at the end of each demo; returns the next embedded demo to play, or
+// once they have all been played, writes the report and exits
+const char *pd_timedemo_next_demo(void) {
+    static const char *const demo_names[] = { "demo1", "demo2", "demo3", "demo4" };
+    if (td_demos.size() < count_of(demo_names)) {
+        const char *name = demo_names[td_demos.size()];
+        if (W_CheckNumForName(name) >= 0) {
+            td_demos.push_back({name});
+            return name;
+        }
+    }
+    const char *filename = getenv("PD_TIMEDEMO_JSON");
+    if (!filename) filename = "timedemo.json";
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        I_Error("Can't write timedemo report %s", filename);
+    }
+#if PD_PIPELINE
+    pipeline_wait();
+#endif
+    pd_dump_pool_stats();
+    td_write_report(f);
+    fclose(f);
+    printf("timedemo: wrote %s (%d demos)\n", filename, (int)td_demos.size());
+    exit(0);
+}
+#endif
+
 #if PICO_ON_DEVICE
 extern "C" {
 #include "i_picosound.h"
@@ -3020,8 +4936,17 @@ void th_bit_overrun(th_bit_input *bi) {
 }
 
 uint8_t *pd_get_work_area(uint32_t *size) {
+#if PD_PIPELINE
+    pipeline_wait();
+#endif
+    // this covers the list_buffer flat regions, which are lost, and can't be used (e.g. by R_PrecacheLevel when loading
+    // a game, before the save data has been read) until the next frame. it stops short of any wipe data
+    for (int e = PD_FLAT_CACHE_RESERVED_SLOTS; e < (int)MAX_CACHED_FLATS; e++) cached_flat_picnum[e] = 0xff;
+    arena_release(ARENA_FLATS);
+    arena_release(ARENA_INSERTION);
     *size = last_list_buffer_limit - list_buffer;
-    return list_buffer;
+    arena_lease_range(ARENA_WORK_AREA, list_buffer, *size);
+    return arena_ptr<uint8_t>(ARENA_WORK_AREA, *size);
 }
 
 #if !DEMO1_ONLY
@@ -3068,6 +4993,15 @@ void draw_cast_sprite(int sprite_lump) {
     pd_flag |= 2;
     R_DrawVisSprite(vis, 0, 0); // vis->x1, vis->x2); the params are ignored
     pd_flag &= ~2;
+#if PD_BUCKET_SORT
+    resolve_pending_columns();
+#endif
+    // the frame had no columns of its own, so these may be over flat regions we said were usable
+    uint32_t col_bytes = render_col_count * sizeof(pd_column);
+    int slots = 1 + (int)(cached_flat0 - list_buffer - col_bytes) / 4096;
+    assert(slots >= 1);
+    cached_flat_slots = std::min((int)cached_flat_slots, slots);
+    lease_columns_and_flat_regions(col_bytes);
 
     // sort into correct lists
     uint8_t buffer[WHD_PATCH_MAX_WIDTH * 3];
@@ -96,6 +96,27 @@ static uint16_t ega_colors[] = {
 #include "hardware/interp.h"
 #endif
 
+// host only: keep each scanline as converted (with its overlays drawn), and reuse it for the next frame if the
+// overlays covering it, the palette and its row of the framebuffer are all unchanged. this needs about 200K, which the
+// device can't spare. PD_SCANLINE_CACHE=0 in the environment turns it off (e.g. for comparison)
+#ifndef PD_SCANLINE_CACHE
+#define PD_SCANLINE_CACHE !PICO_ON_DEVICE
+#endif
+// host only: PD_SCANLINE_STATS=N in the environment prints a histogram of the time taken to generate each scanline
+// every N seconds
+#ifndef PD_SCANLINE_STATS
+#define PD_SCANLINE_STATS !PICO_ON_DEVICE
+#endif
+// host only: PD_SCANVIDEO_TIMING=F in the environment plays the scanlines generated by the host through a model of
+// scanvideo's timing on the device (see scanvideo_timing_record), assuming the device takes F times as long as the host
+// to generate each one, and reports the scanlines which would have been missed
+#ifndef PD_SCANVIDEO_TIMING
+#define PD_SCANVIDEO_TIMING !PICO_ON_DEVICE
+#endif
+#if PD_SCANLINE_STATS || PD_SCANVIDEO_TIMING
+#include <time.h>
+#endif
+
 CU_REGISTER_DEBUG_PINS(scanline_copy)
 //CU_SELECT_DEBUG_PINS(scanline_copy)
 
@@ -130,6 +151,30 @@ pixel_t *I_VideoBuffer; // todo can't have this
 
 uint8_t __aligned(4) frame_buffer[2][SCREENWIDTH*MAIN_VIEWHEIGHT];
 static uint16_t palette[256];
+// host only: convert scanlines a pair of pixels at a time with a 64K entry table of pairs of palette entries, one per
+// PLAYPAL palette (the device uses the interpolators instead, and couldn't spare 256K anyway)
+#ifndef PD_PALETTE_PAIR_LUT
+#define PD_PALETTE_PAIR_LUT !USE_INTERP
+#endif
+#if PD_PALETTE_PAIR_LUT
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+// NEON has no gather, so it uses table lookups on the palette split into low and high bytes instead
+static uint8_t __aligned(16) palette_lo[256], palette_hi[256];
+#endif
+static uint32_t *palette_pairs;
+// the table for each PLAYPAL palette is built the first time it is used, so flashing between them (pickups, damage)
+// doesn't rebuild 256K each time. the palette it was built from is kept, in case the gamma has changed since
+#define PALETTE_PAIR_TABLES 14
+static struct {
+    uint16_t palette[256];
+    uint32_t *pairs;
+} palette_pair_tables[PALETTE_PAIR_TABLES];
+typedef void (*palette_convert_fn)(uint32_t *dest, const uint8_t *src);
+static palette_convert_fn palette_convert_kernel;
+#endif
 static uint16_t __scratch_x("shared_pal") shared_pal[NUM_SHARED_PALETTES][16];
 static int8_t next_pal=-1;
 
@@ -342,6 +387,116 @@ uint32_t *saved_scanline_buffer_ptrs[PICO_SCANVIDEO_SCANLINE_BUFFER_COUNT];
 #pragma GCC optimize("O3")
 #endif
 
+#if !USE_INTERP
+static void palette_convert_loop(uint32_t *dest, const uint8_t *src) {
+    for (int i = 0; i < SCREENWIDTH; i += 2) {
+        uint32_t val = palette[*src++];
+        val |= (palette[*src++]) << 16;
+        *dest++ = val;
+    }
+}
+#endif
+
+#if PD_PALETTE_PAIR_LUT
+static void palette_convert_pairs(uint32_t *dest, const uint8_t *src) {
+    for (int i = 0; i < SCREENWIDTH / 2; i++) {
+        uint16_t pair;
+        memcpy(&pair, src + i * 2, 2);
+        dest[i] = palette_pairs[pair];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static void palette_convert_avx2(uint32_t *dest, const uint8_t *src) {
+    for (int i = 0; i < SCREENWIDTH; i += 16) {
+        __m256i pairs = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(src + i)));
+        _mm256_storeu_si256((__m256i *)(dest + i / 2), _mm256_i32gather_epi32((const int *)palette_pairs, pairs, 4));
+    }
+}
+
+// the same scalar lookups as palette_convert_pairs (there is no gather before AVX2), but loading 8 pairs and storing 4
+// at a time, which is still a little quicker
+__attribute__((target("sse2")))
+static void palette_convert_pairs8(uint32_t *dest, const uint8_t *src) {
+    for (int i = 0; i < SCREENWIDTH; i += 16) {
+        __m128i pairs = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_setr_epi32((int)palette_pairs[_mm_extract_epi16(pairs, 0)], (int)palette_pairs[_mm_extract_epi16(pairs, 1)],
+                                    (int)palette_pairs[_mm_extract_epi16(pairs, 2)], (int)palette_pairs[_mm_extract_epi16(pairs, 3)]);
+        __m128i hi = _mm_setr_epi32((int)palette_pairs[_mm_extract_epi16(pairs, 4)], (int)palette_pairs[_mm_extract_epi16(pairs, 5)],
+                                    (int)palette_pairs[_mm_extract_epi16(pairs, 6)], (int)palette_pairs[_mm_extract_epi16(pairs, 7)]);
+        _mm_storeu_si128((__m128i *)(dest + i / 2), lo);
+        _mm_storeu_si128((__m128i *)(dest + i / 2 + 4), hi);
+    }
+}
+#elif defined(__aarch64__)
+static void palette_convert_neon(uint32_t *dest, const uint8_t *src) {
+    uint8x16x4_t lo[4], hi[4];
+    for (int t = 0; t < 4; t++) {
+        lo[t] = vld1q_u8_x4(palette_lo + t * 64);
+        hi[t] = vld1q_u8_x4(palette_hi + t * 64);
+    }
+    for (int i = 0; i < SCREENWIDTH; i += 16) {
+        uint8x16_t index = vld1q_u8(src + i);
+        uint8x16x2_t pixels;
+        // out of range indices give 0, so each 64 entry quarter of the palette can be looked up and or-ed in
+        pixels.val[0] = vqtbl4q_u8(lo[0], index);
+        pixels.val[1] = vqtbl4q_u8(hi[0], index);
+        for (int t = 1; t < 4; t++) {
+            index = vsubq_u8(index, vdupq_n_u8(64));
+            pixels.val[0] = vorrq_u8(pixels.val[0], vqtbl4q_u8(lo[t], index));
+            pixels.val[1] = vorrq_u8(pixels.val[1], vqtbl4q_u8(hi[t], index));
+        }
+        // interleaving the low and high bytes gives little endian RGB565 pixels
+        vst2q_u8((uint8_t *)dest + i * 2, pixels);
+    }
+}
+#endif
+
+static void fill_palette_pairs(uint32_t *pairs) {
+    for (int i = 0; i < 256; i++) {
+        for (int j = 0; j < 256; j++) {
+            uint8_t bytes[2] = { i, j };
+            uint16_t pair;
+            memcpy(&pair, bytes, 2);
+            pairs[pair] = palette[i] | (palette[j] << 16);
+        }
+    }
+}
+
+#if defined(__aarch64__)
+static void fill_palette_planes(void) {
+    for (int i = 0; i < 256; i++) {
+        palette_lo[i] = palette[i];
+        palette_hi[i] = palette[i] >> 8;
+    }
+}
+#endif
+
+// called when palette has been set to PLAYPAL palette pal
+static void update_palette_pairs(int pal) {
+    if (palette_convert_kernel == palette_convert_loop) return;
+#if defined(__aarch64__)
+    fill_palette_planes();
+    if (palette_convert_kernel == palette_convert_neon) return;
+#endif
+    assert(pal >= 0 && pal < PALETTE_PAIR_TABLES);
+    if (!palette_pair_tables[pal].pairs) {
+        palette_pair_tables[pal].pairs = malloc(65536 * sizeof(uint32_t));
+        if (!palette_pair_tables[pal].pairs) {
+            palette_convert_kernel = palette_convert_loop;
+            return;
+        }
+    } else if (!memcmp(palette_pair_tables[pal].palette, palette, sizeof(palette))) {
+        palette_pairs = palette_pair_tables[pal].pairs;
+        return;
+    }
+    fill_palette_pairs(palette_pair_tables[pal].pairs);
+    memcpy(palette_pair_tables[pal].palette, palette, sizeof(palette));
+    palette_pairs = palette_pair_tables[pal].pairs;
+}
+#endif
+
 static inline void palette_convert_scanline(uint32_t *dest, const uint8_t *src) {
 #if USE_INTERP
     if (interp_updated != 1) {
@@ -372,12 +527,10 @@ static inline void palette_convert_scanline(uint32_t *dest, const uint8_t *src)
 //            dest[4] = (255-scanline) * 0x2000;
             dest += SCREENWIDTH / 2;
 //            dest[-4] = (255-scanline) * 0x10001;
+#elif PD_PALETTE_PAIR_LUT
+    palette_convert_kernel(dest, src);
 #else
-    for (int i = 0; i < SCREENWIDTH; i += 2) {
-        uint32_t val = palette[*src++];
-        val |= (palette[*src++]) << 16;
-        *dest++ = val;
-    }
+    palette_convert_loop(dest, src);
 #endif
 }
 static void scanline_func_none(uint32_t *dest, int scanline) {
@@ -846,6 +999,218 @@ static inline uint draw_vpatch(uint16_t *dest, patch_t *patch, vpatchlist_t *vp,
     return data - data0;
 }
 
+#if PD_SCANLINE_CACHE
+// the most overlays which can still be being drawn on a scanline we cache; their data offsets are restored when the
+// scanline is reused
+#define SCANLINE_CACHE_MAX_ACTIVE 32
+typedef struct {
+    boolean valid;
+    uint8_t video_type;
+    uint8_t active_count;
+    uint32_t palette_generation;
+    uint32_t overlay_hash;
+    uint16_t active_doff[SCANLINE_CACHE_MAX_ACTIVE];
+    uint8_t src[SCREENWIDTH];
+    uint32_t pixels[SCREENWIDTH / 2];
+} scanline_cache_line_t;
+static scanline_cache_line_t *scanline_cache;
+// hash of the overlays covering each scanline of the frame being displayed
+static uint32_t scanline_overlay_hash[200];
+static uint32_t palette_generation;
+
+static void hash_scanline_overlays(const vpatchlist_t *overlays) {
+    for (int y = 0; y < count_of(scanline_overlay_hash); y++) {
+        scanline_overlay_hash[y] = 0x811c9dc5;
+    }
+    // the overlays are hashed in the same order they are drawn
+    for (int i = 1; i < overlays->header.size; i++) {
+        uint32_t entry;
+        memcpy(&entry, &overlays[i], sizeof(entry));
+        patch_t *patch = resolve_vpatch_handle(overlays[i].entry.patch_handle);
+        int end = overlays[i].entry.y + vpatch_height(patch);
+        if (end > count_of(scanline_overlay_hash)) end = count_of(scanline_overlay_hash);
+        for (int y = overlays[i].entry.y; y < end; y++) {
+            uint32_t h = (scanline_overlay_hash[y] ^ entry) * 0x9e3779b1;
+            scanline_overlay_hash[y] = h ^ (h >> 15);
+        }
+    }
+}
+
+static boolean scanline_cacheable(void) {
+    return scanline_cache && (display_video_type == VIDEO_TYPE_DOUBLE || display_video_type == VIDEO_TYPE_SINGLE)
+#if !DEMO1_ONLY
+        && !video_scroll
+#endif
+    ;
+}
+
+// the framebuffer row drawn under the overlays, or NULL if there is none (the status bar area in VIDEO_TYPE_DOUBLE)
+static const uint8_t *scanline_cache_source(int scanline) {
+    if (scanline < MAIN_VIEWHEIGHT) return frame_buffer[display_frame_index] + scanline * SCREENWIDTH;
+    if (display_video_type == VIDEO_TYPE_SINGLE) return frame_buffer[display_frame_index ^ 1] + (scanline - 32) * SCREENWIDTH;
+    return NULL;
+}
+
+static boolean scanline_cache_lookup(uint32_t *dest, int scanline) {
+    const scanline_cache_line_t *line = &scanline_cache[scanline];
+    if (!line->valid || line->video_type != display_video_type || line->palette_generation != palette_generation ||
+        line->overlay_hash != scanline_overlay_hash[scanline]) {
+        return false;
+    }
+    const uint8_t *src = scanline_cache_source(scanline);
+    if (src && memcmp(src, line->src, SCREENWIDTH)) return false;
+    memcpy(dest, line->pixels, sizeof(line->pixels));
+    return true;
+}
+
+// called once the overlays have been drawn, when the ones drawn on this scanline are those left in the active list
+static void scanline_cache_store(const uint32_t *dest, int scanline) {
+    scanline_cache_line_t *line = &scanline_cache[scanline];
+    line->valid = false;
+    int n = 0;
+    for (int vp = vpatchlists->vpatch_next[0]; vp; vp = vpatchlists->vpatch_next[vp]) {
+        if (n == SCANLINE_CACHE_MAX_ACTIVE) return;
+        line->active_doff[n++] = vpatchlists->vpatch_doff[vp];
+    }
+    line->active_count = n;
+    line->video_type = display_video_type;
+    line->palette_generation = palette_generation;
+    line->overlay_hash = scanline_overlay_hash[scanline];
+    const uint8_t *src = scanline_cache_source(scanline);
+    if (src) memcpy(line->src, src, SCREENWIDTH);
+    memcpy(line->pixels, dest, sizeof(line->pixels));
+    line->valid = true;
+}
+#endif
+
+#if PD_SCANLINE_STATS || PD_SCANVIDEO_TIMING
+static inline uint64_t scanline_time_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+#if PD_SCANLINE_STATS
+// bucket n counts scanlines taking less than 250ns << n (the last is everything else); a scanline lasts about 15.6us
+#define SCANLINE_TIME_BUCKETS 8
+static const char *const scanline_time_bucket_names[SCANLINE_TIME_BUCKETS] = {
+        "<0.25us", "<0.5us", "<1us", "<2us", "<4us", "<8us", "<16us", ">=16us"
+};
+static int scanline_stats_period; // in displayed frames, or 0 if not reporting
+static int scanline_stats_frames;
+static uint32_t scanline_time_histogram[SCANLINE_TIME_BUCKETS];
+static uint32_t scanlines_generated, scanlines_reused;
+static uint64_t scanline_time_total_ns;
+
+static void scanline_stats_record(uint64_t ns) {
+    int b = 0;
+    while (b < SCANLINE_TIME_BUCKETS - 1 && ns >= (250u << b)) b++;
+    scanline_time_histogram[b]++;
+    scanlines_generated++;
+    scanline_time_total_ns += ns;
+}
+
+static void scanline_stats_new_frame(void) {
+    if (!scanline_stats_period || ++scanline_stats_frames < scanline_stats_period) return;
+    printf("scanlines: %d generated, %d%% reused, mean %dns:", (int)scanlines_generated,
+           scanlines_generated ? (int)(scanlines_reused * 100ull / scanlines_generated) : 0,
+           scanlines_generated ? (int)(scanline_time_total_ns / scanlines_generated) : 0);
+    for (int b = 0; b < SCANLINE_TIME_BUCKETS; b++) {
+        printf(" %s %d", scanline_time_bucket_names[b], (int)scanline_time_histogram[b]);
+    }
+    printf("\n");
+    memset(scanline_time_histogram, 0, sizeof(scanline_time_histogram));
+    scanlines_generated = scanlines_reused = 0;
+    scanline_time_total_ns = 0;
+    scanline_stats_frames = 0;
+}
+#endif
+
+#if PD_SCANVIDEO_TIMING
+// on the device, scanvideo shows each scanline buffer for VGA_MODE.yscale lines of the video mode, and the scanline
+// callback can only be generating up to PICO_SCANVIDEO_SCANLINE_BUFFER_COUNT buffers ahead of the one being shown. a
+// buffer which isn't finished by the time it is due to be shown is missed (the missing scanline is shown instead)
+#define SCANVIDEO_TIMING_REPORT_FRAMES 600
+static double scanvideo_timing_factor; // estimated device time / host time, or 0 if not emulating
+static int64_t scanvideo_line_ns, scanvideo_frame_ns, scanvideo_vblank_ns;
+static int scanvideo_timing_last_frame = -1;
+static int64_t scanvideo_timing_frame; // frames since we started (scanvideo's frame numbers wrap)
+static int64_t scanvideo_producer_ns; // how far the (virtual) scanline callback has got
+static int64_t scanvideo_buffer_free_ns[PICO_SCANVIDEO_SCANLINE_BUFFER_COUNT]; // when each buffer is freed
+static uint32_t scanvideo_buffer_seq;
+static struct {
+    int frames;
+    uint32_t lines, missed;
+    int64_t busy_ns, worst_late_ns, min_slack_ns;
+    uint16_t missed_by_scanline[200];
+} scanvideo_timing;
+
+static void init_scanvideo_timing(double factor) {
+    const scanvideo_timing_t *timing = VGA_MODE.default_timing;
+    scanvideo_timing_factor = factor;
+    scanvideo_line_ns = timing->h_total * 1000000000ll / timing->clock_freq;
+    scanvideo_frame_ns = timing->v_total * scanvideo_line_ns;
+    scanvideo_vblank_ns = (timing->v_total - timing->v_active) * scanvideo_line_ns;
+    scanvideo_timing.min_slack_ns = INT64_MAX;
+}
+
+static void scanvideo_timing_report(void) {
+    printf("scanvideo timing (device = host x%.1f): %d lines, %d missed (worst %dus late), min slack %dus, callback busy %d%%",
+           scanvideo_timing_factor, (int)scanvideo_timing.lines, (int)scanvideo_timing.missed,
+           (int)(scanvideo_timing.worst_late_ns / 1000),
+           scanvideo_timing.min_slack_ns == INT64_MAX ? 0 : (int)(scanvideo_timing.min_slack_ns / 1000),
+           (int)(scanvideo_timing.busy_ns * 100 / (scanvideo_timing.frames * scanvideo_frame_ns)));
+    if (scanvideo_timing.missed) {
+        // the scanlines missed most often
+        printf("; missed scanlines:");
+        for (int n = 0; n < 5; n++) {
+            int worst = 0;
+            for (int y = 1; y < count_of(scanvideo_timing.missed_by_scanline); y++) {
+                if (scanvideo_timing.missed_by_scanline[y] > scanvideo_timing.missed_by_scanline[worst]) worst = y;
+            }
+            if (!scanvideo_timing.missed_by_scanline[worst]) break;
+            printf(" %d (%d)", worst, scanvideo_timing.missed_by_scanline[worst]);
+            scanvideo_timing.missed_by_scanline[worst] = 0;
+        }
+    }
+    printf("\n");
+    memset(&scanvideo_timing, 0, sizeof(scanvideo_timing));
+    scanvideo_timing.min_slack_ns = INT64_MAX;
+}
+
+// called with the time the host took to generate each scanline (including any per frame work done beforehand)
+static void scanvideo_timing_record(int frame, int scanline, uint64_t host_ns) {
+    if (frame != scanvideo_timing_last_frame) {
+        if (scanvideo_timing_last_frame >= 0) {
+            scanvideo_timing_frame += (uint16_t)(frame - scanvideo_timing_last_frame);
+        }
+        scanvideo_timing_last_frame = frame;
+        if (++scanvideo_timing.frames == SCANVIDEO_TIMING_REPORT_FRAMES) scanvideo_timing_report();
+    }
+    if (scanline >= count_of(scanvideo_timing.missed_by_scanline)) return;
+    int64_t cost = (int64_t)(host_ns * scanvideo_timing_factor);
+    int64_t due = scanvideo_timing_frame * scanvideo_frame_ns + scanvideo_vblank_ns +
+                  scanline * VGA_MODE.yscale * scanvideo_line_ns;
+    int64_t *free_ns = &scanvideo_buffer_free_ns[scanvideo_buffer_seq++ % PICO_SCANVIDEO_SCANLINE_BUFFER_COUNT];
+    int64_t start = scanvideo_producer_ns > *free_ns ? scanvideo_producer_ns : *free_ns;
+    int64_t finish = start + cost;
+    scanvideo_timing.lines++;
+    scanvideo_timing.busy_ns += cost;
+    if (finish > due) {
+        scanvideo_timing.missed++;
+        scanvideo_timing.missed_by_scanline[scanline]++;
+        if (finish - due > scanvideo_timing.worst_late_ns) scanvideo_timing.worst_late_ns = finish - due;
+        // scanvideo would have moved on to the scanline after, so we don't carry the lateness over
+        finish = due;
+    } else if (due - finish < scanvideo_timing.min_slack_ns) {
+        scanvideo_timing.min_slack_ns = due - finish;
+    }
+    scanvideo_producer_ns = finish;
+    *free_ns = due + VGA_MODE.yscale * scanvideo_line_ns;
+}
+#endif
+
 // this is not in flash as quite large and only once per frame
 void __noinline new_frame_init_overlays_palette_and_wipe() {
     // re-initialize our overlay drawing
@@ -860,6 +1225,9 @@ void __noinline new_frame_init_overlays_palette_and_wipe() {
             vpatchlists->vpatch_next[i] = vpatchlists->vpatch_starters[overlays[i].entry.y];
             vpatchlists->vpatch_starters[overlays[i].entry.y] = i;
         }
+#if PD_SCANLINE_CACHE
+        if (scanline_cache) hash_scanline_overlays(overlays);
+#endif
         if (next_pal != -1) {
             static const uint8_t *playpal;
             static bool calculate_palettes;
@@ -904,6 +1272,9 @@ void __noinline new_frame_init_overlays_palette_and_wipe() {
                     palette[i] = PICO_SCANVIDEO_PIXEL_FROM_RGB8(r, g, b);
                 }
             }
+#if PD_PALETTE_PAIR_LUT
+            update_palette_pairs(next_pal);
+#endif
             next_pal = -1;
             assert(vpatch_type(stbar) == vp4_solid); // no transparent, no runs, 4 bpp
             for (int i = 0; i < NUM_SHARED_PALETTES; i++) {
@@ -914,6 +1285,9 @@ void __noinline new_frame_init_overlays_palette_and_wipe() {
                     shared_pal[i][j] = palette[vpatch_palette(patch)[j]];
                 }
             }
+#if PD_SCANLINE_CACHE
+            palette_generation++;
+#endif
         }
         if (display_video_type == VIDEO_TYPE_WIPE) {
 //            printf("WIPEMIN %d\n", wipe_min);
@@ -984,16 +1358,41 @@ void __scratch_x("scanlines") fill_scanlines() {
         static int8_t last_frame_number = -1;
         int frame = scanvideo_frame_number(buffer->scanline_id);
         int scanline = scanvideo_scanline_number(buffer->scanline_id);
+#if PD_SCANLINE_STATS || PD_SCANVIDEO_TIMING
+        boolean time_scanline = false;
+#if PD_SCANLINE_STATS
+        time_scanline |= scanline_stats_period != 0;
+#endif
+#if PD_SCANVIDEO_TIMING
+        time_scanline |= scanvideo_timing_factor > 0;
+#endif
+        uint64_t scanline_start_ns = time_scanline ? scanline_time_ns() : 0;
+#endif
         if ((int8_t) frame != last_frame_number) {
             last_frame_number = frame;
             new_frame_stuff();
+#if PD_SCANLINE_STATS
+            scanline_stats_new_frame();
+#endif
         }
 
         DEBUG_PINS_SET(scanline_copy, 1);
         if (display_video_type != VIDEO_TYPE_TEXT) {
             // we don't have text mode -> normal transition yet, but we may for network game, so leaving this here - we would need to put the buffer pointers back
             assert (buffer->data < text_scanline_buffer_start || buffer->data >= text_scanline_buffer_start + TEXT_SCANLINE_BUFFER_TOTAL_WORDS);
+#if PD_SCANLINE_CACHE
+            boolean cacheable = scanline_cacheable();
+            boolean reused = cacheable && scanline_cache_lookup(buffer->data + 1, scanline);
+            if (!reused) {
+                scanline_funcs[display_video_type](buffer->data + 1, scanline);
+            }
+#if PD_SCANLINE_STATS
+            scanlines_reused += reused;
+#endif
+            int active = 0;
+#else
             scanline_funcs[display_video_type](buffer->data+1, scanline);
+#endif
             if (display_video_type >= FIRST_VIDEO_TYPE_WITH_OVERLAYS) {
                 assert(scanline < count_of(vpatchlists->vpatch_starters));
                 int prev = 0;
@@ -1015,6 +1414,13 @@ void __scratch_x("scanlines") fill_scanlines() {
                     patch_t *patch = resolve_vpatch_handle(overlays[vp].entry.patch_handle);
                     int yoff = scanline - overlays[vp].entry.y;
                     if (yoff < vpatch_height(patch)) {
+#if PD_SCANLINE_CACHE
+                        if (reused) {
+                            // already drawn, but we need to be in the right place in the patch data for the next line
+                            assert(active < scanline_cache[scanline].active_count);
+                            vpatchlists->vpatch_doff[vp] = scanline_cache[scanline].active_doff[active++];
+                        } else
+#endif
                         vpatchlists->vpatch_doff[vp] = draw_vpatch((uint16_t*)(buffer->data + 1), patch, &overlays[vp],
                                                                    vpatchlists->vpatch_doff[vp]);
                         prev = vp;
@@ -1023,6 +1429,9 @@ void __scratch_x("scanlines") fill_scanlines() {
                     }
                 }
             }
+#if PD_SCANLINE_CACHE
+            if (cacheable && !reused) scanline_cache_store(buffer->data + 1, scanline);
+#endif
             uint16_t *p = (uint16_t *) buffer->data;
             p[0] = video_doom_offset_raw_run;
             p[1] = p[2];
@@ -1044,6 +1453,17 @@ void __scratch_x("scanlines") fill_scanlines() {
             buffer->data_used = SCREENWIDTH / 2 + 3;
 #endif
         }
+#if PD_SCANLINE_STATS || PD_SCANVIDEO_TIMING
+        if (time_scanline) {
+            uint64_t scanline_ns = scanline_time_ns() - scanline_start_ns;
+#if PD_SCANLINE_STATS
+            if (scanline_stats_period) scanline_stats_record(scanline_ns);
+#endif
+#if PD_SCANVIDEO_TIMING
+            if (scanvideo_timing_factor > 0) scanvideo_timing_record(frame, scanline, scanline_ns);
+#endif
+        }
+#endif
         scanvideo_end_scanline_generation(buffer);
 #if SUPPORT_TEXT
         buffer = scanvideo_begin_scanline_generation_linked(display_video_type == VIDEO_TYPE_TEXT ? 2 : 1, false);
@@ -1100,12 +1520,104 @@ static void core1() {
     }
 }
 
+#if PD_PALETTE_PAIR_LUT
+// times each conversion against the original loop (PD_PALETTE_BENCH=<scanlines>), checking they give the same result
+static void palette_convert_benchmark(int scanlines) {
+    static const struct {
+        const char *name;
+        palette_convert_fn fn;
+    } kernels[] = {
+        { "loop", palette_convert_loop },
+        { "pairs", palette_convert_pairs },
+#if defined(__x86_64__) || defined(__i386__)
+        { "pairs8", palette_convert_pairs8 },
+        { "avx2", palette_convert_avx2 },
+#elif defined(__aarch64__)
+        { "neon", palette_convert_neon },
+#endif
+    };
+    uint32_t *pairs = malloc(65536 * sizeof(uint32_t));
+    if (!pairs) return;
+    uint16_t saved_palette[256];
+    uint32_t *saved_pairs = palette_pairs;
+    memcpy(saved_palette, palette, sizeof(palette));
+    for (int i = 0; i < 256; i++) palette[i] = (uint16_t)(i * 0x9e37u + 0x1234u);
+    fill_palette_pairs(pairs);
+    palette_pairs = pairs;
+#if defined(__aarch64__)
+    fill_palette_planes();
+#endif
+    uint8_t *src = frame_buffer[0];
+    for (int i = 0; i < SCREENWIDTH * MAIN_VIEWHEIGHT; i++) src[i] = (uint8_t)(i * 7 + (i >> 9));
+    uint32_t expected[SCREENWIDTH / 2], dest[SCREENWIDTH / 2];
+    for (uint k = 0; k < count_of(kernels); k++) {
+#if defined(__x86_64__) || defined(__i386__)
+        if (kernels[k].fn == palette_convert_avx2 && !__builtin_cpu_supports("avx2")) continue;
+#endif
+        bool ok = true;
+        for (int y = 0; y < MAIN_VIEWHEIGHT; y++) {
+            palette_convert_loop(expected, src + y * SCREENWIDTH);
+            kernels[k].fn(dest, src + y * SCREENWIDTH);
+            if (memcmp(expected, dest, sizeof(dest))) ok = false;
+        }
+        uint64_t t0 = time_us_64();
+        for (int n = 0; n < scanlines; n++) {
+            kernels[k].fn(dest, src + (n % MAIN_VIEWHEIGHT) * SCREENWIDTH);
+        }
+        uint64_t t = time_us_64() - t0;
+        printf("palette_convert %-6s: %d ns/scanline%s\n", kernels[k].name, (int)(t * 1000 / scanlines), ok ? "" : " MISMATCH");
+    }
+    free(pairs);
+    palette_pairs = saved_pairs;
+    memcpy(palette, saved_palette, sizeof(palette));
+#if defined(__aarch64__)
+    fill_palette_planes();
+#endif
+}
+
+static void init_palette_convert(void) {
+    palette_convert_kernel = palette_convert_loop;
+    // PD_PALETTE_LUT=0 sticks with the original loop
+    const char *env = getenv("PD_PALETTE_LUT");
+    if (env && !atoi(env)) return;
+    palette_convert_kernel = palette_convert_pairs;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) palette_convert_kernel = palette_convert_avx2;
+    else if (__builtin_cpu_supports("sse2")) palette_convert_kernel = palette_convert_pairs8;
+#elif defined(__aarch64__)
+    palette_convert_kernel = palette_convert_neon;
+#endif
+    // until the first palette is set
+    update_palette_pairs(0);
+    env = getenv("PD_PALETTE_BENCH");
+    if (env && atoi(env) > 0) palette_convert_benchmark(atoi(env));
+}
+#endif
+
 void I_InitGraphics(void)
 {
     stbar = resolve_vpatch_handle(VPATCH_STBAR);
     sem_init(&render_frame_ready, 0, 2);
     sem_init(&display_frame_freed, 1, 2);
     sem_init(&core1_launch, 0, 1);
+#if PD_PALETTE_PAIR_LUT
+    init_palette_convert();
+#endif
+#if PD_SCANLINE_CACHE
+    const char *scanline_cache_env = getenv("PD_SCANLINE_CACHE");
+    if (!scanline_cache_env || atoi(scanline_cache_env)) {
+        scanline_cache = calloc(count_of(scanline_overlay_hash), sizeof(scanline_cache_line_t));
+    }
+#endif
+#if PD_SCANLINE_STATS
+    const char *scanline_stats_env = getenv("PD_SCANLINE_STATS");
+    if (scanline_stats_env) scanline_stats_period = atoi(scanline_stats_env) * 60;
+#endif
+#if PD_SCANVIDEO_TIMING
+    const char *scanvideo_timing_env = getenv("PD_SCANVIDEO_TIMING");
+    if (scanvideo_timing_env && atof(scanvideo_timing_env) > 0) init_scanvideo_timing(atof(scanvideo_timing_env));
+#endif
     pd_init();
     multicore_launch_core1(core1);
     // wait for core1 launch as it may do malloc and we have no mutex around that
@@ -7,6 +7,12 @@ extern "C" {
 
 #include "m_fixed.h"
 
+// cull sprite columns which are entirely behind solid walls before their posts are decoded (see
+// pd_masked_columns_occluded)
+#ifndef PD_OCCLUSION
+#define PD_OCCLUSION 1
+#endif
+
 typedef enum {
     PDCOL_NONE = 0,
     PDCOL_TOP,
@@ -25,8 +31,24 @@ void pd_begin_frame();
 void pd_add_column(pd_column_type type);
 void pd_add_masked_columns(uint8_t *ys, int seg_count);
 void pd_add_plane_column(int x, int yl, int yh, fixed_t scale, int floor, int fd_num);
+#if PD_OCCLUSION
+// column x has been closed by solid walls, so nothing further away will be visible
+void pd_close_column(int x);
+// whether masked columns x1 to x2 (inclusive) at the given scale would be entirely hidden by what has been added so far
+int pd_masked_columns_occluded(int x1, int x2, fixed_t scale);
+#endif
 void pd_end_frame(int wipe_start);
+// level load precache of flats and patch decoders (see R_PrecacheLevel), most important first
+void pd_precache_begin(void);
+void pd_precache_flat(int picnum);
+void pd_precache_texture(int texnum);
+void pd_precache_end(void);
 uint8_t *pd_get_work_area(uint32_t *size);
+// print the peak use of the renderer's pools for the current map, and the recent pool overflows
+void pd_dump_pool_stats(void);
+#if PD_TIMEDEMO
+const char *pd_timedemo_next_demo(void);
+#endif
 #if PICO_ON_DEVICE
 void pd_start_save_pause(void);
 void pd_end_save_pause(void);
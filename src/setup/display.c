@@ -75,6 +75,7 @@ static int fullscreen_width = 0, fullscreen_height = 0;
 static int window_width = 800, window_height = 600;
 static int startup_delay = 1000;
 static int max_scaling_buffer_pixels = 16000000;
+static int streaming_texture = 0;
 static int usegamma = 0;
 
 int graphical_startup = 1;
@@ -267,6 +268,7 @@ void BindDisplayVariables(void)
     M_BindIntVariable("vga_porch_flash",           &vga_porch_flash);
     M_BindIntVariable("force_software_renderer",   &force_software_renderer);
     M_BindIntVariable("max_scaling_buffer_pixels", &max_scaling_buffer_pixels);
+    M_BindIntVariable("streaming_texture",         &streaming_texture);
 
     if (gamemission == doom || gamemission == heretic
      || gamemission == strife)
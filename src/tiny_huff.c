@@ -286,4 +286,58 @@ int __not_in_flash_func(th_make_prefix_length_table)(th_decoder decoder, uint8_t
     }
     return max_length;
 }
-#pragma GCC pop_options
\ No newline at end of file
+// reverse the low n (<= 16) bits of x
+static inline uint th_reverse_bits(uint x, uint n) {
+    return ((reverse8[x & 0xff] << 8) | reverse8[(x >> 8) & 0xff]) >> (16 - n);
+}
+
+void __not_in_flash_func(th_make_lut)(th_decoder decoder, uint16_t *lut, uint k) {
+    assert(decoder[0] > 1);
+    assert(k > 0 && k <= TH_LUT_MAX_BITS);
+    const uint8_t *symbols = (uint8_t *)(decoder + decoder[0]);
+    uint max_length = decoder[0] / 2;
+    if (max_length > k) max_length = k;
+    // anything not covered by a code of up to k bits is the prefix of a longer one
+    for(uint i=0; i < (1u << k); i++) {
+        lut[i] = th_reverse_bits(i, k);
+    }
+    decoder++;
+    uint code = 0;
+    for(uint length=1; length<=max_length;length++) {
+        for(;code < decoder[TH_IDX_CEILING];code++) {
+            uint index = th_reverse_bits(code, length);
+            uint16_t entry = (length << TH_LUT_LENGTH_SHIFT) | symbols[code - decoder[TH_IDX_OFFSET]];
+            for(uint i=0;i < (1u << (k-length)); i++) {
+                lut[index | (i << length)] = entry;
+            }
+        }
+        code <<= 1;
+        decoder += 2;
+    }
+}
+
+void __not_in_flash_func(th_make_lut_16)(th_decoder decoder, uint32_t *lut, uint k) {
+    assert(decoder[0] > 1);
+    assert(k > 0 && k <= TH_LUT_MAX_BITS);
+    const uint16_t *symbols = decoder + decoder[0];
+    uint max_length = decoder[0] / 2;
+    if (max_length > k) max_length = k;
+    // anything not covered by a code of up to k bits is the prefix of a longer one
+    for(uint i=0; i < (1u << k); i++) {
+        lut[i] = th_reverse_bits(i, k);
+    }
+    decoder++;
+    uint code = 0;
+    for(uint length=1; length<=max_length;length++) {
+        for(;code < decoder[TH_IDX_CEILING];code++) {
+            uint index = th_reverse_bits(code, length);
+            uint32_t entry = (length << TH_LUT16_LENGTH_SHIFT) | symbols[code - decoder[TH_IDX_OFFSET]];
+            for(uint i=0;i < (1u << (k-length)); i++) {
+                lut[index | (i << length)] = entry;
+            }
+        }
+        code <<= 1;
+        decoder += 2;
+    }
+}
+#pragma GCC pop_options
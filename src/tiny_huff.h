@@ -3,6 +3,7 @@ extern "C" {
 #endif
 
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
 typedef unsigned int uint;
 
@@ -138,7 +139,8 @@ static inline int th_bit(th_bit_input *bi) {
 
 #if TH_USE_ACCUM
 static inline void th_fill_byte(th_bit_input *bi) {
-    assert(bi->bits < 24);
+    // th_refill32 tops up from 24 bits to 32
+    assert(bi->bits <= 24);
 //    if (bi->bits < 8) {
 #ifndef NDEBUG
         if (bi->cur == bi->end) th_bit_overrun(bi);
@@ -147,6 +149,38 @@ static inline void th_fill_byte(th_bit_input *bi) {
         bi->bits += 8;
 //    }
 }
+
+// whether a 32 bit refill may load a (possibly unaligned) word rather than one byte at a time
+#ifndef TH_UNALIGNED_READS
+#if !PICO_ON_DEVICE || defined(__ARM_FEATURE_UNALIGNED)
+#define TH_UNALIGNED_READS 1
+#else
+#define TH_UNALIGNED_READS 0
+#endif
+#endif
+
+// top up the accumulator to at least 25 bits, so that a code of up to 25 bits may be decoded from it with no further
+// refill. note this may read up to 3 bytes past the last bit actually consumed. the word path leaves the bits of the
+// next input byte above bits in the accumulator; that is fine as th_fill_byte would or the same values in there
+static inline void th_refill32(th_bit_input *bi) {
+#ifndef NDEBUG
+    if (bi->end && bi->cur + 4 > bi->end) {
+        while (bi->bits <= 24 && bi->cur < bi->end) th_fill_byte(bi);
+        return;
+    }
+#endif
+#if TH_UNALIGNED_READS
+    if (bi->bits <= 24) {
+        uint32_t word;
+        memcpy(&word, bi->cur, 4);
+        bi->accum |= word << bi->bits;
+        bi->cur += (31 - bi->bits) >> 3;
+        bi->bits |= 24;
+    }
+#else
+    while (bi->bits <= 24) th_fill_byte(bi);
+#endif
+}
 #endif
 
 static inline uint th_read_bits(th_bit_input *bi, int n) {
@@ -345,6 +379,68 @@ static inline uint16_t th_decode_table_special_16(th_decoder decoder, const uint
     } while (1);
 }
 
+// lookup table decoding: a first level table indexed by the next k input bits (k <= TH_LUT_MAX_BITS, chosen per decoder
+// to fit the RAM available; the table is 2 << k bytes, or 4 << k for th_make_lut_16). each entry holds the length of
+// the code those bits start with and its symbol, or for a code longer than k bits a length of 0 and the k bit canonical
+// prefix, from which th_decode_lut finishes the code by walking the decoder as th_decode does
+#define TH_LUT_MAX_BITS 12
+#define TH_LUT_LENGTH_SHIFT 12
+#define TH_LUT16_LENGTH_SHIFT 16
+void th_make_lut(th_decoder decoder, uint16_t *lut, uint k);
+void th_make_lut_16(th_decoder decoder, uint32_t *lut, uint k);
+
+#if TH_USE_ACCUM
+// finish a code longer than k bits whose canonical prefix is code
+static inline uint th_decode_lut_long(th_decoder decoder, uint code, uint k, th_bit_input *bi) {
+    bi->accum >>= k;
+    bi->bits -= k;
+#ifndef NDEBUG
+    uint max_code_length = (decoder[0] - 1)/2;
+    uint length = k;
+#endif
+    decoder += 1 + 2 * k;
+    do {
+        code = (code << 1u) | th_bit(bi);
+        if (code < decoder[TH_IDX_CEILING]) {
+            return code - decoder[TH_IDX_OFFSET];
+        }
+        decoder += 2;
+#ifndef NDEBUG
+        length++;
+        assert(length < max_code_length);
+#endif
+    } while (1);
+}
+
+static inline uint8_t th_decode_lut(th_decoder decoder, const uint16_t *lut, uint k, th_bit_input *bi) {
+    assert(decoder[0] > 1); // we should be called for the empty decoder case
+    th_refill32(bi);
+    uint entry = lut[bi->accum & ((1u << k) - 1)];
+    uint length = entry >> TH_LUT_LENGTH_SHIFT;
+    if (length) {
+        bi->accum >>= length;
+        bi->bits -= length;
+        return (uint8_t)entry;
+    }
+    const uint8_t *symbols = (uint8_t *)(decoder + decoder[0]);
+    return symbols[th_decode_lut_long(decoder, entry, k, bi)];
+}
+
+static inline uint16_t th_decode_lut_16(th_decoder decoder, const uint32_t *lut, uint k, th_bit_input *bi) {
+    assert(decoder[0] > 1); // we should be called for the empty decoder case
+    th_refill32(bi);
+    uint32_t entry = lut[bi->accum & ((1u << k) - 1)];
+    uint length = entry >> TH_LUT16_LENGTH_SHIFT;
+    if (length) {
+        bi->accum >>= length;
+        bi->bits -= length;
+        return (uint16_t)entry;
+    }
+    const uint16_t *symbols = decoder + decoder[0];
+    return symbols[th_decode_lut_long(decoder, entry, k, bi)];
+}
+#endif
+
 #if 0
 // todo asm-ify // note we need at most 15 bits
 static uint8_t th_decode_fast_special(th_decoder decoder, th_bit_input *bi) {
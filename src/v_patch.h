@@ -62,6 +62,9 @@ typedef const uint8_t patch_t;
 #define patch_byte_addressed(p) (((p)[0] & 4)!=0)
 #define patch_fully_opaque(p) (((p)[0] & 2)!=0)
 #define patch_has_extra(p) (((p)[0] & 1)!=0)
+// each column's (backwards) post metadata ends at its own col_offset rather than at the next stored column's, as the
+// columns are stored out of order (whd_gen -order)
+#define patch_meta_before_column(p) (((p)[0] & 8)!=0)
 
 // vpatch style patches are stored differently
 #define vpatch_width(p) ((p)[0] | (((p)[3]&0x2)<<7u))
@@ -66,6 +66,7 @@ typedef struct {
     uint16_t num;
 } lump_name_info_t;
 static lump_name_info_t *lump_names;
+static const uint32_t *lump_sizes; // only if WHD_LUMP_SIZES_PRESENT
 #endif
 unsigned int numlumps = 0;
 
@@ -176,6 +177,7 @@ wad_file_t *W_AddFile (const char *filename)
     lump_offsets = (const uint32_t *)(whd_map_base + ((wadinfo_t *)whd_map_base)->infotableofs);
     whdheader = (const whdheader_t*)(whd_map_base + sizeof(wadinfo_t));
     lump_names = (lump_name_info_t *)(whd_map_base + sizeof(wadinfo_t) + sizeof(whdheader_t) + (numlumps + 1) * 4);
+    lump_sizes = (lump_offsets[numlumps] & WHD_LUMP_SIZES_PRESENT) ? (const uint32_t *)(lump_names + whdheader->num_named_lumps) : NULL;
 #endif
 #else
 
@@ -391,6 +393,7 @@ static inline int lump_size(const lumpinfo_t *lump) {
 #if !USE_WHD
     return lump->size;
 #else
+    if (lump_sizes) return lump_sizes[lump - lump_offsets]; // data isn't in lump order
     return ((lump[1] - lump[0])&0xffffffu) - (lump[0]>>30); // just the address of the next minus this one (argh i guess we mauy have alignment issues)
 #endif
 }
@@ -515,6 +518,74 @@ should_be_const void *W_CacheLumpNum(lumpindex_t lumpnum, int tag)
 #endif
     return result;
 }
+#elif PRINT_TOUCHED_LUMPS
+// there is no lumpinfo to mark touched here, so instead lumps.txt gets a line per frame listing the lumps touched since
+// the previous one, in the order they were first touched, followed by the patch columns drawn, e.g.
+// "frame 12: 1201 1202 988 1201:17 1201:18". this is the access trace for whd_gen -order. note this isn't thread safe,
+// so capture with a single render thread
+static uint8_t *touched_this_frame;
+static lumpindex_t *touched_order;
+static int touched_count;
+#define TOUCHED_COLUMN_HASH_SIZE 4096
+static uint32_t touched_column_hash[TOUCHED_COLUMN_HASH_SIZE]; // (lumpnum << 9 | col) + 1, or 0 for empty
+static uint32_t touched_columns[TOUCHED_COLUMN_HASH_SIZE / 2]; // in the order first touched
+static int touched_column_count;
+
+void W_TouchLump(lumpindex_t lumpnum)
+{
+    if (!touched_this_frame)
+    {
+        touched_this_frame = calloc(numlumps, 1);
+        touched_order = malloc(numlumps * sizeof(lumpindex_t));
+    }
+    if ((unsigned)lumpnum < numlumps && !touched_this_frame[lumpnum])
+    {
+        touched_this_frame[lumpnum] = 1;
+        touched_order[touched_count++] = lumpnum;
+    }
+}
+
+void W_TouchLumpColumn(lumpindex_t lumpnum, int col)
+{
+    uint32_t entry = ((uint32_t)lumpnum << 9) | col;
+    uint h = (entry * 2654435761u) >> 20;
+
+    while (touched_column_hash[h])
+    {
+        if (touched_column_hash[h] == entry + 1) return;
+        h = (h + 1) & (TOUCHED_COLUMN_HASH_SIZE - 1);
+    }
+    // keep the hash table at most half full; any more columns this frame are just left out
+    if (touched_column_count < TOUCHED_COLUMN_HASH_SIZE / 2)
+    {
+        touched_column_hash[h] = entry + 1;
+        touched_columns[touched_column_count++] = entry;
+    }
+}
+
+void W_EndTouchedLumpsFrame(void)
+{
+    static int frame;
+    static FILE *f;
+    if (!f) {
+        f = fopen("lumps.txt", "w");
+    }
+    fprintf(f, "frame %d:", frame++);
+    for (int i = 0; i < touched_count; i++)
+    {
+        fprintf(f, " %d", touched_order[i]);
+        touched_this_frame[touched_order[i]] = 0;
+    }
+    for (int i = 0; i < touched_column_count; i++)
+    {
+        fprintf(f, " %d:%d", (int)(touched_columns[i] >> 9), (int)(touched_columns[i] & 0x1ff));
+    }
+    memset(touched_column_hash, 0, sizeof(touched_column_hash));
+    touched_column_count = 0;
+    fprintf(f, "\n");
+    fflush(f);
+    touched_count = 0;
+}
 #endif
 
 
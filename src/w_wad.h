@@ -104,8 +104,17 @@ static inline should_be_const uint8_t *lump_data(const lumpinfo_t *lump) {
 #if !DOOM_TINY
 should_be_const void *W_CacheLumpNum(lumpindex_t lump, int tag);
 #else
+#if PRINT_TOUCHED_LUMPS
+void W_TouchLump(lumpindex_t lumpnum);
+// a column of a patch lump drawn this frame (for laying out the column data within patches)
+void W_TouchLumpColumn(lumpindex_t lumpnum, int col);
+void W_EndTouchedLumpsFrame(void);
+#endif
 static inline should_be_const void *W_CacheLumpNum(lumpindex_t lumpnum, int tag)
 {
+#if PRINT_TOUCHED_LUMPS
+    W_TouchLump(lumpnum);
+#endif
     return lump_data(lump_info(lumpnum));
 }
 #endif
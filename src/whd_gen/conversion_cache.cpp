@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <cstdio>
+#include <cerrno>
+#include <sstream>
+#include <thread>
+#include <functional>
+#include <sys/stat.h>
+#include "conversion_cache.h"
+#include "doomtype.h"
+extern "C" {
+#include "sha1.h"
+}
+
+void conversion_cache::open(const std::string &dir_, const std::string &options_) {
+#ifdef _WIN32
+    int rc = mkdir(dir_.c_str());
+#else
+    int rc = mkdir(dir_.c_str(), 0777);
+#endif
+    if (rc && errno != EEXIST) {
+        fail("Unable to create cache directory %s", dir_.c_str());
+    }
+    dir = dir_;
+    options = options_;
+}
+
+std::string conversion_cache::entry_name(const char *category, const std::vector<uint8_t> &input,
+                                         const std::string &variant) const {
+    sha1_context_t context;
+    sha1_digest_t digest;
+    SHA1_Init(&context);
+    SHA1_UpdateString(&context, (char *)category);
+    SHA1_UpdateInt32(&context, WHD_CACHE_VERSION);
+    SHA1_UpdateString(&context, (char *)options.c_str());
+    if (!variant.empty()) SHA1_UpdateString(&context, (char *)variant.c_str());
+    SHA1_UpdateInt32(&context, input.size());
+    SHA1_Update(&context, (byte *)input.data(), input.size());
+    SHA1_Final(digest, &context);
+    char hex[sizeof(digest) * 2 + 1];
+    for (int i = 0; i < (int)sizeof(digest); i++) {
+        sprintf(hex + i * 2, "%02x", digest[i]);
+    }
+    return dir + "/" + hex;
+}
+
+bool conversion_cache::lookup(const char *category, const std::string &name, std::vector<uint8_t> &output) {
+    FILE *in = fopen(name.c_str(), "rb");
+    uint32_t us = 0;
+    bool hit = false;
+    if (in) {
+        fseek(in, 0, SEEK_END);
+        long size = ftell(in);
+        fseek(in, 0, SEEK_SET);
+        if (size >= 4 && 1 == fread(&us, 4, 1, in)) {
+            std::vector<uint8_t> data(size - 4);
+            hit = data.empty() || 1 == fread(data.data(), data.size(), 1, in);
+            if (hit) output = std::move(data);
+        }
+        fclose(in);
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &s = stats[category];
+    if (hit) {
+        s.hits++;
+        s.saved_us += us;
+    } else {
+        s.misses++;
+    }
+    return hit;
+}
+
+void conversion_cache::store(const char *category, const std::string &name, const std::vector<uint8_t> &output, uint32_t us) {
+    // write to a temporary file and rename it, so a reader never sees a partial entry
+    std::ostringstream tmp_name;
+    tmp_name << name << ".tmp" << std::hash<std::thread::id>()(std::this_thread::get_id());
+    FILE *out = fopen(tmp_name.str().c_str(), "wb");
+    bool ok = out && 1 == fwrite(&us, 4, 1, out);
+    if (ok && !output.empty()) ok = 1 == fwrite(output.data(), output.size(), 1, out);
+    if (out && fclose(out)) ok = false;
+    if (!ok || rename(tmp_name.str().c_str(), name.c_str())) {
+        // not fatal, we just won't have it next time
+        remove(tmp_name.str().c_str());
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    stats[category].converted_us += us;
+}
+
+void conversion_cache::print_report() {
+    if (!is_open()) return;
+    printf("CACHE %s\n", dir.c_str());
+    uint64_t total_saved_us = 0;
+    for (const auto &e : stats) {
+        printf("%20s: hits %d/%d saved %.2fs converted %.2fs\n", e.first.c_str(), e.second.hits,
+               e.second.hits + e.second.misses, e.second.saved_us / 1e6, e.second.converted_us / 1e6);
+        total_saved_us += e.second.saved_us;
+    }
+    printf("%20s: saved %.2fs\n", "total", total_saved_us / 1e6);
+}
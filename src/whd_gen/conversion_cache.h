@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <chrono>
+
+// bump this whenever the output of one of the cached conversions changes (or they start depending on something
+// other than the lump data and the options passed to open())
+#define WHD_CACHE_VERSION 1
+
+/**
+ * On disk cache of conversions which depend only on the contents of a single lump (patches, flats, sounds, music).
+ *
+ * Each entry is a file in the cache directory named by the SHA-1 of the converter category, WHD_CACHE_VERSION,
+ * the conversion options, any per lump variant and the input lump data. The file holds the time the conversion
+ * originally took, followed by the converted data. Entries are never updated in place, so several whd_gen may share
+ * a cache.
+ *
+ * Safe to call from parallel conversion jobs.
+ */
+struct conversion_cache {
+    // enable the cache, storing entries in dir (which is created if necessary)
+    void open(const std::string &dir, const std::string &options);
+    bool is_open() const { return !dir.empty(); }
+
+    /**
+     * Convert input into output (which may be the same vector), taking the result from the cache if possible.
+     *
+     * Otherwise, convert() is called to fill in output; it returns false if the lump couldn't be converted,
+     * in which case nothing is cached and false is returned.
+     *
+     * variant is anything else specific to this lump which the conversion depends on
+     */
+    template<typename F> bool convert(const char *category, const std::vector<uint8_t> &input,
+                                      std::vector<uint8_t> &output, F convert, const std::string &variant = "") {
+        if (!is_open()) return convert();
+        std::string name = entry_name(category, input, variant);
+        if (lookup(category, name, output)) return true;
+        auto t0 = std::chrono::steady_clock::now();
+        if (!convert()) return false;
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+        store(category, name, output, (uint32_t)us);
+        return true;
+    }
+
+    // print hits and time saved for each category
+    void print_report();
+
+private:
+    struct category_stats {
+        int hits = 0, misses = 0;
+        uint64_t saved_us = 0, converted_us = 0;
+    };
+
+    std::string entry_name(const char *category, const std::vector<uint8_t> &input, const std::string &variant) const;
+    bool lookup(const char *category, const std::string &name, std::vector<uint8_t> &output);
+    void store(const char *category, const std::string &name, const std::vector<uint8_t> &output, uint32_t us);
+
+    std::string dir;
+    std::string options;
+    std::mutex mutex;
+    std::map<std::string, category_stats> stats;
+};
@@ -0,0 +1,173 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <cstdio>
+#include <chrono>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include "decode_cost.h"
+#include "doomtype.h"
+#include "image_decoder.h"
+
+const decode_cost_model default_decode_cost_model = {
+        .decoder_ns = { 245, 1150 },
+        .pixel_ns = { 8.9, 11.1 },
+        .table_ns = { 690, 750 },
+};
+
+// there is no way to run -calibrate-decode on the device, so these are cycle counts for the Thumb code of the
+// decoders (running from RAM, with the patch data in the XIP cache) at 270MHz. for a typical patch of ~60 colors:
+//   prefix length table: 256 entries at ~8 cycles, plus the memset:                    ~2400 cycles
+//   raw table: 32 + 8 per used group of presence bits at ~10 cycles, plus ~25 per
+//     symbol, then th_create_decoder at ~35 per symbol:                                ~5100 cycles
+//   min/max table: as raw, but with a presence bit per value in the range; that is
+//     data dependent, so it is taken to be the ~8% longer measured on the host:        ~5500 cycles
+//   c3: a raw table plus the 7 delta lengths, th_create_decoder_16 and the prefix
+//     length table:                                                                    ~7800 cycles
+//   a pixel: th_decode_table_special ~33 cycles, th_decode_table_special_16 plus the
+//     delta ~39 cycles
+// the decoders have no branch prediction to lose on the device, so decoding a pixel is cheap compared to building a
+// decoder, relative to the host
+const decode_cost_model rp2040_decode_cost_model = {
+        .decoder_ns = { 8900, 28900 },
+        .pixel_ns = { 12.2, 14.4 },
+        .table_ns = { 18900, 20400 },
+};
+
+void decode_cost_model::read(const std::string &filename) {
+    std::ifstream in(filename);
+    if (!in) fail("Unable to read decode cost model %s", filename.c_str());
+    bool found[PATCH_ENCODING_COUNT] = {};
+    bool found_table[HUFFMAN_TABLE_COUNT] = {};
+    std::string line;
+    while (std::getline(in, line)) {
+        int encoding, table;
+        double d, p;
+        if (3 == sscanf(line.c_str(), "encoding %d decoder_ns %lf pixel_ns %lf", &encoding, &d, &p) &&
+            encoding >= 0 && encoding < PATCH_ENCODING_COUNT) {
+            decoder_ns[encoding] = d;
+            pixel_ns[encoding] = p;
+            found[encoding] = true;
+        } else if (2 == sscanf(line.c_str(), "table %d ns %lf", &table, &d) &&
+                   table >= 0 && table < HUFFMAN_TABLE_COUNT) {
+            table_ns[table] = d;
+            found_table[table] = true;
+        }
+    }
+    if (std::count(found, found + PATCH_ENCODING_COUNT, true) != PATCH_ENCODING_COUNT ||
+        std::count(found_table, found_table + HUFFMAN_TABLE_COUNT, true) != HUFFMAN_TABLE_COUNT) {
+        fail("Decode cost model %s doesn't cover every patch encoding and Huffman table format", filename.c_str());
+    }
+}
+
+std::string decode_cost_model::to_string() const {
+    std::ostringstream os;
+    for (int e = 0; e < PATCH_ENCODING_COUNT; e++) {
+        char line[128];
+        snprintf(line, sizeof(line), "encoding %d decoder_ns %.1f pixel_ns %.3f\n", e, decoder_ns[e], pixel_ns[e]);
+        os << line;
+    }
+    for (int t = 0; t < HUFFMAN_TABLE_COUNT; t++) {
+        char line[128];
+        snprintf(line, sizeof(line), "table %d ns %.1f\n", t, table_ns[t]);
+        os << line;
+    }
+    return os.str();
+}
+
+// best of this many runs, to avoid counting page faults, other jobs etc.
+#define CALIBRATION_RUNS 8
+static volatile uint32_t decoded_sink; // so the decode isn't optimized away
+
+void decode_cost_calibration::record(int encoding, const std::vector<uint8_t> &data, uint32_t pixels) {
+    using clock = std::chrono::steady_clock;
+    // the 32 bit refill may read a few bytes past the end
+    std::vector<uint8_t> padded(data);
+    padded.resize(data.size() + 8);
+    uint16_t decoder[512];
+    uint8_t tmp[1024];
+    uint8_t column[256];
+    uint32_t sink = 0;
+    double best_decoder_ns = 1e30, best_pixels_ns = 1e30, best_table_ns = 1e30;
+    int table = HUFFMAN_TABLE_RAW;
+    for (int run = 0; run < CALIBRATION_RUNS; run++) {
+        th_bit_input bi;
+        th_bit_input_init(&bi, padded.data());
+        // as in get_patch_decoder and get_patch_decoder_table
+        auto t0 = clock::now();
+        if (encoding == PATCH_ENCODING_PIXELS_ONLY) {
+            table = th_bit(&bi) ? HUFFMAN_TABLE_MIN_MAX : HUFFMAN_TABLE_RAW;
+            if (table == HUFFMAN_TABLE_MIN_MAX) {
+                th_read_simple_decoder(&bi, decoder, count_of(decoder), tmp, count_of(tmp));
+            } else {
+                read_raw_pixels_decoder(&bi, decoder, count_of(decoder), tmp, count_of(tmp));
+            }
+        } else {
+            read_raw_pixels_decoder_c3(&bi, decoder, count_of(decoder), tmp, count_of(tmp));
+        }
+        auto t_table = clock::now();
+        th_make_prefix_length_table(decoder, tmp);
+        auto t1 = clock::now();
+        // as in decode_patch_column; the columns follow on from each other
+        if (encoding == PATCH_ENCODING_PIXELS_ONLY) {
+            for (uint32_t i = 0; i < pixels; i++) {
+                column[i & 0xff] = th_decode_table_special(decoder, tmp, &bi);
+            }
+        } else {
+            for (uint32_t i = 0; i < pixels; i++) {
+                uint16_t p = th_decode_table_special_16(decoder, tmp, &bi);
+                column[i & 0xff] = p < 256 ? p : column[(i - 1) & 0xff] + (p & 0xff) - 3;
+            }
+        }
+        auto t2 = clock::now();
+        sink += column[0];
+        if (encoding == PATCH_ENCODING_PIXELS_ONLY) {
+            // the table is accounted for separately
+            best_table_ns = std::min(best_table_ns, (double)std::chrono::nanoseconds(t_table - t0).count());
+            best_decoder_ns = std::min(best_decoder_ns, (double)std::chrono::nanoseconds(t1 - t_table).count());
+        } else {
+            best_decoder_ns = std::min(best_decoder_ns, (double)std::chrono::nanoseconds(t1 - t0).count());
+        }
+        best_pixels_ns = std::min(best_pixels_ns, (double)std::chrono::nanoseconds(t2 - t1).count());
+    }
+    decoded_sink = sink;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &t = encodings[encoding];
+    t.patches++;
+    t.pixels += pixels;
+    t.decoder_ns += best_decoder_ns;
+    t.pixels_ns += best_pixels_ns;
+    if (encoding == PATCH_ENCODING_PIXELS_ONLY) {
+        tables[table].patches++;
+        tables[table].decoder_ns += best_table_ns;
+    }
+}
+
+decode_cost_model decode_cost_calibration::fit() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    decode_cost_model model = default_decode_cost_model;
+    for (int e = 0; e < PATCH_ENCODING_COUNT; e++) {
+        const auto &t = encodings[e];
+        if (t.patches) model.decoder_ns[e] = t.decoder_ns / t.patches;
+        if (t.pixels) model.pixel_ns[e] = t.pixels_ns / t.pixels;
+    }
+    for (int f = 0; f < HUFFMAN_TABLE_COUNT; f++) {
+        const auto &t = tables[f];
+        if (t.patches) model.table_ns[f] = t.decoder_ns / t.patches;
+    }
+    return model;
+}
+
+void decode_cost_calibration::write(const std::string &filename) const {
+    FILE *out = fopen(filename.c_str(), "w");
+    if (!out) fail("Unable to write decode cost model %s", filename.c_str());
+    std::string model = fit().to_string();
+    fprintf(out, "# whd_gen -calibrate-decode: host ns to build a patch's decoder, and per pixel decoded, then to read each "
+                 "Huffman table format\n%s", model.c_str());
+    fclose(out);
+    printf("DECODE COST MODEL (%d+%d patches, %d+%d tables) written to %s\n%s", encodings[0].patches,
+           encodings[1].patches, tables[0].patches, tables[1].patches, filename.c_str(), model.c_str());
+}
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+
+// patch encodings, as written in the first bit of the patch decoder (see get_patch_decoder in pd_render.cpp)
+#define PATCH_ENCODING_PIXELS_ONLY 0 // consider_compress_pixels_only
+#define PATCH_ENCODING_C3 1 // consider_compress3
+#define PATCH_ENCODING_COUNT 2
+
+// Huffman code table formats, as written in the first bit of the table (see decode_data in image_decoder.c)
+#define HUFFMAN_TABLE_RAW 0 // output_raw_pixels, read by read_raw_pixels_decoder
+#define HUFFMAN_TABLE_MIN_MAX 1 // output_min_max_best, read by th_read_simple_decoder
+#define HUFFMAN_TABLE_COUNT 2
+
+/**
+ * Model of the time taken to decode a patch at runtime, for each patch encoding: building the decoder
+ * (including the prefix length table) plus a cost per decoded pixel. PATCH_ENCODING_PIXELS_ONLY may use either
+ * Huffman table format, so reading its table isn't included in decoder_ns, but is in table_ns for the format.
+ *
+ * The figures are in ns running the real image_decoder.c/tiny_huff.c decoders; only their relative sizes really
+ * matter, since -decode-weight is in bytes per us of whatever the model measures. The default is measured on the
+ * host, which weighs decoder building against pixel decoding rather differently to the device (see
+ * rp2040_decode_cost_model).
+ */
+struct decode_cost_model {
+    double decoder_ns[PATCH_ENCODING_COUNT];
+    double pixel_ns[PATCH_ENCODING_COUNT];
+    double table_ns[HUFFMAN_TABLE_COUNT];
+
+    // table is the Huffman table format, for PATCH_ENCODING_PIXELS_ONLY
+    double patch_us(int encoding, uint32_t pixels, int table = HUFFMAN_TABLE_RAW) const {
+        double ns = decoder_ns[encoding] + pixel_ns[encoding] * pixels;
+        if (encoding == PATCH_ENCODING_PIXELS_ONLY) ns += table_ns[table];
+        return ns / 1000;
+    }
+
+    double table_us(int table) const {
+        return table_ns[table] / 1000;
+    }
+
+    // read a model written by decode_cost_calibration::write; fails if it can't
+    void read(const std::string &filename);
+    std::string to_string() const;
+};
+
+// measured with -calibrate-decode on an x86-64 host
+extern const decode_cost_model default_decode_cost_model;
+// estimated from cycle counts of the decoders on the RP2040 at 270MHz (-decode-model rp2040)
+extern const decode_cost_model rp2040_decode_cost_model;
+
+/**
+ * Times the real decoders over the candidate encodings of each patch converted, to fit a decode_cost_model
+ * (-calibrate-decode).
+ *
+ * Safe to call from parallel conversion jobs, though the timings are steadier with -j 1.
+ */
+struct decode_cost_calibration {
+    // data is the patch decoder followed by its columns, as in the converted patch, decoding to pixels pixels
+    void record(int encoding, const std::vector<uint8_t> &data, uint32_t pixels);
+    decode_cost_model fit() const;
+    void write(const std::string &filename) const;
+
+private:
+    struct totals {
+        int patches = 0;
+        uint64_t pixels = 0;
+        double decoder_ns = 0, pixels_ns = 0;
+    };
+    totals encodings[PATCH_ENCODING_COUNT];
+    totals tables[HUFFMAN_TABLE_COUNT]; // only patches and decoder_ns are used
+    mutable std::mutex mutex;
+};
@@ -0,0 +1,41 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#include <cstdarg>
+#include "parallel.h"
+
+int whd_gen_threads = std::max(1u, std::thread::hardware_concurrency());
+std::mutex job_mutex;
+thread_local std::string *job_log;
+
+int job_printf(const char *fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    int rc;
+    if (job_log) {
+        va_list va2;
+        va_copy(va2, va);
+        rc = vsnprintf(nullptr, 0, fmt, va2);
+        va_end(va2);
+        if (rc > 0) {
+            size_t pos = job_log->size();
+            job_log->resize(pos + rc + 1);
+            vsnprintf(&(*job_log)[pos], rc + 1, fmt, va);
+            job_log->resize(pos + rc);
+        }
+    } else {
+        rc = vprintf(fmt, va);
+    }
+    va_end(va);
+    return rc;
+}
+
+void flush_job_log() {
+    if (job_log) {
+        fputs(job_log->c_str(), stdout);
+        job_log->clear();
+        job_log = nullptr;
+    }
+}
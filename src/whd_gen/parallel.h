@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2022 Graham Sanderson
+ *
+ * SPDX-License-Identifier: BSD-3-Clause
+ */
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+
+// number of threads used to convert independent lumps (-j N)
+extern int whd_gen_threads;
+
+// guards global state shared between conversion jobs which isn't internally locked (symbol_stats and the
+// compressed/name_required sets). none of it depends on the order jobs run in
+extern std::mutex job_mutex;
+
+// jobs print with job_printf, whose output on a worker thread is captured here, and printed when the job is committed,
+// so the log comes out in the same order as a serial run. anything printed with plain printf from a job may come out
+// of order
+extern thread_local std::string *job_log;
+int job_printf(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+// print anything captured by the current job straight away (e.g. before we exit from fail())
+void flush_job_log();
+
+/**
+ * Call encode(job) for every job, spread over whd_gen_threads threads, and commit(job) for each job on the calling
+ * thread in the order of the jobs vector, as soon as it (and all jobs before it) are encoded.
+ *
+ * encode must only touch the job itself and state that doesn't care about ordering (locked statistics etc.); anything
+ * which affects the output (updating the wad, touched, ...) belongs in commit. with a single thread this is exactly
+ * the serial encode/commit loop.
+ */
+template<typename J, typename E, typename C> void parallel_convert(std::vector<J> &jobs, E encode, C commit) {
+    int count = (int)jobs.size();
+    int threads = std::min(whd_gen_threads, count);
+    if (threads <= 1) {
+        for (auto &job : jobs) {
+            encode(job);
+            commit(job);
+        }
+        return;
+    }
+    std::vector<std::string> logs(count);
+    std::vector<std::exception_ptr> errors(count);
+    std::vector<bool> done(count);
+    std::atomic<int> next{0};
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&] {
+            for (int i; (i = next++) < count;) {
+                job_log = &logs[i];
+                try {
+                    encode(jobs[i]);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+                job_log = nullptr;
+                std::lock_guard<std::mutex> lock(mutex);
+                done[i] = true;
+                cond.notify_all();
+            }
+        });
+    }
+    std::exception_ptr error;
+    for (int i = 0; i < count && !error; i++) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return done[i]; });
+        }
+        fputs(logs[i].c_str(), stdout);
+        logs[i].clear();
+        error = errors[i];
+        if (!error) {
+            try {
+                commit(jobs[i]);
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+    }
+    // don't start any more jobs, and let the running ones finish before we unwind
+    next = count;
+    for (auto &w : workers) w.join();
+    if (error) std::rethrow_exception(error);
+}
+
@@ -6,13 +6,16 @@
 #pragma once
 #include <string>
 #include <algorithm>
+#include <mutex>
 
 struct statsomizer {
     const std::string name;
 
     explicit statsomizer(std::string name) : name(std::move(name)) { reset(); }
 
+    // may be called from conversion jobs running in parallel
     void record(int value) {
+        std::lock_guard<std::mutex> lock(mutex());
         total += value;
         min = std::min(min, value);
         max = std::max(max, value);
@@ -39,4 +42,10 @@ struct statsomizer {
 
     long total;
     int count, min, max;
+
+private:
+    static std::mutex &mutex() {
+        static std::mutex m;
+        return m;
+    }
 };
@@ -114,7 +114,8 @@ unsigned int W_LumpNameHash(const char *s)
     return result;
 }
 
-void wad::write_whd(const std::string &filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny) {
+void wad::write_whd(const std::string &filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny,
+                    const std::vector<std::vector<int>> &trace) {
     FILE *out = fopen(filename.c_str(), "wb");
     if (!out) throw std::invalid_argument(filename + " can't be opened for write");
 
@@ -183,40 +184,103 @@ void wad::write_whd(const std::string &filename, std::set<std::string> name_requ
         write_raw(out, &s);
     }
 #else
+    // the lump data is normally stored in lump order. given an access trace (whd_gen -order) the lumps are instead
+    // stored in the order they are first touched, so those used together share flash pages/XIP cache lines, followed
+    // by the untouched ones in lump order
+    std::vector<int> order;
+    std::vector<bool> placed(num_lumps);
+    for (const auto &frame : trace) {
+        for (int l : frame) {
+            if (l >= 0 && l < num_lumps && !placed[l] && lumps.find(l) != lumps.end()) {
+                placed[l] = true;
+                order.push_back(l);
+            }
+        }
+    }
+    int traced_lumps = order.size();
+    bool reordered = traced_lumps > 0;
+    for (const auto &e : lumps) {
+        if (!placed[e.first]) order.push_back(e.first);
+    }
     int base_data_offset = header.infotableofs + (num_lumps + 1) * sizeof(uint32_t) + name_count * 12;
-    int data_offset = base_data_offset;
-    int num = 0;
-    for(const auto &e : lumps) {
-        while (num < e.first) {
-            write_raw(out, &data_offset);
-            num++;
+    if (reordered) base_data_offset += num_lumps * sizeof(uint32_t); // explicit lump sizes
+    auto layout = [&](const std::vector<int> &lump_order, std::vector<uint32_t> &offsets) {
+        int data_offset = base_data_offset;
+        offsets.assign(num_lumps + 1, 0);
+        for (int n : lump_order) {
+            offsets[n] = data_offset;
+            data_offset += lumps[n].data.size();
+            data_offset = (data_offset + 3) &~3;
+        }
+        offsets[num_lumps] = data_offset;
+        // a lump number without a lump has the offset of the next one (so a size of 0 when in lump order)
+        for (int n = num_lumps - 1; n >= 0; n--) {
+            if (lumps.find(n) == lumps.end()) offsets[n] = offsets[n + 1];
+        }
+    };
+    std::vector<uint32_t> offsets;
+    layout(order, offsets);
+    for (int num = 0; num < num_lumps; num++) {
+        uint32_t combined = offsets[num];
+        auto it = lumps.find(num);
+        if (it != lumps.end()) {
+            int size = it->second.data.size();
+            combined |= ((4 -size) << 30); // store amount to substract off word aligned size to get real size in two high bits
         }
-        const auto& l = e.second;
-        int size = l.data.size();
-        uint32_t combined = data_offset | ((4 -size) << 30); // store amount to substract off word aligned size to get real size in two high bits
         write_raw(out, &combined);
-        data_offset += size;
-        data_offset = (data_offset + 3) &~3;
-        num++;
+    }
+    uint32_t end_marker = offsets[num_lumps] | (reordered ? WHD_LUMP_SIZES_PRESENT : 0);
+    write_raw(out, &end_marker);
+    if (reordered) {
+        // how many distinct 4K flash pages each traced frame touches, compared with the usual lump order
+        std::vector<int> lump_order;
+        for (const auto &e : lumps) lump_order.push_back(e.first);
+        std::vector<uint32_t> lump_order_offsets;
+        layout(lump_order, lump_order_offsets);
+        auto pages_per_frame = [&](const std::vector<uint32_t> &offs) {
+            uint64_t total = 0;
+            for (const auto &frame : trace) {
+                std::set<uint32_t> pages;
+                for (int l : frame) {
+                    if (l < 0 || l >= num_lumps || lumps.find(l) == lumps.end() || lumps[l].data.empty()) continue;
+                    for (uint32_t p = offs[l] / 4096; p <= (offs[l] + lumps[l].data.size() - 1) / 4096; p++) {
+                        pages.insert(p);
+                    }
+                }
+                total += pages.size();
+            }
+            return total / (double)trace.size();
+        };
+        printf("WHD ORDER %d/%d lumps placed from a trace of %d frames; 4K flash pages touched per frame %.1f -> %.1f\n",
+               traced_lumps, (int)lumps.size(), (int)trace.size(), pages_per_frame(lump_order_offsets),
+               pages_per_frame(offsets));
     }
 #endif
-    write_raw(out, &data_offset);
     for(const auto &s : name_required_lower) {
         std::vector<uint8_t> n(10);
         strncpy((char *)n.data(), s.c_str(), 8);
         write_raw(out, n);
         int16_t lnum = get_lump_index(s);
 //        printf("%s %d\n", s.c_str(), lnum);
-        assert(num >= 0);
+        assert(lnum >= 0);
         write_raw(out, &lnum);
     }
+    if (reordered) {
+        for (int num = 0; num < num_lumps; num++) {
+            auto it = lumps.find(num);
+            uint32_t size = it == lumps.end() ? 0 : it->second.data.size();
+            write_raw(out, &size);
+        }
+    }
     printf("WHD LUMP METADATA %d (%dK)\n", (int)ftell(out), (((int)ftell(out))+512)/1024);
 
     assert(ftell(out) == base_data_offset);
-    for(const auto &e : lumps) {
-        if (e.second.data.size()) {
-            write_raw(out, e.second.data);
-            for(int i=e.second.data.size() & 3; i && i < 4; i++) {
+    for(int n : order) {
+        const auto &data = lumps[n].data;
+        if (data.size()) {
+            assert(ftell(out) == (long)offsets[n]);
+            write_raw(out, data);
+            for(int i=data.size() & 3; i && i < 4; i++) {
                 fputc(0, out);
             }
         }
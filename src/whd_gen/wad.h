@@ -41,7 +41,9 @@ struct wad {
     }
     static wad read(const std::string& filename);
     void write(const std::string& filename);
-    void write_whd(const std::string& filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny);
+    // trace is the lumps touched in each frame, as read from an access trace by whd_gen -order, if any
+    void write_whd(const std::string& filename, std::set<std::string> name_required, uint32_t hash, bool super_tiny,
+                   const std::vector<std::vector<int>> &trace = {});
 
     std::map<int, lump>& get_lumps() {
         return lumps;
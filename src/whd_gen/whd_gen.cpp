@@ -10,6 +10,8 @@
 #include <functional>
 #include <cstring>
 #include <cassert>
+#include <fstream>
+#include <sstream>
 #include <memory>
 #include <cstdarg>
 #include <array>
@@ -44,14 +46,40 @@ bool super_tiny = true;
 using std::vector;
 
 template<typename T, typename S> std::ostream &operator<<(std::ostream &os, const std::pair<T, S> &v);
+#include "parallel.h"
+#include "conversion_cache.h"
+#include "decode_cost.h"
 #include "huffman.h"
 #include "huff.h"
 #include "huff_sink.h"
 
-int dumped_patch_count, converted_patch_count, converted_patch_size;
-int bit_addressable_patch;
-std::vector<int> winners(16);
-std::vector<int> fwinners(4);
+conversion_cache whd_cache;
+
+// -decode-weight: bytes of flash we'll spend on a patch to save 1us (on the host) decoding it each frame. 0 means
+// always pick the smallest encoding
+static double decode_weight;
+static decode_cost_model decode_model = default_decode_cost_model;
+static std::unique_ptr<decode_cost_calibration> decode_calibration; // -calibrate-decode
+// from the -order trace: the number of frames each lump was touched in
+static std::vector<int> lump_frame_counts;
+static int traced_frames;
+// from the -order trace: the columns of each patch lump in the order they were first drawn
+static std::map<int, std::vector<int>> traced_patch_columns;
+
+// the fraction of traced frames a lump is used in; without a trace every lump is considered hot
+static double lump_hotness(int num) {
+    if (!traced_frames) return 1;
+    return num >= 0 && num < (int)lump_frame_counts.size() ? lump_frame_counts[num] / (double)traced_frames : 0;
+}
+
+// these are updated by conversion jobs which may run in parallel
+std::atomic<int> dumped_patch_count, converted_patch_count, converted_patch_size;
+std::atomic<int> bit_addressable_patch;
+std::atomic<int> reordered_column_patch;
+std::vector<std::atomic<int>> winners(16);
+std::vector<std::atomic<int>> fwinners(4);
+std::atomic<int> decode_weighted_patches, decode_weighted_bytes; // not the smallest encoding because of -decode-weight
+int decode_weighted_textures, decode_weighted_texture_bytes; // composite textures rendered as a patch because of -decode-weight
 std::set<int> all_linedef_flags;
 
 statsomizer flat_have_same_savings("Flat same savings");
@@ -718,6 +746,7 @@ const anim_range_t tex_animdefs[] = {
 };
 
 void __attribute__((noreturn)) fail(const char *msg, ...) {
+    flush_job_log();
     va_list va;
     va_start(va, msg);
     vprintf(msg, va);
@@ -769,7 +798,41 @@ T get_field_inc(const std::vector<uint8_t> &data, int &offset) {
 }
 
 static void usage() {
-    throw std::invalid_argument("usage: whd_gen <wad_in> <whd_out>");
+    throw std::invalid_argument("usage: whd_gen <wad_in> <whd_out> [-no-super-tiny] [-j <threads>] [-cache <dir>] [-order <lumps.txt>] "
+                                "[-decode-weight <bytes per us>] [-decode-model <file>|rp2040] [-calibrate-decode <file>]");
+}
+
+// read the lumps touched in each frame from an access trace written by a PRINT_TOUCHED_LUMPS build, i.e. lines of
+// "frame <n>: <lump> <lump> ... <lump>:<col> ...", the latter being patch columns drawn, which are added to
+// traced_patch_columns. the older one line per first touch "<lump> (...)" is read as a single frame
+static std::vector<std::vector<int>> read_lump_trace(const char *filename) {
+    std::ifstream in(filename);
+    if (!in) fail("Unable to read lump trace %s", filename);
+    std::vector<std::vector<int>> frames;
+    std::map<int, std::set<int>> columns_seen;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.compare(0, 5, "frame")) {
+            auto colon = line.find(':');
+            if (colon == std::string::npos) fail("Bad lump trace line: %s", line.c_str());
+            frames.emplace_back();
+            std::istringstream tokens(line.substr(colon + 1));
+            for (std::string t; tokens >> t;) {
+                int l = atoi(t.c_str());
+                auto col_colon = t.find(':');
+                if (col_colon == std::string::npos) {
+                    frames.back().push_back(l);
+                } else {
+                    int col = atoi(t.c_str() + col_colon + 1);
+                    if (columns_seen[l].insert(col).second) traced_patch_columns[l].push_back(col);
+                }
+            }
+        } else if (!line.empty() && isdigit(line[0])) {
+            if (frames.empty()) frames.emplace_back();
+            frames.back().push_back(atoi(line.c_str()));
+        }
+    }
+    return frames;
 }
 
 std::set<std::string> music_lumpnames = {
@@ -1073,8 +1136,8 @@ std::vector<int16_t> unpack_patch(lump &patch) {
     return pixels;
 }
 
-int opaque_pixels;
-int transparent_pixels;
+std::atomic<int> opaque_pixels;
+std::atomic<int> transparent_pixels;
 std::vector<std::vector<uint8_t>> to_merged_posts(const std::vector<int16_t>& pix, uint width, uint height, std::vector<int>& same, bool& have_same) {
     std::vector<std::vector<uint8_t>> merged_posts(width);
     same.clear();
@@ -1105,18 +1168,21 @@ std::vector<std::vector<uint8_t>> to_merged_posts(const std::vector<int16_t>& pi
         }
     }
 #endif
+    int opaque = 0, transparent = 0;
     for(int x=0;x<(int)width;x++) {
         if (!same[x]) {
             for(int y = 0; y < (int)(width * height); y += width) {
                 if (pix[x+y]>=0) {
                     merged_posts[x].push_back(pix[x+y]);
-                    opaque_pixels++;
+                    opaque++;
                 } else {
-                    transparent_pixels++;
+                    transparent++;
                 }
             }
         }
     }
+    opaque_pixels += opaque;
+    transparent_pixels += transparent;
     return merged_posts;
 }
 
@@ -1338,6 +1404,28 @@ std::ostream &operator<<(std::ostream &os, const std::pair<T, S> &v) {
     return os;
 }
 
+// write the Huffman code table for huff in whichever format (see decode_data in image_decoder.c) is smallest, plus weight
+// bytes for each us the decode model says it takes to read; returns the HUFFMAN_TABLE_ format chosen
+template<typename H>
+int output_huffman_table(std::shared_ptr<byte_vector_bit_output> &output, huffman_encoding<uint8_t, H> &huff, double weight) {
+    auto bo2 = std::make_shared<byte_vector_bit_output>();
+    output_raw_pixels(bo2, huff);
+    auto bo3 = std::make_shared<byte_vector_bit_output>();
+    output_min_max_best(bo3, huff);
+    //printf( "      bo2 %u bo3 %u\n", bo2->bit_size(), bo3->bit_size());
+    double raw_cost = bo2->bit_size() / 8.0 + weight * decode_model.table_us(HUFFMAN_TABLE_RAW);
+    double min_max_cost = bo3->bit_size() / 8.0 + weight * decode_model.table_us(HUFFMAN_TABLE_MIN_MAX);
+    if (raw_cost < min_max_cost) {
+        output->write(bit_sequence(HUFFMAN_TABLE_RAW, 1));
+        bo2->write_to(output);
+        return HUFFMAN_TABLE_RAW;
+    } else {
+        output->write(bit_sequence(HUFFMAN_TABLE_MIN_MAX, 1));
+        bo3->write_to(output);
+        return HUFFMAN_TABLE_MIN_MAX;
+    }
+}
+
 uint consider_compress3(const std::string& name, const std::vector<std::vector<uint8_t>>& posts,
                         std::shared_ptr<byte_vector_bit_output>& decoder_output, std::vector<std::shared_ptr<byte_vector_bit_output>>& zposts,
                         uint width, uint height, uint& decoder_size) {
@@ -1384,12 +1472,12 @@ uint consider_compress3(const std::string& name, const std::vector<std::vector<u
         if (!pass) {
             if (color_change_count == 0) { // very pointless but CYAN in doom2 is this
                 // this is simpler than adding special case in the decode
-                printf("warning: zero colors for compression, adding some dummies\n");
+                job_printf("warning: zero colors for compression, adding some dummies\n");
                 sink.output(std::make_pair(false, 0));
                 sink.output(std::make_pair(false, 1));
             } else if (color_change_count == 1) {
                 // this is simpler than adding special case in the decode
-                printf("warning: only one color for compression, adding a dummy\n");
+                job_printf("warning: only one color for compression, adding a dummy\n");
                 sink.output(std::make_pair(false, (uint8_t)(last_color + 1)));
             }
 
@@ -1446,7 +1534,7 @@ uint consider_compress3(const std::string& name, const std::vector<std::vector<u
         if (!std::equal(post.begin(), post.end(), posts[x].begin(), posts[x].end())) {
             if (post.size() == posts[x].size()) {
                 for(int i=0;i<(int)post.size();i++) {
-                    printf("%d %02x %02x %c\n", i, posts[x][i], post[i], posts[x][i] != post[i] ? '*' : ' ');
+                    job_printf("%d %02x %02x %c\n", i, posts[x][i], post[i], posts[x][i] != post[i] ? '*' : ' ');
                 }
             }
             fail("Post mismatcher %d %d vs %d\n", x, (int)post.size(), (int)posts[x].size());
@@ -1459,8 +1547,10 @@ uint consider_compress3(const std::string& name, const std::vector<std::vector<u
     return result.size();
 }
 
+// weight is in bytes per us of decode time, for the choice of Huffman table format, which is returned in table_out
 uint consider_compress_pixels_only(const std::string& name, const std::vector<std::vector<uint8_t>>& posts,
-                                   std::shared_ptr<byte_vector_bit_output>& decoder_output, std::vector<std::shared_ptr<byte_vector_bit_output>>& zposts, uint width, uint height, uint& decoder_size_out) {
+                                   std::shared_ptr<byte_vector_bit_output>& decoder_output, std::vector<std::shared_ptr<byte_vector_bit_output>>& zposts, uint width, uint height, uint& decoder_size_out,
+                                   double weight = 0, int *table_out = nullptr) {
     symbol_sink<huffman_params<uint8_t>> raw_pixel_sink("Raw Pixel");
     sink_wrappers<std::shared_ptr<byte_vector_bit_output>> wrappers{raw_pixel_sink};
 
@@ -1489,27 +1579,17 @@ uint consider_compress_pixels_only(const std::string& name, const std::vector<st
         if (!pass) {
             if (color_change_count == 0) { // very pointless but CYAN in doom2 is this
                 // this is simpler than adding special case in the decode
-                printf("warning: zero colors for compression, adding some dummies");
+                job_printf("warning: zero colors for compression, adding some dummies");
                 raw_pixel_sink.output(0);
                 raw_pixel_sink.output(1);
             } else if (color_change_count == 1) {
                 // this is simpler than adding special case in the decode
-                printf("warning: only one color for compression, adding a dummy");
+                job_printf("warning: only one color for compression, adding a dummy");
                 raw_pixel_sink.output(last_color + 1);
             }
             wrappers.begin_output(decoder_output);
-            auto bo2 = std::make_shared<byte_vector_bit_output>();
-            output_raw_pixels(bo2, raw_pixel_sink.huff);
-            auto bo3 = std::make_shared<byte_vector_bit_output>();
-            output_min_max_best(bo3, raw_pixel_sink.huff);
-            //printf( "      bo2 %u bo3 %u\n", bo2->bit_size(), bo3->bit_size());
-            if (bo2->bit_size() < bo3->bit_size()) {
-                decoder_output->write(bit_sequence(0, 1));
-                bo2->write_to(decoder_output);
-            } else {
-                decoder_output->write(bit_sequence(1, 1));
-                bo3->write_to(decoder_output);
-            }
+            int table = output_huffman_table(decoder_output, raw_pixel_sink.huff, weight);
+            if (table_out) *table_out = table;
         }
     }
 
@@ -1546,10 +1626,10 @@ uint consider_compress_pixels_only(const std::string& name, const std::vector<st
             post.push_back(pix);
         }
         if (!std::equal(post.begin(), post.end(), posts[x].begin(), posts[x].end())) {
-            printf("Post mismatcher %d %d vs %d\n", x, (int)post.size(), (int)posts[x].size());
+            job_printf("Post mismatcher %d %d vs %d\n", x, (int)post.size(), (int)posts[x].size());
             if (post.size() == posts[x].size()) {
                 for(int i=0;i<(int)post.size();i++) {
-                    printf("%d %02x %02x %c\n", i, posts[x][i], post[i], posts[x][i] != post[i] ? '*' : ' ');
+                    job_printf("%d %02x %02x %c\n", i, posts[x][i], post[i], posts[x][i] != post[i] ? '*' : ' ');
                 }
             }
         }
@@ -1560,8 +1640,9 @@ uint consider_compress_pixels_only(const std::string& name, const std::vector<st
     return result.size();
 }
 
+// weight is in bytes per us of decode time, for the choice of Huffman table format
 uint consider_compress_data(const std::string& name, std::vector<uint8_t>& input,
-                                   std::shared_ptr<byte_vector_bit_output>& output) {
+                                   std::shared_ptr<byte_vector_bit_output>& output, double weight = 0) {
     symbol_sink<huffman_params<uint8_t>> byte_sink("Raw Data");
     sink_wrappers<std::shared_ptr<byte_vector_bit_output>> wrappers{byte_sink};
 
@@ -1572,17 +1653,7 @@ uint consider_compress_data(const std::string& name, std::vector<uint8_t>& input
         }
         if (!pass) {
             wrappers.begin_output(output);
-            auto bo2 = std::make_shared<byte_vector_bit_output>();
-            output_raw_pixels(bo2, byte_sink.huff);
-            auto bo3 = std::make_shared<byte_vector_bit_output>();
-            output_min_max_best(bo3, byte_sink.huff);
-            if (bo2->bit_size() < bo3->bit_size()) {
-                output->write(bit_sequence(0, 1));
-                bo2->write_to(output);
-            } else {
-                output->write(bit_sequence(1, 1));
-                bo3->write_to(output);
-            }
+            output_huffman_table(output, byte_sink.huff, weight);
         }
     }
 
@@ -1655,7 +1726,8 @@ const uint8_t bitcount8_table[256] = {
         8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8, 8,
         };
 
-void convert_patch(wad &wad, int num, lump &patch) {
+// the part of convert_patch which only depends on the patch itself, so can be run as a parallel job
+void encode_patch(wad &wad, int num, lump &patch) {
     dump_patch(patch.name.c_str(), num, patch);
     auto ph = get_field<patch_header>(patch.data, 0);
     auto pix = unpack_patch(patch);
@@ -1800,33 +1872,55 @@ for(int y=0;y<ph.height-1;y++) {
 #endif
     int choice = 0;
     uint best = std::numeric_limits<uint>::max();
+    uint smallest = best;
+    double best_cost = std::numeric_limits<double>::max();
     std::vector<std::shared_ptr<byte_vector_bit_output>> zposts;
     std::shared_ptr<byte_vector_bit_output> decoder_output;
     std::vector<std::shared_ptr<byte_vector_bit_output>> best_zposts;
     std::shared_ptr<byte_vector_bit_output> best_decoder_output;
     uint decoder_size;
-    uint best_decoder_size;
+    uint best_decoder_size = 0;
+    std::vector<int> same;
+    bool have_same;
+    auto posts = to_merged_posts(pix, ph.width, ph.height, same, have_same);
+    uint pixel_count = 0;
+    for (const auto &post : posts) pixel_count += post.size();
+    double weight = decode_weight * lump_hotness(num);
+    int table = HUFFMAN_TABLE_RAW; // Huffman table format for PATCH_ENCODING_PIXELS_ONLY
+    // smallest size, plus the weighted decode time of the encoding
     auto choose = [&](int c, uint size) {
-        if (size < best) {
+        if (decode_calibration) {
+            auto data = std::make_shared<byte_vector_bit_output>();
+            decoder_output->write_to(data);
+            for (auto &col_bo : zposts) {
+                col_bo->write_to(data);
+            }
+            decode_calibration->record(c, data->get_output(), pixel_count);
+        }
+        smallest = std::min(smallest, size);
+        double cost = size + weight * decode_model.patch_us(c, pixel_count, table);
+        if (cost < best_cost) {
             choice = c;
             best = size;
+            best_cost = cost;
             best_zposts = zposts;
             best_decoder_output = std::make_shared<byte_vector_bit_output>(*decoder_output);
             best_decoder_size = decoder_size;
         }
     };
-    std::vector<int> same;
-    bool have_same;
-    auto posts = to_merged_posts(pix, ph.width, ph.height, same, have_same);
     // i think 0 and 3 may be fine on their own
-    choose(0, consider_compress_pixels_only(patch.name, posts, decoder_output, zposts, ph.width, ph.height, decoder_size));
+    choose(PATCH_ENCODING_PIXELS_ONLY, consider_compress_pixels_only(patch.name, posts, decoder_output, zposts, ph.width, ph.height, decoder_size, weight, &table));
 #if !USE_PIXELS_ONLY_PATCH
-    choose(1, consider_compress3(patch.name, posts, decoder_output, zposts, ph.width, ph.height, decoder_size));
+    choose(PATCH_ENCODING_C3, consider_compress3(patch.name, posts, decoder_output, zposts, ph.width, ph.height, decoder_size));
     //choose(2, consider_compress_wtf(patch.name, posts, decoder_output, zposts, ph.width, ph.height));
     // todo put this back if we need 5K
 //    choose(3, consider_compress1(patch.name, posts, ph.width, ph.height, 2, 8));
 #endif
     winners[choice]++;
+    if (best != smallest) {
+        decode_weighted_patches++;
+        decode_weighted_bytes += best - smallest;
+    }
     cp_size.record(best);
     converted_patch_size += ph.width * ph.height;
 
@@ -1834,6 +1928,7 @@ for(int y=0;y<ph.height-1;y++) {
     // start with metadata without post pixels
     int full_or_same_column_count = 0;
     uint orig_meta_size = 0;
+    std::unique_lock<std::mutex> stats_lock(job_mutex); // for patch_run_stats
     for (int col = 0; col < ph.width; col++) {
         uint32_t col_offset = *(uint32_t *) (patch.data.data() + 8 + col * 4);
         const uint8_t *post = patch.data.data() + col_offset;
@@ -1857,6 +1952,7 @@ for(int y=0;y<ph.height-1;y++) {
             full_or_same_column_count++;
         }
     }
+    stats_lock.unlock();
 
     uint16_t w = ph.width;
     uint16_t h = ph.height;
@@ -1873,7 +1969,32 @@ for(int y=0;y<ph.height-1;y++) {
         return bitcount8_table[v];
     };
 
+    // store the columns in the order they were first drawn in the -order trace (if any), followed by the rest
+    std::vector<int> col_order;
+    std::vector<bool> col_ordered(ph.width);
+    auto traced_cols = traced_patch_columns.find(num);
+    if (traced_cols != traced_patch_columns.end()) {
+        for (int x : traced_cols->second) {
+            if (x < 0 || x >= ph.width) continue;
+            if (same[x]) x = same[x] - 1; // the trace records the column asked for
+            if (!col_ordered[x]) {
+                col_ordered[x] = true;
+                col_order.push_back(x);
+            }
+        }
+    }
+    for (int x = 0; x < ph.width; x++) {
+        if (!same[x] && !col_ordered[x]) col_order.push_back(x);
+    }
+    // once out of order, the next stored column no longer marks the end of a column's post metadata (which is read
+    // backwards), so it goes before the column's pixels instead, ending at its col_offset
+    bool reordered = !std::is_sorted(col_order.begin(), col_order.end());
+    bool meta_before_column = reordered && !fully_opaque;
+    if (meta_before_column) flags |= 8;
+    if (reordered) reordered_column_patch++;
+
     auto write_meta = [&](bool bit_aligned) {
+        std::lock_guard<std::mutex> lock(job_mutex); // for patch_run_stats
         auto bo = byte_vector_bit_output();
         col_offsets.clear();
         col_offsets.resize(ph.width+1);
@@ -1885,15 +2006,16 @@ for(int y=0;y<ph.height-1;y++) {
                 // however that breaks our ability to use the next columns start as our data end (we wouldn't be
                 // able to determine same_col from col_offset[same_col] at runtime to get col_offset[same_col+1]).
                 col_offsets[x] = -same[x];
-                continue;
-            } else {
+            }
+        }
+        for(int x : col_order) {
+            if (!meta_before_column) {
                 col_offsets[x] = bo.bit_size() / (bit_aligned ? 1 : 8);
+                // write the column data first
+                best_zposts[x]->write_to(bo);
             }
 
-            // write the column data first
-            best_zposts[x]->write_to(bo);
-
-            // column post metadata is afterwards and will be reversed
+            // column post metadata is afterwards (or before, see above) and will be reversed
             if (!fully_opaque) {
                 std::vector<bit_sequence> col_metadata;
                 uint32_t col_offset = *(uint32_t *) (patch.data.data() + 8 + x * 4);
@@ -1937,11 +2059,16 @@ for(int y=0;y<ph.height-1;y++) {
                 for(int i=col_metadata.size()-1;i>=0;i--) {
                     bo.write(col_metadata[i]);
                 }
+                if (meta_before_column) {
+                    col_offsets[x] = bo.bit_size() / (bit_aligned ? 1 : 8);
+                    best_zposts[x]->write_to(bo);
+                }
             } else {
                 if (!bit_aligned) bo.pad_to_byte();
             }
         }
         if (!bit_aligned) {
+            if (meta_before_column) bo.pad_to_byte();
             assert(!bo.bit_index()); // should already be aligned
         }
         col_offsets[ph.width] = bo.bit_size() / (bit_aligned ? 1 : 8);
@@ -2012,15 +2139,23 @@ for(int y=0;y<ph.height-1;y++) {
     auto c2 = output.get_output();
     p2.insert(p2.end(), c2.begin(), c2.end());
 #endif
-    printf("      encoding %d %d->%d ds %d\n", choice, (int)patch.data.size(), (int)p2.size(), best_decoder_size);
+    job_printf("      encoding %d %d->%d ds %d\n", choice, (int)patch.data.size(), (int)p2.size(), best_decoder_size);
     patch_orig_size.record(patch.data.size());
     patch.data = p2;
     patch_new_size.record(patch.data.size());
+}
+
+void commit_patch(wad &wad, int num, lump &patch) {
     wad.update_lump(patch);
     compressed.insert(num);
     touched[num] = TOUCHED_PATCH;
 }
 
+void convert_patch(wad &wad, int num, lump &patch) {
+    encode_patch(wad, num, patch);
+    commit_patch(wad, num, patch);
+}
+
 // use_runs = true to do runs of pixels, false to use 0 as transparent color
 void convert_vpatch(wad &wad, lump &patch, int max_colors, bool use_runs, std::set<int> colors, int shared_palette_handle, bool first) {
     touched[patch.num] = TOUCHED_VPATCH;
@@ -2248,13 +2383,14 @@ void convert_vpatches(wad &wad, const std::vector<std::string>& names, int max_c
     }
 }
 
-void convert_patches(wad &wad, std::string from_name, std::string to_name) {
+void convert_patches(wad &wad, std::string from_name, std::string to_name, const char *category) {
     lump pnames;
     int start = wad.get_lump_index(from_name);
     int end = wad.get_lump_index(to_name);
     std::set<int> pname_patches;
 
     std::set<std::string> temp_hack;
+    std::vector<lump> patches;
     for (int num = start + 1; num < end; num++) {
         lump patch;
         if (wad.get_lump(num, patch)) {
@@ -2267,24 +2403,56 @@ void convert_patches(wad &wad, std::string from_name, std::string to_name) {
 
             // for now remove the data
             //wad.remove_lump(name);
-
-            convert_patch(wad, num, patch);
-        } else {
-            printf("  %d - not found\n", num);
         }
+        patch.num = num; // no data means not found
+        patches.push_back(patch);
     }
+    parallel_convert(patches, [&](lump &patch) {
+        if (!patch.data.empty()) {
+            // the encoding chosen also depends on how hot the patch is
+            std::string variant;
+            if (decode_weight) {
+                char weight[64];
+                snprintf(weight, sizeof(weight), "decode_weight=%a\n", decode_weight * lump_hotness(patch.num));
+                variant = weight + decode_model.to_string();
+            }
+            // as does the order its columns are stored in
+            auto cols = traced_patch_columns.find(patch.num);
+            if (cols != traced_patch_columns.end()) {
+                variant += "column_order=";
+                for (int c : cols->second) variant += std::to_string(c) + ",";
+                variant += "\n";
+            }
+            whd_cache.convert(category, patch.data, patch.data, [&] {
+                encode_patch(wad, patch.num, patch);
+                return true;
+            }, variant);
+        }
+    }, [&](lump &patch) {
+        if (!patch.data.empty()) {
+            commit_patch(wad, patch.num, patch);
+        } else {
+            printf("  %d - not found\n", patch.num);
+        }
+    });
 }
 
 void dump_patch(const char *name, int num, lump &patch) {
     static std::set<int> dumped;
-    if (!dumped.insert(num).second) return;
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        if (!dumped.insert(num).second) return;
+    }
     dumped_patch_count++;
 #if 1
     const patch_header *ph = (const patch_header *)patch.data.data();
     patch_widths.record(ph->width);
     patch_heights.record(ph->height);
-    patch_width_stats.add(ph->width);
-    patch_height_stats.add(ph->height);
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        patch_width_stats.add(ph->width);
+        patch_height_stats.add(ph->height);
+    }
     patch_left_offsets.record(ph->leftoffset);
     patch_top_offsets.record(ph->topoffset);
     patch_sizes.record(ph->width * ph->height);
@@ -2351,9 +2519,9 @@ void dump_patch(const char *name, int num, lump &patch) {
     });
     auto c2 = output.get_output();
 #endif
-    printf("  %d %s - %dx%d +%d,%d colors %d\n", num, name, ph->width, ph->height, ph->leftoffset, ph->topoffset, (int)patch_color_set.size());
+    job_printf("  %d %s - %dx%d +%d,%d colors %d\n", num, name, ph->width, ph->height, ph->leftoffset, ph->topoffset, (int)patch_color_set.size());
     if (ph->width >= 256) {
-        printf("        wide\n");
+        job_printf("        wide\n");
     }
 }
 
@@ -3527,7 +3695,10 @@ lump get_free_lump(wad& wad) {
     return l;
 }
 
-std::vector<uint8_t> optimize_column(std::string name, int col, std::vector<uint8_t> cmds, const std::vector<int> local_patches, int height, int &seg_count) {
+// pixel_weight is bytes per pixel decoded (from -decode-weight), since some rewrites save metadata by decoding more of a
+// patch column
+std::vector<uint8_t> optimize_column(std::string name, int col, std::vector<uint8_t> cmds, const std::vector<int> local_patches, int height, int &seg_count,
+                                     double pixel_weight) {
     using seg = std::pair<int, std::vector<uint8_t>>;
 
     std::vector<seg> original_segs;
@@ -3618,6 +3789,23 @@ std::vector<uint8_t> optimize_column(std::string name, int col, std::vector<uint
         dump_segs(original_segs, "original");
     };
 #endif
+    // size of the segments as encoded below, plus pixel_weight for every pixel decoded (up to the bottom of each
+    // segment, see draw_composite_columns); a memcpy is cheap by comparison
+    auto weighted_size = [&](const std::vector<seg> &segs) {
+        double size = 0;
+        int y = 0;
+        for(const auto &e : segs) {
+            size += e.second.size() + (y != e.first);
+            if (!(e.second[0] & WHD_COL_SEG_MEMCPY)) size += pixel_weight * (e.second[3] + e.second[1]);
+            y = e.first + e.second[1];
+        }
+        return size;
+    };
+    // whether a rewrite which draws the same column is worth having; without -decode-weight they all are
+    auto worth = [&](const std::vector<seg> &old_segs, const std::vector<seg> &new_segs) {
+        return !pixel_weight || weighted_size(new_segs) <= weighted_size(old_segs);
+    };
+
     // first try and find patches that have been split by one or more patches in front... these fragments can be drawn
     // as a single run, then the one or more patches drawn over the front. (funnily enough this is how things are
     // specified in the first place!!!)
@@ -3635,7 +3823,7 @@ std::vector<uint8_t> optimize_column(std::string name, int col, std::vector<uint
                     new_segs.insert(new_segs.end(), segs.begin(), segs.begin() + candidate);
                     new_segs.insert(new_segs.end(), segs.begin() + candidate + 1, segs.end());
                     new_segs[match].second[1] = segs[candidate].first + segs[candidate].second[1] - segs[match].first;
-                    if (original_result == draw_column(new_segs)) {
+                    if (original_result == draw_column(new_segs) && worth(segs, new_segs)) {
                         segs = new_segs;
 #if DEBUG_TEXTURE_OPTIMIZATION
                         dump_segs(segs, "coalesce same part of same obscured %d and %d", match, candidate);
@@ -3673,14 +3861,14 @@ std::vector<uint8_t> optimize_column(std::string name, int col, std::vector<uint
                         0x80, segs[candidate].second[1], (uint8_t)(segs[match].first + to_data_top - from_data_top)
                     });
                     new_segs.insert(new_segs.end(), segs.begin() + candidate + 1, segs.end());
-                    if (original_result == draw_column(new_segs)) {
+                    if (original_result == draw_column(new_segs) && worth(segs, new_segs)) {
 #if DEBUG_TEXTURE_OPTIMIZATION
                         dump_segs(segs, "memcpy from %d to %d", match, candidate);
 #endif
                         segs = new_segs;
                     } else {
                         new_segs[candidate].second[0] |= WHD_COL_SEG_MEMCPY_IS_BACKWARDS;
-                        if (original_result == draw_column(new_segs)) {
+                        if (original_result == draw_column(new_segs) && worth(segs, new_segs)) {
 #if DEBUG_TEXTURE_OPTIMIZATION
                             dump_segs(segs, "backwards memcpy from %d to %d", match, candidate);
 #endif
@@ -3701,14 +3889,14 @@ std::vector<uint8_t> optimize_column(std::string name, int col, std::vector<uint
                             });
                             new_segs.insert(new_segs.end(), segs.begin() + match + 1 , segs.begin() + candidate);
                             new_segs.insert(new_segs.end(), segs.begin() + candidate + 1, segs.end());
-                            if (original_result == draw_column(new_segs)) {
+                            if (original_result == draw_column(new_segs) && worth(segs, new_segs)) {
 #if DEBUG_TEXTURE_OPTIMIZATION
                                 dump_segs(segs, "memcpy from %d to %d but with the latter moved next to the former", match, candidate);
 #endif
                                 segs = new_segs;
                             } else {
                                 new_segs[candidate].second[0] |= WHD_COL_SEG_MEMCPY_IS_BACKWARDS;
-                                if (original_result == draw_column(new_segs)) {
+                                if (original_result == draw_column(new_segs) && worth(segs, new_segs)) {
 #if DEBUG_TEXTURE_OPTIMIZATION
                                     dump_segs(segs, "memcpy backwards from %d to %d but with the latter moved next to the former", match, candidate);
 #endif
@@ -3737,7 +3925,7 @@ std::vector<uint8_t> optimize_column(std::string name, int col, std::vector<uint
                         new_segs.insert(new_segs.end(), segs.begin() + candidate + 1, segs.end());
                         new_segs[earlier].second[1] += segs[candidate].second[1];
                         // call with second arg = true (lenient) as we may produce an invalid memcpy here, but it is hard to check without doing the same work that draw_column does
-                        if (original_result == draw_column(new_segs, true)) {
+                        if (original_result == draw_column(new_segs, true) && worth(segs, new_segs)) {
                             // hail mary success!
                             segs = new_segs;
 #if DEBUG_TEXTURE_OPTIMIZATION
@@ -4021,6 +4209,30 @@ texture_index convert_textures(wad &wad) {
         int max_unique_col_patches = 0;
         int max_seg_count = 0;
         std::vector<uint8_t> metadata;
+        // -decode-weight: the texture is as hot as the hottest of its patches, which are touched whenever it is drawn.
+        // their encodings aren't chosen yet, but c3 is the usual one
+        double weight = 0;
+        double pixel_weight = 0;
+        uint composite_pixels = 0; // decoded to draw each column once (see draw_composite_columns)
+        if (decode_weight) {
+            for (const auto &mp : mpatches) weight = std::max(weight, decode_weight * lump_hotness(pname_lookup[mp.patch]));
+            pixel_weight = weight * decode_model.pixel_ns[PATCH_ENCODING_C3] / 1000;
+        }
+        auto column_pixels_decoded = [](const std::vector<uint8_t> &cmds) {
+            uint pixels = 0;
+            for (int i = 0; i < (int)cmds.size(); ) {
+                int m0 = cmds[i];
+                int length = (cmds[i + 1] & 0x7f) + 1;
+                i += 2 + ((m0 & WHD_COL_SEG_EXPLICIT_Y) != 0);
+                if (m0 & WHD_COL_SEG_MEMCPY) {
+                    i++;
+                } else {
+                    pixels += cmds[i + 1] + length;
+                    i += 2;
+                }
+            }
+            return pixels;
+        };
         if (tex_whd.patch_count) {
             std::vector<int> local_patches;
             std::vector<std::vector<uint8_t>> patch_runs(tex_whd.width);
@@ -4029,7 +4241,7 @@ texture_index convert_textures(wad &wad) {
                 std::set<int> unique_col_patches;
                 int last = -1;
                 int run = 0;
-                int localp;
+                int localp = 0xff; // a column may start out transparent
                 bool had_col_transparent = false;
                 for (int y = 0; y < tex_whd.height; y++) {
                     int p = pixel_patch[y * tex_whd.width + x];
@@ -4150,6 +4362,7 @@ texture_index convert_textures(wad &wad) {
                     }
                 }
                 if (x0 != x) {
+                    for (int xs = x; xs < x0; xs++) composite_pixels += column_pixels_decoded(patch_runs[xs]);
                     metadata.push_back(x0 - x - 1);
                     // bit of a waste of space, but keeps things length and "end" bit in the same place
                     metadata.push_back(0xff);
@@ -4179,8 +4392,11 @@ texture_index convert_textures(wad &wad) {
                 }
                 int seg_count = patch_runs[x].size() / 4;
                 if (have_repeat) {
-                    patch_runs[x] = optimize_column(name, x, patch_runs[x], local_patches, tex_whd.height, seg_count);
+                    // the column is drawn x2 - x times
+                    patch_runs[x] = optimize_column(name, x, patch_runs[x], local_patches, tex_whd.height, seg_count,
+                                                    pixel_weight * (x2 - x));
                 }
+                composite_pixels += column_pixels_decoded(patch_runs[x]) * (x2 - x);
                 max_seg_count = std::max(seg_count, max_seg_count);
                 metadata.push_back(x2 - x - 1);
                 metadata.insert(metadata.end(), patch_runs[x].begin(), patch_runs[x].end());
@@ -4191,22 +4407,52 @@ texture_index convert_textures(wad &wad) {
         if (tex_whd.patch_count && solid_patches != mtexture.patchcount) {
             printf("warning: multi patch transparent texture tex=%s\n", name.c_str()); // todo is this actually allowed on a per column basis (i.e. mix compostie cols with transparent non composite cols?)
         }
-        if (max_seg_count > WHD_MAX_COL_SEGS || max_unique_col_patches > WHD_MAX_COL_UNIQUE_PATCHES) {
+        auto flattened_patch = [&]() {
+            std::vector<int> pixels(tex_whd.width * tex_whd.height);
+            for(uint x=0;x<tex_whd.width;x++) {
+                for (uint y = 0; y < tex_whd.height; y++) {
+                    pixels[x+y*tex_whd.width] = column_pixels[x][y];
+                }
+            }
+            return image_to_patch(pixels, tex_whd.width, tex_whd.height);
+        };
+        bool too_complex = max_seg_count > WHD_MAX_COL_SEGS || max_unique_col_patches > WHD_MAX_COL_UNIQUE_PATCHES;
+        bool flatten = too_complex;
+        int flatten_extra_bytes = 0;
+        if (!too_complex && weight && tex_whd.patch_count && !had_transparent) {
+            // drawing a composite texture builds a decoder for each of its patches, and decodes each patch column down
+            // to the bottom of the part used, and overdraws; its own patch would take just the one decoder and pixel
+            const auto &model = decode_model;
+            double saved_us = (tex_whd.patch_count - 1) * model.decoder_ns[PATCH_ENCODING_C3] / 1000 +
+                              ((double)composite_pixels - tex_whd.width * tex_whd.height) * model.pixel_ns[PATCH_ENCODING_C3] / 1000;
+            if (saved_us > 0) {
+                lump trial;
+                trial.num = -1;
+                trial.data = flattened_patch();
+                encode_patch(wad, trial.num, trial);
+                flatten_extra_bytes = (int)trial.data.size() - (int)metadata.size();
+                if (flatten_extra_bytes < weight * saved_us) {
+                    flatten = true;
+                    decode_weighted_textures++;
+                    decode_weighted_texture_bytes += flatten_extra_bytes;
+                }
+            }
+        }
+        if (flatten) {
             auto new_patch = get_free_lump(wad);
             char lname[32];
             sprintf(lname, "_SYN%d", new_patch.num);
             new_patch.name = lname;
-            printf("warning: overly complex texture %s rendering as new patch %d\n", name.c_str(), new_patch.num);
+            if (too_complex) {
+                printf("warning: overly complex texture %s rendering as new patch %d\n", name.c_str(), new_patch.num);
+            } else {
+                printf("  decode weight: texture %s rendering as new patch %d for %d extra bytes\n", name.c_str(),
+                       new_patch.num, flatten_extra_bytes);
+            }
             tex_whd.patch_count = 0;
             tex_whd.patch0 = new_patch.num;
             metadata.clear();
-            std::vector<int> pixels(tex_whd.width * tex_whd.height);
-            for(uint x=0;x<tex_whd.width;x++) {
-                for (uint y = 0; y < tex_whd.height; y++) {
-                    pixels[x+y*tex_whd.width] = column_pixels[x][y];
-                }
-            }
-            new_patch.data = image_to_patch(pixels, tex_whd.width, tex_whd.height);
+            new_patch.data = flattened_patch();
             convert_patch(wad, new_patch.num, new_patch);
         } else {
             texture_col_metadata.record((int) metadata.size());
@@ -4273,6 +4519,90 @@ statsomizer flat_under_colors[] = {
         statsomizer("256 color flat"),
         };
 
+void encode_flat(lump &lump) {
+    std::set<uint8_t> colors;
+    for (const auto &p: lump.data) colors.insert(p);
+    assert(lump.data.size() == 64 * 64);
+    std::vector<int16_t> pix;
+    for (int y = 0; y < 64; y++) {
+        for (int x = 0; x < 64; x++) {
+            pix.push_back(lump.data[y * 64 + x]);
+        }
+    }
+    uint best = std::numeric_limits<uint>::max();
+    std::vector<std::shared_ptr<byte_vector_bit_output>> zposts;
+    std::vector<std::shared_ptr<byte_vector_bit_output>> best_zposts;
+    std::shared_ptr<byte_vector_bit_output> decoder_output;
+    std::shared_ptr<byte_vector_bit_output> best_decoder_output;
+    uint decoder_size;
+    uint best_decoder_size = 0;
+    int choice = 0;
+    auto choose = [&](int c, uint size) {
+        if (size < best) {
+            choice = c;
+            best = size;
+            best_zposts = zposts;
+            best_decoder_output = std::make_shared<byte_vector_bit_output>(*decoder_output);
+            best_decoder_size = decoder_size;
+        }
+        return size;
+    };
+    std::vector<int> same;
+    bool have_same;
+    auto posts = to_merged_posts(pix, 64, 64, same, have_same);
+    uint s1 = choose(0, consider_compress_pixels_only(lump.name, posts, decoder_output, zposts, 64, 64, decoder_size)); ((void)s1);
+#if !USE_PIXELS_ONLY_FLAT
+    uint s2 = choose(1, consider_compress3(lump.name, posts, decoder_output, zposts, 64, 64));
+#endif
+    if (best_decoder_size > WHD_FLAT_DECODER_MAX_SIZE) {
+        fail("flat decoder is too big %s %d", lump.name.c_str(), best_decoder_size);
+    }
+    fwinners[choice]++;
+    flat_rawsize.record(4096);
+    if (have_same) {
+        int savings = 0;
+        for (int i = 0; i < 64; i++) {
+            if (same[i]) {
+                savings += zposts[same[i] - 1]->bit_size();
+                savings -= 1 + bitcount8_table[i];
+            }
+        }
+        if (savings < 0) have_same = false;
+        flat_have_same_savings.record(have_same);
+    }
+    byte_vector_bit_output final_bo;
+#if !USE_PIXELS_ONLY_FLAT
+    assert(choice < 2);
+    final_bo.write(bit_sequence(choice, 1));
+#endif
+    decoder_output->write_to(final_bo);
+    final_bo.write(bit_sequence(have_same, 1));
+    for (int x = 0; x < 64; x++) {
+        if (have_same) {
+            final_bo.write(bit_sequence(same[x] != 0, 1));
+            if (same[x]) {
+                assert(!zposts[x]->bit_size());
+                assert(same[x] - 1 < x);
+                assert(!same[same[x] - 1]);
+                // todo down one
+                final_bo.write(bit_sequence(same[x] - 1, bitcount8_table[x]));
+            } else {
+                zposts[x]->write_to(final_bo);
+            }
+        } else {
+            zposts[x]->write_to(final_bo);
+        }
+    }
+    lump.data = final_bo.get_output();
+    flat_c2size.record(lump.data.size());
+    flat_colors.record(colors.size());
+    uint x = colors.size();
+    if (x) x--;
+    x = 31 - __builtin_clz(x);
+    assert(x < 8);
+    flat_under_colors[x].record(colors.size());
+}
+
 void convert_flats(wad &wad) {
     int fstart = wad.get_lump_index("f_start");
     int fend = wad.get_lump_index("f_end");
@@ -4283,6 +4613,7 @@ void convert_flats(wad &wad) {
     std::vector<uint8_t> special_to_flat(special_flats.size());
     std::fill(special_to_flat.begin(), special_to_flat.end(), 0xff);
     std::vector<uint8_t> flat_to_special;
+    std::vector<lump> flats;
     for (int f = fstart+1; f < fend; f++) {
         // todo we only need flats mentioned in sectors (or well known)
         lump lump;
@@ -4295,94 +4626,21 @@ void convert_flats(wad &wad) {
             } else {
                 flat_to_special.push_back(0xff);
             }
-            std::set<uint8_t> colors;
-            for (const auto &p: lump.data) colors.insert(p);
-            assert(lump.data.size() == 64 * 64);
-            std::vector<int16_t> pix;
-            for (int y = 0; y < 64; y++) {
-                for (int x = 0; x < 64; x++) {
-                    pix.push_back(lump.data[y * 64 + x]);
-                }
-            }
-            uint best = std::numeric_limits<uint>::max();
-            std::vector<std::shared_ptr<byte_vector_bit_output>> zposts;
-            std::vector<std::shared_ptr<byte_vector_bit_output>> best_zposts;
-            std::shared_ptr<byte_vector_bit_output> decoder_output;
-            std::shared_ptr<byte_vector_bit_output> best_decoder_output;
-            uint decoder_size;
-            uint best_decoder_size;
-            int choice = 0;
-            auto choose = [&](int c, uint size) {
-                if (size < best) {
-                    choice = c;
-                    best = size;
-                    best_zposts = zposts;
-                    best_decoder_output = std::make_shared<byte_vector_bit_output>(*decoder_output);
-                    best_decoder_size = decoder_size;
-                }
-                return size;
-            };
-            std::vector<int> same;
-            bool have_same;
-            auto posts = to_merged_posts(pix, 64, 64, same, have_same);
-            uint s1 = choose(0, consider_compress_pixels_only(lump.name, posts, decoder_output, zposts, 64, 64, decoder_size)); ((void)s1);
-#if !USE_PIXELS_ONLY_FLAT
-            uint s2 = choose(1, consider_compress3(lump.name, posts, decoder_output, zposts, 64, 64));
-#endif
-            if (best_decoder_size > WHD_FLAT_DECODER_MAX_SIZE) {
-                fail("flat decoder is too big %s %d", lump.name.c_str(), best_decoder_size);
-            }
-            fwinners[choice]++;
-            flat_rawsize.record(4096);
-            if (have_same) {
-                int savings = 0;
-                for (int i = 0; i < 64; i++) {
-                    if (same[i]) {
-                        savings += zposts[same[i] - 1]->bit_size();
-                        savings -= 1 + bitcount8_table[i];
-                    }
-                }
-                if (savings < 0) have_same = false;
-                flat_have_same_savings.record(have_same);
-            }
-            byte_vector_bit_output final_bo;
-#if !USE_PIXELS_ONLY_FLAT
-            assert(choice < 2);
-            final_bo.write(bit_sequence(choice, 1));
-#endif
-            decoder_output->write_to(final_bo);
-            final_bo.write(bit_sequence(have_same, 1));
-            for (int x = 0; x < 64; x++) {
-                if (have_same) {
-                    final_bo.write(bit_sequence(same[x] != 0, 1));
-                    if (same[x]) {
-                        assert(!zposts[x]->bit_size());
-                        assert(same[x] - 1 < x);
-                        assert(!same[same[x] - 1]);
-                        // todo down one
-                        final_bo.write(bit_sequence(same[x] - 1, bitcount8_table[x]));
-                    } else {
-                        zposts[x]->write_to(final_bo);
-                    }
-                } else {
-                    zposts[x]->write_to(final_bo);
-                }
-            }
-            compressed.insert(f);
-            touched[f] = TOUCHED_FLAT;
-            lump.data = final_bo.get_output();
-            flat_c2size.record(lump.data.size());
-            wad.update_lump(lump);
-            flat_colors.record(colors.size());
-            uint x = colors.size();
-            if (x) x--;
-            x = 31 - __builtin_clz(x);
-            assert(x < 8);
-            flat_under_colors[x].record(colors.size());
+            flats.push_back(lump);
         } else {
             flat_to_special.push_back(0xff);
         }
     }
+    parallel_convert(flats, [&](lump &lump) {
+        whd_cache.convert("flat", lump.data, lump.data, [&] {
+            encode_flat(lump);
+            return true;
+        });
+    }, [&](lump &lump) {
+        compressed.insert(lump.num);
+        touched[lump.num] = TOUCHED_FLAT;
+        wad.update_lump(lump);
+    });
     lump fstart_lump;
     wad.get_lump("f_start", fstart_lump);
     fstart_lump.data = special_to_flat;
@@ -4479,7 +4737,11 @@ void convert_music(std::pair<const int, lump> &e) {
 #if USE_MUSX
     auto &h = e.second.data;
     if (h[0] == 'M' && h[1] == 'U' && h[2] == 'S' && h[3] == 26) {
-        auto new_mus = compress_mus(e);
+        std::vector<uint8_t> new_mus;
+        whd_cache.convert("music", h, new_mus, [&] {
+            new_mus = compress_mus(e);
+            return true;
+        });
         int original_size = e.second.data.size();
         h.clear();
         h.push_back('M');
@@ -4595,12 +4857,15 @@ bool convert_sound(std::pair<const int, lump> &e) {
         return false;
     }
 
-    name_required.insert(lump.name);
+    {
+        std::lock_guard<std::mutex> lock(job_mutex);
+        name_required.insert(lump.name);
+    }
     // 16 bit sample rate field, 32 bit length field
 
     int samplerate = (data[3] << 8) | data[2];
     if (samplerate != 11025) {
-        printf("oou %s %d\n", lump.name.c_str(), samplerate);
+        job_printf("oou %s %d\n", lump.name.c_str(), samplerate);
     }
     int length = (data[7] << 24) | (data[6] << 16) | (data[5] << 8) | data[4];
 
@@ -4642,7 +4907,6 @@ bool convert_sound(std::pair<const int, lump> &e) {
     ) < 0) {
         return false;
     }
-    compressed.insert(e.first);
     sfx_orig_size.record(e.second.data.size());
     e.second.data = out;
     sfx_new_size.record(e.second.data.size());
@@ -4719,6 +4983,9 @@ std::vector<uint8_t> png_to_patch(wad& wad, const char *prefix, const char *name
 int main(int argc, const char **argv) {
     hash = 0;
     int argn = 1;
+    const char *cache_dir = nullptr;
+    const char *trace_name = nullptr;
+    const char *calibrate_name = nullptr;
     auto next_arg = [&](bool required = true) {
         if (argn >= argc) {
             if (required) usage();
@@ -4726,6 +4993,29 @@ int main(int argc, const char **argv) {
         }
         if (!strcmp(argv[argn], "-no-super-tiny")) {
             super_tiny = false;
+        } else if (!strcmp(argv[argn], "-j")) {
+            if (argn + 1 >= argc) usage();
+            whd_gen_threads = std::max(1, atoi(argv[++argn]));
+        } else if (!strcmp(argv[argn], "-cache")) {
+            if (argn + 1 >= argc) usage();
+            cache_dir = argv[++argn];
+        } else if (!strcmp(argv[argn], "-order")) {
+            if (argn + 1 >= argc) usage();
+            trace_name = argv[++argn];
+        } else if (!strcmp(argv[argn], "-decode-weight")) {
+            if (argn + 1 >= argc) usage();
+            decode_weight = std::max(0.0, atof(argv[++argn]));
+        } else if (!strcmp(argv[argn], "-decode-model")) {
+            if (argn + 1 >= argc) usage();
+            argn++;
+            if (!strcmp(argv[argn], "rp2040")) {
+                decode_model = rp2040_decode_cost_model;
+            } else {
+                decode_model.read(argv[argn]);
+            }
+        } else if (!strcmp(argv[argn], "-calibrate-decode")) {
+            if (argn + 1 >= argc) usage();
+            calibrate_name = argv[++argn];
         }
         return argv[argn++];
     };
@@ -4738,7 +5028,41 @@ int main(int argc, const char **argv) {
         }
         printf("LUMPS ORIG SIZE %d\n", size);
         auto output_filename = next_arg();
-        next_arg(false); // check for more options
+        while (next_arg(false)); // check for more options
+        std::vector<std::vector<int>> trace;
+        if (trace_name) {
+            trace = read_lump_trace(trace_name);
+            traced_frames = trace.size();
+            for (const auto &frame : trace) {
+                for (int l : frame) {
+                    if (l < 0) continue;
+                    if (l >= (int)lump_frame_counts.size()) lump_frame_counts.resize(l + 1);
+                    lump_frame_counts[l]++; // a lump appears at most once per frame
+                }
+            }
+        }
+        if (calibrate_name) decode_calibration.reset(new decode_cost_calibration());
+        if (cache_dir && decode_calibration) {
+            printf("Not using the cache, so every patch is encoded (and timed) for -calibrate-decode\n");
+            cache_dir = nullptr;
+        }
+        if (cache_dir) {
+            // everything (other than the lump itself) which may change the result of a cached conversion
+            char options[128];
+            snprintf(options, sizeof(options), "super_tiny=%d lookahead=%d pixels_only=%d,%d", super_tiny, LOOKAHEAD,
+#if USE_PIXELS_ONLY_PATCH
+                     1,
+#else
+                     0,
+#endif
+#if USE_PIXELS_ONLY_FLAT
+                     1
+#else
+                     0
+#endif
+                     );
+            whd_cache.open(cache_dir, options);
+        }
         const char *pos = std::max(strrchr(wad_name, '\\'), strrchr(wad_name, '/'));
         if (pos) pos++;
         else pos = wad_name;
@@ -4821,8 +5145,9 @@ int main(int argc, const char **argv) {
             }
             auto textz = std::make_shared<byte_vector_bit_output>();
             auto attrz = std::make_shared<byte_vector_bit_output>();
-            printf("ENDOOM TEXT %d %d\n", (int)text.size(), consider_compress_data("text", text, textz));
-            printf("ENDOOM ATTR %d %d\n", (int)attr.size(), consider_compress_data("attr", attr, attrz));
+            double weight = decode_weight * lump_hotness(endoom.num);
+            printf("ENDOOM TEXT %d %d\n", (int)text.size(), consider_compress_data("text", text, textz, weight));
+            printf("ENDOOM ATTR %d %d\n", (int)attr.size(), consider_compress_data("attr", attr, attrz, weight));
             byte_vector_bit_output combined;
             textz->write_to(combined);
             attrz->write_to(combined);
@@ -4844,7 +5169,7 @@ int main(int argc, const char **argv) {
 
 
         for(auto &s : named_lumps) name_required.insert(s);
-        convert_patches(wad, "p_start", "p_end");
+        convert_patches(wad, "p_start", "p_end", "patch");
         std::vector<uint8_t> vpatch_lookup;
         int vp_num=0;
         for(const auto &n : vpatch_names) {
@@ -4889,7 +5214,7 @@ int main(int argc, const char **argv) {
         touched[s_start_lump.num] = TOUCHED_SPRITE_METADATA;
         s_start_lump.data = sprite_metadata;
         wad.update_lump(s_start_lump);
-        convert_patches(wad, "s_start", "s_end");
+        convert_patches(wad, "s_start", "s_end", "sprite");
         for (const auto &cg : splash_graphics) {
             lump l;
             int indexp1 = wad.get_lump(cg, l);
@@ -4956,15 +5281,28 @@ int main(int argc, const char **argv) {
 
         convert_flats(wad);
         // filter again
+        std::vector<std::pair<std::pair<const int, lump> *, bool>> sounds;
         for (auto &e : wad.get_lumps()) {
             if (sfx_lumpnames.find(to_lower(e.second.name)) != sfx_lumpnames.end()) {
-                if (!convert_sound(e)) {
-                    printf("Failed to convert sound %s\n", e.second.name.c_str());
-                    // todo remove?
-                }
-                touched[e.first] = TOUCHED_SFX;
+                sounds.emplace_back(&e, false);
+            }
+        }
+        parallel_convert(sounds, [&](auto &s) {
+            auto &data = s.first->second.data;
+            s.second = whd_cache.convert("sfx", data, data, [&] {
+                return convert_sound(*s.first);
+            });
+        }, [&](auto &s) {
+            if (!s.second) {
+                printf("Failed to convert sound %s\n", s.first->second.name.c_str());
+                // todo remove?
+            } else {
+                std::lock_guard<std::mutex> lock(job_mutex);
+                name_required.insert(s.first->second.name); // convert_sound isn't called if it was cached
+                compressed.insert(s.first->first);
             }
-        }
+            touched[s.first->first] = TOUCHED_SFX;
+        });
         for (auto &e : wad.get_lumps()) {
             if (e.second.name.substr(0, 5) == "WIMAP") {
                 //dump_patch(e.second.name.c_str(), e.first, e.second);
@@ -5237,7 +5575,13 @@ int main(int argc, const char **argv) {
         same_columns.print_summary();
 
         for(i=0;i<(int)winners.size();i++) {
-            printf("WIN %d %d\n", i, winners[i]);
+            printf("WIN %d %d\n", i, (int)winners[i]);
+        }
+        if (decode_weight) {
+            printf("DECODE WEIGHT %d patches use a faster encoding for %d extra bytes\n", (int)decode_weighted_patches,
+                   (int)decode_weighted_bytes);
+            printf("DECODE WEIGHT %d composite textures rendered as a patch for %d extra bytes\n", decode_weighted_textures,
+                   decode_weighted_texture_bytes);
         }
         patch_pixels.print_summary();
         cp1_pixels.print_summary();
@@ -5248,9 +5592,10 @@ int main(int argc, const char **argv) {
         cp1_run.print_summary();
         cp1_raw_run.print_summary();
         cp_size.print_summary();
-        printf("Bit addressable %d\n", bit_addressable_patch);
-        printf("Dumped patches %d Converted patches %d Size %d\n", dumped_patch_count, converted_patch_count, converted_patch_size);
-        printf("Opaque %d Transparent %d total %d\n", opaque_pixels, transparent_pixels, opaque_pixels + transparent_pixels);
+        printf("Bit addressable %d\n", (int)bit_addressable_patch);
+        if (reordered_column_patch) printf("Columns in trace order %d\n", (int)reordered_column_patch);
+        printf("Dumped patches %d Converted patches %d Size %d\n", (int)dumped_patch_count, (int)converted_patch_count, (int)converted_patch_size);
+        printf("Opaque %d Transparent %d total %d\n", (int)opaque_pixels, (int)transparent_pixels, opaque_pixels + transparent_pixels);
         flat_rawsize.print_summary();
         flat_c2size.print_summary();
         flat_have_same_savings.print_summary();
@@ -5259,7 +5604,7 @@ int main(int argc, const char **argv) {
             s.print_summary();
         }
         for(i=0;i<(int)fwinners.size();i++) {
-            printf("FWIN %d %d\n", i, fwinners[i]);
+            printf("FWIN %d %d\n", i, (int)fwinners[i]);
         }
 
         color_runs.print_summary();
@@ -5272,7 +5617,9 @@ int main(int argc, const char **argv) {
         demo_size_orig.print_summary();
         demo_size.print_summary();
         single_patch_metadata_size.print_summary();
-        wad.write_whd(output_filename, name_required, hash, super_tiny);
+        wad.write_whd(output_filename, name_required, hash, super_tiny, trace);
+        whd_cache.print_report();
+        if (decode_calibration) decode_calibration->write(calibrate_name);
         size = 0;
         for(const auto &e : wad.get_lumps()) {
             size += e.second.data.size();
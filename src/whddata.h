@@ -770,6 +770,11 @@ typedef PACKED_STRUCT({
 static_assert(sizeof(whdheader_t)==24, "");
 extern const whdheader_t *whdheader;
 
+// set in the end marker (the offset after the last lump) when the lump data is not stored in lump order (whd_gen -order).
+// the size of a lump can't then be implied from the offset of the next one, so a uint32_t size for each lump follows
+// the named lumps
+#define WHD_LUMP_SIZES_PRESENT 0x80000000u
+
 #define WHD_MAX_COL_SEGS 8 // todo may be smaller
 #define WHD_MAX_COL_UNIQUE_PATCHES 4  // 4 * 128 = 512 which is how big we like to keep the decoder_tmp in pd_render_nh (when used for decoding)
 